@@ -1 +1,4 @@
-gcc -o graph graph.c -lpthread -lwayland-client -lcairo -lrt
+XDG_SHELL=$(pkg-config --variable=pkgdatadir wayland-protocols)/stable/xdg-shell/xdg-shell.xml
+wayland-scanner client-header "$XDG_SHELL" xdg-shell-client-protocol.h
+wayland-scanner private-code "$XDG_SHELL" xdg-shell-protocol.c
+gcc -o graph graph.c xdg-shell-protocol.c -lpthread -lwayland-client -lcairo -lrt
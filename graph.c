@@ -3,40 +3,129 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <termios.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <errno.h>
+#include <sys/select.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <linux/input-event-codes.h>
 #include <wayland-client.h>
 #include <cairo/cairo.h>
+#include "xdg-shell-client-protocol.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define SERIAL_PORT "/dev/ttyS0" // change this to your serial port
 #define SERIAL_BAUD B9600 // change this to your baud rate
-#define SERIAL_BUFFER_SIZE 256 // change this to your buffer size
+#define SERIAL_BUFFER_SIZE 1024 // change this to your maximum line length
+#define SERIAL_READ_BUFFER_SIZE 16384 // change this to your serial read buffer size
+#define CSV_MAX_FIELDS 64 // change this to your maximum number of csv fields per line
+#define CSV_MAX_CHANNELS 32 // change this to your maximum number of y channels per line
+#define CSV_CHUNK_POINTS 65536 // change this to the number of points per storage chunk (a power of two)
+#define CSV_MAX_CHUNKS 32768 // change this to the maximum number of storage chunks
+#define CSV_LOD_BASE_SHIFT 4 // change this to log2 of the number of points per block of the finest pyramid level
+#define CSV_LOD_LEVEL_SHIFT 2 // change this to log2 of the block size ratio between two pyramid levels
+#define CSV_LOD_LEVELS 7 // change this to the number of pyramid levels (the coarsest block must fit in a chunk)
+#define SAMPLE_QUEUE_SIZE 16384 // change this to the number of parsed samples the ingest queue can hold (a power of two)
+#define SHM_BUCKET_MIN_SIZE (1 << 20) // Smallest shared memory slot per buffer, slots grow in powers of two
+#define WINDOW_MIN_PLOT_SIZE 20 // Smallest plot area in pixels when the window is resized
+#define SHM_BUFFER_COUNT 3 // change this to the number of wl_shm buffers (2 for double, 3 for triple buffering)
 #define GRAPH_WIDTH 800 // change this to your graph width
 #define GRAPH_HEIGHT 600 // change this to your graph height
 #define GRAPH_MARGIN 50 // change this to your graph margin
 
-// A struct to store the csv data
+// The number of chunks actually filled, capped so the number of points (an int) never wraps
+#define CSV_CHUNK_LIMIT ((CSV_MAX_CHUNKS < INT_MAX / CSV_CHUNK_POINTS) ? CSV_MAX_CHUNKS : INT_MAX / CSV_CHUNK_POINTS)
+
+// A struct to store one fixed-size chunk of the csv data as columns, one contiguous array per value
 typedef struct {
-    double x; // the x value
-    double y; // the y value
+    double *x; // the x values (first csv column), shared by all channels
+    double *y[CSV_MAX_CHANNELS]; // the y values of each channel (remaining csv columns)
+    double *lod_min[CSV_MAX_CHANNELS]; // the minimum y value of each pyramid block of each channel
+    double *lod_max[CSV_MAX_CHANNELS]; // the maximum y value of each pyramid block of each channel
+} csv_chunk_t;
+
+// A struct to store the csv data as a directory of chunks, so appending never moves existing points
+// The directory has a fixed size so a chunk never moves either, and published points are never modified
+typedef struct {
+    csv_chunk_t *chunks[CSV_MAX_CHUNKS]; // the chunk directory, point i is at offset i % CSV_CHUNK_POINTS of chunk i / CSV_CHUNK_POINTS
+    int chunk_count; // the number of chunks in use
+    int channels; // the number of y channels, latched by the queue consumer from the first sample it drains
 } csv_data_t;
 
-// A global variable to store the csv data array
-csv_data_t *csv_data = NULL;
+// A global variable to store the csv data columns
+csv_data_t csv_data = {0};
 
 // A global variable to store the csv data size
 int csv_data_size = 0;
 
-// Mutex for protecting csv_data access
-pthread_mutex_t csv_data_mutex = PTHREAD_MUTEX_INITIALIZER;
+// A struct to store the range of the x values and of the y values over all channels
+typedef struct {
+    double min_x;
+    double max_x;
+    double min_y;
+    double max_y;
+} csv_range_t;
+
+// A struct to describe a consistent view of the csv data
+// Points are numbered from 0 in arrival order, the view covers points start .. start + count - 1
+typedef struct {
+    unsigned long start; // the number of the oldest point in the view
+    int count; // the number of points in the view
+    unsigned long generation; // the total number of points added so far, changes whenever points are added
+    csv_range_t range; // the range of the points in the view, maintained incrementally as points are added
+} csv_snapshot_t;
+
+// A struct to publish the latest snapshot of the csv data with a sequence lock
+typedef struct {
+    atomic_uint sequence; // odd while the writer is updating the fields below
+    atomic_ulong start;
+    atomic_int count;
+    atomic_ulong generation;
+    _Atomic double min_x;
+    _Atomic double max_x;
+    _Atomic double min_y;
+    _Atomic double max_y;
+} csv_snapshot_header_t;
+
+// A global variable to store the published snapshot header
+csv_snapshot_header_t csv_snapshot_header;
+
+// A global variable to store the total number of points added to the csv data
+unsigned long csv_data_generation = 0;
+
+// A global variable to store the range of the csv data, extended as points are appended
+csv_range_t csv_data_range;
+
+// Trace colors for the channels (red for the first channel, then cycling through the rest)
+#define TRACE_COLOR_COUNT 8
+const double trace_colors[TRACE_COLOR_COUNT][3] = {
+    {1.0, 0.0, 0.0}, // red
+    {0.0, 0.0, 1.0}, // blue
+    {0.0, 0.6, 0.0}, // green
+    {1.0, 0.5, 0.0}, // orange
+    {0.6, 0.0, 0.8}, // purple
+    {0.0, 0.7, 0.7}, // teal
+    {0.7, 0.7, 0.0}, // olive
+    {0.5, 0.3, 0.1}, // brown
+};
 
 // A global variable to store the serial port file descriptor
 int serial_fd = -1;
 
+// Global variables to store the window size, it starts at GRAPH_WIDTH x GRAPH_HEIGHT and follows configure events
+int graph_width = GRAPH_WIDTH;
+int graph_height = GRAPH_HEIGHT;
+
 // A global variable to store the wayland display
 struct wl_display *display = NULL;
 
@@ -58,12 +147,76 @@ struct wl_surface *surface = NULL;
 // A global variable to store the wayland shell surface
 struct wl_shell_surface *shell_surface = NULL;
 
-// A global variable to store the wayland buffer
-struct wl_buffer *buffer = NULL;
+// A global variable to store the xdg shell, used instead of the wayland shell when the compositor has it
+struct xdg_wm_base *wm_base = NULL;
+
+// A global variable to store the xdg surface
+struct xdg_surface *xdg_surface = NULL;
+
+// A global variable to store the xdg toplevel window
+struct xdg_toplevel *xdg_toplevel = NULL;
+
+// Global variables to store the size asked by the last toplevel configure event (0 when left to the program)
+int32_t configure_width = 0;
+int32_t configure_height = 0;
+
+// A global flag set once the first configure event is acknowledged, no buffer may be attached before
+int configured = 0;
+
+// A global flag set when the user closes the window
+int window_closed = 0;
 
-// Shared memory file descriptor and data
+// A struct to store one wl_buffer of the shared memory pool
+typedef struct {
+    struct wl_buffer *buffer; // the wayland buffer
+    void *data; // the pixels of the buffer inside the shared memory
+    int busy; // set from commit until the compositor releases the buffer
+    size_t offset; // the offset of the pixels in the shared memory pool
+    int width; // the size of the buffer, it is created again when the window size changes
+    int height;
+} shm_buffer_t;
+
+// A global variable to store the wayland buffers, drawn into in turn so a held buffer is never redrawn
+shm_buffer_t shm_buffers[SHM_BUFFER_COUNT];
+
+// A global variable to store the shared memory pool the buffers are carved from, kept for the whole run
+struct wl_shm_pool *shm_pool = NULL;
+
+// Shared memory file descriptor, data and size, mapped once for all buffers and mapped again when the pool grows
 int shm_fd = -1;
 void *shm_data = NULL;
+size_t shm_size = 0;
+
+// Global variables to store where the current buffer slots start in the pool and the size of each slot
+size_t shm_slot_offset = 0;
+size_t shm_slot_size = 0;
+
+// A global flag set when the graph has to be drawn again (new data, input or the first frame)
+int redraw_needed = 1;
+
+// A global flag set from a commit until the compositor asks for the next frame with the frame callback
+int frame_pending = 0;
+
+// A global variable to store the wayland seat
+struct wl_seat *seat = NULL;
+
+// A global variable to store the wayland pointer of the seat
+struct wl_pointer *pointer = NULL;
+
+// A global variable to store the pointer x position in the window and whether it is dragging the view
+double pointer_x = 0.0;
+int pointer_dragging = 0;
+
+// A global variable to store whether the view follows the whole csv data (autoscale) or a zoomed x range
+int view_follow = 1;
+
+// Global variables to store the x range of the view when it does not follow the csv data
+double view_min_x = 0.0;
+double view_max_x = 1.0;
+
+// Global variables to store the x scale and offset of the last frame, used to map the pointer to x values
+double view_scale_x = 1.0;
+double view_offset_x = 0.0;
 
 // A function to create a shared memory file
 int create_shm_file(size_t size) {
@@ -141,74 +294,714 @@ int serial_init() {
     return 0;
 }
 
-// A function to read a line from the serial port
-int serial_read_line(char *buffer, int size) {
-    int index = 0; // the current index of the buffer
-    char c; // the current character read from the serial port
+// A struct to store bytes read from the serial port until they form complete lines
+typedef struct {
+    char data[SERIAL_READ_BUFFER_SIZE + 1]; // the received bytes (+1 so a line can always be null terminated)
+    size_t head; // the index of the first byte not yet handed out as a line
+    size_t tail; // the index one past the last byte received
+    size_t scanned; // the number of bytes after head already searched for a line break
+    int discarding; // set while skipping the rest of an overlong line
+} serial_reader_t;
+
+// A function to find the first occurrence of either of two characters in a block of memory
+const char *find_either_char(const char *data, size_t size, char a, char b) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // Compare 16 bytes at a time and stop at the first block containing a match
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; i + 16 <= size; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, va), _mm_cmpeq_epi8(block, vb)));
+        if (mask != 0) {
+            return data + i + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    // Check the remaining bytes one by one
+    for (; i < size; i++) {
+        if (data[i] == a || data[i] == b) {
+            return data + i;
+        }
+    }
+
+    return NULL;
+}
+
+// A function to read whatever the serial port has buffered into the reader in a single call
+// Returns the number of bytes read (0 when the port is drained), -2 at end of file or -1 on error
+ssize_t serial_reader_fill(serial_reader_t *reader, int fd) {
+    // Move the partial line left over from the previous read to the front of the buffer
+    if (reader->head > 0) {
+        size_t pending = reader->tail - reader->head;
+        memmove(reader->data, reader->data + reader->head, pending);
+        reader->head = 0;
+        reader->tail = pending;
+    }
 
-    // Loop until the buffer is full or a newline character is read
-    while (index < size - 1) {
-        // Read one character from the serial port
-        if (read(serial_fd, &c, 1) == 1) {
-            // If the character is a newline or carriage return, break the loop
-            if (c == '\n' || c == '\r') {
-                break;
+    // Read as many bytes as fit in the remaining space
+    ssize_t count = read(fd, reader->data + reader->tail, SERIAL_READ_BUFFER_SIZE - reader->tail);
+    if (count > 0) {
+        reader->tail += count;
+    } else if (count == 0) {
+        // Nothing to read although select reported the port readable, the other end was closed
+        count = -2;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        // The port is drained, the caller should go back to select
+        count = 0;
+    }
+
+    return count;
+}
+
+// A function to get the next complete line from the reader without copying it
+// Returns a null terminated pointer into the reader buffer (valid until the next fill) or NULL
+char *serial_reader_next_line(serial_reader_t *reader, size_t *length) {
+    while (1) {
+        char *line = reader->data + reader->head;
+        size_t pending = reader->tail - reader->head;
+
+        // Search only the bytes that were not searched by a previous call
+        const char *end = find_either_char(line + reader->scanned, pending - reader->scanned, '\n', '\r');
+        if (end == NULL) {
+            reader->scanned = pending;
+
+            // A line that does not fit the line size limit is dropped up to its line break
+            if (pending >= SERIAL_BUFFER_SIZE) {
+                if (!reader->discarding) {
+                    fprintf(stderr, "Discarding serial line longer than %d characters\n", SERIAL_BUFFER_SIZE - 1);
+                }
+                reader->discarding = 1;
+                reader->head = reader->tail;
+                reader->scanned = 0;
             }
-            // Otherwise, store the character in the buffer and increment the index
-            buffer[index] = c;
-            index++;
+            return NULL;
+        }
+
+        // Terminate the line in place and advance past the line break
+        size_t size = end - line;
+        line[size] = '\0';
+        reader->head += size + 1;
+        reader->scanned = 0;
+
+        // Skip the tail of a line that was discarded because it was too long
+        if (reader->discarding) {
+            reader->discarding = 0;
+            continue;
         }
+        if (size >= SERIAL_BUFFER_SIZE) {
+            fprintf(stderr, "Discarding serial line longer than %d characters\n", SERIAL_BUFFER_SIZE - 1);
+            continue;
+        }
+
+        *length = size;
+        return line;
     }
+}
 
-    // Terminate the buffer with a null character
-    buffer[index] = '\0';
+// Powers of ten that are exactly representable as doubles, used by the fast float parser
+const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
-    // Return the number of characters read
-    return index;
+// A function to find the positions of the commas in a csv line (16 bytes at a time with SSE2)
+// Returns the number of commas found, at most max_commas
+int csv_find_delimiters(const char *line, size_t length, size_t *commas, int max_commas) {
+    int count = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // Build a bit mask of the commas in each block and walk its set bits
+    const __m128i comma = _mm_set1_epi8(',');
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(line + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, comma));
+        while (mask != 0) {
+            if (count == max_commas) {
+                return count;
+            }
+            commas[count++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    // Check the remaining bytes one by one
+    for (; i < length; i++) {
+        if (line[i] == ',') {
+            if (count == max_commas) {
+                return count;
+            }
+            commas[count++] = i;
+        }
+    }
+
+    return count;
 }
 
-// A function to parse a csv line and store the data in the global array
-int csv_parse_line(char *line) {
-    // Skip empty lines
-    if (strlen(line) == 0) {
+// A function to parse a double from the characters between start and end, without locale or allocation
+// Plain integers and decimals are converted exactly in a fast path, anything else is handed to strtod,
+// so the result is always bit-identical to strtod. Returns 0 on success or -1 if the field is not a number.
+int parse_double(const char *start, const char *end, double *value) {
+    // Trim surrounding spaces and tabs
+    while (start < end && (*start == ' ' || *start == '\t')) {
+        start++;
+    }
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    if (start == end) {
+        return -1;
+    }
+
+    const char *p = start;
+    int negative = 0;
+    if (*p == '+' || *p == '-') {
+        negative = (*p == '-');
+        p++;
+    }
+
+    // Accumulate the significant digits of the integer and fraction parts
+    uint64_t mantissa = 0;
+    int digits = 0; // the number of significant digits in the mantissa
+    int exponent = 0; // the decimal exponent applied to the mantissa
+    int seen_digit = 0;
+    for (; p < end && (unsigned)(*p - '0') < 10; p++) {
+        if (mantissa != 0 || *p != '0') {
+            digits++;
+        }
+        mantissa = mantissa * 10 + (*p - '0');
+        seen_digit = 1;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        for (; p < end && (unsigned)(*p - '0') < 10; p++) {
+            if (mantissa != 0 || *p != '0') {
+                digits++;
+            }
+            mantissa = mantissa * 10 + (*p - '0');
+            exponent--;
+            seen_digit = 1;
+        }
+    }
+
+    // Let strtod handle inf, nan, hex floats and mantissas that may not fit 64 bits
+    if (!seen_digit || digits > 19) {
+        goto fallback;
+    }
+
+    // Parse an optional exponent
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        int exponent_negative = 0;
+        if (p < end && (*p == '+' || *p == '-')) {
+            exponent_negative = (*p == '-');
+            p++;
+        }
+        if (p == end || (unsigned)(*p - '0') >= 10) {
+            return -1;
+        }
+        int explicit_exponent = 0;
+        for (; p < end && (unsigned)(*p - '0') < 10; p++) {
+            if (explicit_exponent < 100000) {
+                explicit_exponent = explicit_exponent * 10 + (*p - '0');
+            }
+        }
+        exponent += exponent_negative ? -explicit_exponent : explicit_exponent;
+    }
+
+    // Anything left over is either garbage or a form only strtod understands
+    if (p != end) {
+        goto fallback;
+    }
+
+    if (mantissa == 0) {
+        *value = negative ? -0.0 : 0.0;
+        return 0;
+    }
+
+    // Both the mantissa and the power of ten are exact doubles, so a single
+    // correctly rounded multiply or divide gives the same result as strtod
+    if (mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        double result = (double)mantissa;
+        if (exponent < 0) {
+            result /= exact_powers_of_ten[-exponent];
+        } else {
+            result *= exact_powers_of_ten[exponent];
+        }
+        *value = negative ? -result : result;
         return 0;
     }
 
-    // Allocate memory for a new csv data struct
-    csv_data_t data;
+fallback:;
+    // Copy the field so strtod cannot read past its end
+    char field[128];
+    size_t size = end - start;
+    if (size >= sizeof(field)) {
+        return -1;
+    }
+    memcpy(field, start, size);
+    field[size] = '\0';
 
-    // Scan the line for two double values separated by a comma
-    if (sscanf(line, "%lf,%lf", &data.x, &data.y) != 2) {
-        fprintf(stderr, "Invalid csv format: %s\n", line);
+    char *stop;
+    double result = strtod(field, &stop);
+    if (stop != field + size) {
         return -1;
     }
+    *value = result;
+    return 0;
+}
 
-    // Lock the mutex before modifying csv_data
-    pthread_mutex_lock(&csv_data_mutex);
+// A function to split a csv line into fields and parse each field as a double
+// Returns the number of values stored, or -1 if a field is not a number or the line has more than max_values fields
+int csv_parse_values(const char *line, size_t length, double *values, int max_values) {
+    size_t commas[CSV_MAX_FIELDS];
 
-    // Reallocate memory for the global csv data array to fit the new data
-    csv_data_t *new_data = realloc(csv_data, sizeof(csv_data_t) * (csv_data_size + 1));
-    if (new_data == NULL) {
-        perror("realloc");
-        pthread_mutex_unlock(&csv_data_mutex);
+    // Look for one comma more than max_values fields need, finding it means the line has too many fields
+    int comma_count = csv_find_delimiters(line, length, commas, max_values);
+    if (comma_count == max_values) {
         return -1;
     }
-    csv_data = new_data;
+    int count = comma_count + 1;
+
+    // Parse the fields between consecutive commas
+    size_t field_start = 0;
+    for (int i = 0; i < count; i++) {
+        size_t field_end = (i < comma_count) ? commas[i] : length;
+        if (parse_double(line + field_start, line + field_end, &values[i]) == -1) {
+            return -1;
+        }
+        field_start = field_end + 1;
+    }
+
+    return count;
+}
+
+// A struct to store one parsed csv line on its way from the serial thread to the csv data
+typedef struct {
+    double values[CSV_MAX_CHANNELS + 1]; // the x value followed by one value per channel
+    int channels; // the number of channel values after the x value
+} csv_sample_t;
+
+// A struct for the lock-free single-producer/single-consumer queue between the serial thread and the csv data
+// Head and tail count samples since the start and only ever grow, the slot of sample n is n % SAMPLE_QUEUE_SIZE
+typedef struct {
+    csv_sample_t samples[SAMPLE_QUEUE_SIZE]; // the queued samples
+    _Alignas(64) atomic_size_t head; // the number of samples consumed (stored by the consumer only)
+    _Alignas(64) atomic_size_t tail; // the number of samples published (stored by the producer only)
+    _Alignas(64) size_t written; // the number of samples written by the producer, published in batches
+    size_t head_cache; // the value of head last seen by the producer
+} sample_queue_t;
+
+// A global variable to store the queue of parsed samples
+sample_queue_t sample_queue;
+
+// A global variable to count the samples dropped because the queue was full
+atomic_ulong csv_samples_dropped = 0;
+
+// A global variable to store the number of channels set by the first valid line (producer side)
+// The consumer never reads it, each sample carries its channel count through the queue instead
+int serial_channels = 0;
+
+// A global variable to store the eventfd the serial thread signals to wake the main loop when it publishes samples
+int data_event_fd = -1;
+
+// A global flag set when data_event_fd has been signaled and not yet read, so the serial thread writes
+// to it at most once per wakeup of the main loop
+atomic_int data_event_signaled = 0;
+
+// A function to get the next free slot of a sample queue (producer side)
+// Returns NULL when the queue is full
+csv_sample_t *sample_queue_reserve(sample_queue_t *queue) {
+    // Only reload the consumer position when the cached one says the queue is full
+    if (queue->written - queue->head_cache == SAMPLE_QUEUE_SIZE) {
+        queue->head_cache = atomic_load_explicit(&queue->head, memory_order_acquire);
+        if (queue->written - queue->head_cache == SAMPLE_QUEUE_SIZE) {
+            return NULL;
+        }
+    }
+    return &queue->samples[queue->written & (SAMPLE_QUEUE_SIZE - 1)];
+}
+
+// A function to add the sample written into the reserved slot to the current batch (producer side)
+void sample_queue_commit(sample_queue_t *queue) {
+    queue->written++;
+}
 
-    // Store the new data in the global array and increment the size
-    csv_data[csv_data_size] = data;
+// A function to make every committed sample visible to the consumer with a single release store (producer side)
+void sample_queue_publish(sample_queue_t *queue) {
+    atomic_store_explicit(&queue->tail, queue->written, memory_order_release);
+}
+
+// A function to wake the main loop after samples are published (producer side)
+void data_event_signal() {
+    if (data_event_fd >= 0 && atomic_exchange(&data_event_signaled, 1) == 0) {
+        uint64_t one = 1;
+        if (write(data_event_fd, &one, sizeof(one)) == -1) {
+            perror("write");
+        }
+    }
+}
+
+// A function to consume the wakeup of the main loop (consumer side)
+// Samples published before a signal that was skipped because the flag was still set are visible
+// once the flag is cleared here, so the drain that follows never misses them
+void data_event_clear() {
+    uint64_t value;
+    if (read(data_event_fd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        perror("read");
+    }
+    atomic_exchange(&data_event_signaled, 0);
+}
+
+// A function to get log2 of the number of points per block of a pyramid level
+int csv_lod_shift(int level) {
+    return CSV_LOD_BASE_SHIFT + level * CSV_LOD_LEVEL_SHIFT;
+}
+
+// A function to get the slot of the pyramid block holding a point offset of a chunk
+// The levels are stored one after another, finest first, so level slots start after every finer level
+int csv_lod_slot(int level, int offset) {
+    int slot = 0;
+    for (int l = 0; l < level; l++) {
+        slot += CSV_CHUNK_POINTS >> csv_lod_shift(l);
+    }
+    return slot + (offset >> csv_lod_shift(level));
+}
+
+// A function to get the size in bytes of the memory block backing one chunk
+size_t csv_chunk_bytes() {
+    size_t columns = (size_t)CSV_CHUNK_POINTS * (csv_data.channels + 1);
+    size_t pyramid = (size_t)csv_lod_slot(CSV_LOD_LEVELS, 0) * 2 * csv_data.channels;
+    return sizeof(double) * (columns + pyramid);
+}
+
+// A function to add an empty chunk to the end of the csv data
+int csv_data_add_chunk() {
+    if (csv_data.chunk_count == CSV_CHUNK_LIMIT) {
+        fprintf(stderr, "CSV data is full (%d chunks)\n", CSV_CHUNK_LIMIT);
+        return -1;
+    }
+
+    // Allocate the chunk descriptor, it never moves once it is in the directory
+    csv_chunk_t *chunk = malloc(sizeof(csv_chunk_t));
+    if (chunk == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    // Reserve the columns of the chunk from the OS as one large block
+    double *block = mmap(NULL, csv_chunk_bytes(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED) {
+        perror("mmap");
+        free(chunk);
+        return -1;
+    }
+
+    // Lay the columns out one after another inside the block
+    chunk->x = block;
+    for (int c = 0; c < csv_data.channels; c++) {
+        chunk->y[c] = block + (size_t)CSV_CHUNK_POINTS * (c + 1);
+    }
+
+    // Lay the pyramid blocks of each channel out after the columns
+    double *pyramid = block + (size_t)CSV_CHUNK_POINTS * (csv_data.channels + 1);
+    int slots = csv_lod_slot(CSV_LOD_LEVELS, 0);
+    for (int c = 0; c < csv_data.channels; c++) {
+        chunk->lod_min[c] = pyramid + (size_t)slots * 2 * c;
+        chunk->lod_max[c] = pyramid + (size_t)slots * (2 * c + 1);
+    }
+    csv_data.chunks[csv_data.chunk_count] = chunk;
+    csv_data.chunk_count++;
+
+    return 0;
+}
+
+// A function to get the number of points of a chunk that are part of a view of count points
+int csv_chunk_size(int chunk, int count) {
+    int size = count - chunk * CSV_CHUNK_POINTS;
+    return (size < CSV_CHUNK_POINTS) ? size : CSV_CHUNK_POINTS;
+}
+
+// A function to store the x value and channel values of one csv line at an index of the csv data
+void csv_data_set(int index, const double *values) {
+    csv_chunk_t *chunk = csv_data.chunks[index / CSV_CHUNK_POINTS];
+    int offset = index % CSV_CHUNK_POINTS;
+    chunk->x[offset] = values[0];
+    for (int c = 0; c < csv_data.channels; c++) {
+        chunk->y[c][offset] = values[c + 1];
+    }
+}
+
+// A function to add the channel values of the point at an index of the csv data to every pyramid level
+// The block holding the point is started by its first point and widened by the others, so the pyramid
+// is always up to date and costs O(levels * channels) per point
+void csv_data_add_lod(int index, const double *values) {
+    csv_chunk_t *chunk = csv_data.chunks[index / CSV_CHUNK_POINTS];
+    int offset = index % CSV_CHUNK_POINTS;
+
+    int slot_base = 0;
+    for (int level = 0; level < CSV_LOD_LEVELS; level++) {
+        int shift = csv_lod_shift(level);
+        int slot = slot_base + (offset >> shift);
+        int first = (offset & ((1 << shift) - 1)) == 0;
+        for (int c = 0; c < csv_data.channels; c++) {
+            double value = values[c + 1];
+            if (first || value < chunk->lod_min[c][slot]) chunk->lod_min[c][slot] = value;
+            if (first || value > chunk->lod_max[c][slot]) chunk->lod_max[c][slot] = value;
+        }
+        slot_base += CSV_CHUNK_POINTS >> shift;
+    }
+}
+
+// A function to get the level of the largest pyramid block that starts at a point and ends before end,
+// up to max_level. Blocks are aligned to their size, so a block never spans two chunks
+// Returns -1 when no block fits and the point has to be read on its own
+int csv_lod_block_level(int index, int end, int max_level) {
+    for (int level = max_level; level >= 0; level--) {
+        int size = 1 << csv_lod_shift(level);
+        if ((index & (size - 1)) == 0 && index + size <= end) {
+            return level;
+        }
+    }
+    return -1;
+}
+
+// A function to get the y range over all channels of the points start .. end - 1
+// Whole pyramid blocks are read wherever they fit, so the cost grows with the number of blocks, not points
+void csv_data_get_y_range(int start, int end, double *min_y, double *max_y) {
+    *min_y = csv_data.chunks[start / CSV_CHUNK_POINTS]->y[0][start % CSV_CHUNK_POINTS];
+    *max_y = *min_y;
+
+    int index = start;
+    while (index < end) {
+        csv_chunk_t *chunk = csv_data.chunks[index / CSV_CHUNK_POINTS];
+        int offset = index % CSV_CHUNK_POINTS;
+        int level = csv_lod_block_level(index, end, CSV_LOD_LEVELS - 1);
+        for (int c = 0; c < csv_data.channels; c++) {
+            double low, high;
+            if (level == -1) {
+                low = high = chunk->y[c][offset];
+            } else {
+                int slot = csv_lod_slot(level, offset);
+                low = chunk->lod_min[c][slot];
+                high = chunk->lod_max[c][slot];
+            }
+            if (low < *min_y) *min_y = low;
+            if (high > *max_y) *max_y = high;
+        }
+        index += (level == -1) ? 1 : 1 << csv_lod_shift(level);
+    }
+}
+
+// A function to find the first of count points whose x value is not less than a value
+// The x values are expected to be non-decreasing (e.g. timestamps)
+int csv_data_find_x(double value, int count) {
+    int low = 0;
+    int high = count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (csv_data.chunks[middle / CSV_CHUNK_POINTS]->x[middle % CSV_CHUNK_POINTS] < value) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// A function to free every chunk of the csv data
+void csv_data_free() {
+    for (int k = 0; k < csv_data.chunk_count; k++) {
+        munmap(csv_data.chunks[k]->x, csv_chunk_bytes());
+        free(csv_data.chunks[k]);
+    }
+    memset(&csv_data, 0, sizeof(csv_data));
+    csv_data_size = 0;
+    csv_data_generation = 0;
+}
+
+// A function to extend the range of the csv data with the values of a new point
+// Points are never removed, so the range only grows and costs O(channels) per point
+void csv_data_extend_range(const double *values) {
+    if (csv_data_size == 0) {
+        csv_data_range.min_x = values[0];
+        csv_data_range.max_x = values[0];
+        csv_data_range.min_y = values[1];
+        csv_data_range.max_y = values[1];
+    }
+
+    if (values[0] < csv_data_range.min_x) csv_data_range.min_x = values[0];
+    if (values[0] > csv_data_range.max_x) csv_data_range.max_x = values[0];
+    for (int c = 1; c <= csv_data.channels; c++) {
+        if (values[c] < csv_data_range.min_y) csv_data_range.min_y = values[c];
+        if (values[c] > csv_data_range.max_y) csv_data_range.max_y = values[c];
+    }
+}
+
+// A function to get the range of the csv data
+void csv_data_get_range(csv_range_t *range) {
+    *range = csv_data_range;
+}
+
+// A function to append one sample to the csv data, called by the queue consumer only
+int csv_data_append(const double *values) {
+    // Start a new chunk when the last one is full, existing points are never copied
+    if (csv_data_size == csv_data.chunk_count * CSV_CHUNK_POINTS && csv_data_add_chunk() == -1) {
+        return -1;
+    }
+
+    // Store the new data in the last chunk and increment the size
+    csv_data_set(csv_data_size, values);
+    csv_data_add_lod(csv_data_size, values);
+    csv_data_extend_range(values);
     csv_data_size++;
+    csv_data_generation++;
+
+    return 0;
+}
+
+// A function to publish the current extent of the csv data to readers (writer side)
+// The points are written before this is called, so every point in the published view is complete
+void csv_data_publish() {
+    unsigned int sequence = atomic_load_explicit(&csv_snapshot_header.sequence, memory_order_relaxed);
+
+    // Mark the header as being updated, the fence keeps the field stores after this store
+    atomic_store_explicit(&csv_snapshot_header.sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&csv_snapshot_header.start, csv_data_generation - csv_data_size, memory_order_relaxed);
+    atomic_store_explicit(&csv_snapshot_header.count, csv_data_size, memory_order_relaxed);
+    atomic_store_explicit(&csv_snapshot_header.generation, csv_data_generation, memory_order_relaxed);
+
+    // The range costs O(1) here because it is maintained as points are added
+    csv_range_t range;
+    csv_data_get_range(&range);
+    atomic_store_explicit(&csv_snapshot_header.min_x, range.min_x, memory_order_relaxed);
+    atomic_store_explicit(&csv_snapshot_header.max_x, range.max_x, memory_order_relaxed);
+    atomic_store_explicit(&csv_snapshot_header.min_y, range.min_y, memory_order_relaxed);
+    atomic_store_explicit(&csv_snapshot_header.max_y, range.max_y, memory_order_relaxed);
+
+    // Mark the header as consistent again and release the points written before it
+    atomic_store_explicit(&csv_snapshot_header.sequence, sequence + 2, memory_order_release);
+}
+
+// A function to take a snapshot of the csv data without blocking the writer
+// Only the small header is retried when the writer updates it at the same time
+void csv_data_snapshot(csv_snapshot_t *snapshot) {
+    unsigned int before, after;
+    do {
+        before = atomic_load_explicit(&csv_snapshot_header.sequence, memory_order_acquire);
+        snapshot->start = atomic_load_explicit(&csv_snapshot_header.start, memory_order_relaxed);
+        snapshot->count = atomic_load_explicit(&csv_snapshot_header.count, memory_order_relaxed);
+        snapshot->generation = atomic_load_explicit(&csv_snapshot_header.generation, memory_order_relaxed);
+        snapshot->range.min_x = atomic_load_explicit(&csv_snapshot_header.min_x, memory_order_relaxed);
+        snapshot->range.max_x = atomic_load_explicit(&csv_snapshot_header.max_x, memory_order_relaxed);
+        snapshot->range.min_y = atomic_load_explicit(&csv_snapshot_header.min_y, memory_order_relaxed);
+        snapshot->range.max_y = atomic_load_explicit(&csv_snapshot_header.max_y, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&csv_snapshot_header.sequence, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+}
+
+// A function to move every published sample from the sample queue into the csv data without blocking
+// Returns the number of samples moved
+int csv_data_drain() {
+    size_t head = atomic_load_explicit(&sample_queue.head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&sample_queue.tail, memory_order_acquire);
+
+    int count = 0;
+    for (; head != tail; head++) {
+        const csv_sample_t *sample = &sample_queue.samples[head & (SAMPLE_QUEUE_SIZE - 1)];
+        // The first sample sets the number of channels of the csv data, the producer rejects any other count
+        if (csv_data.channels == 0) {
+            csv_data.channels = sample->channels;
+        }
+        if (csv_data_append(sample->values) == -1) {
+            break;
+        }
+        count++;
+    }
 
-    // Unlock the mutex
-    pthread_mutex_unlock(&csv_data_mutex);
+    // Hand the slots back to the producer with a single release store
+    atomic_store_explicit(&sample_queue.head, head, memory_order_release);
+
+    // Publish the new extent of the csv data to readers
+    if (count > 0) {
+        csv_data_publish();
+    }
+
+    return count;
+}
+
+// A function to parse a csv line into the sample queue, the sample becomes visible to the
+// consumer with the next sample_queue_publish call
+int csv_parse_line(const char *line, size_t length) {
+    // Skip empty lines
+    if (length == 0) {
+        return 0;
+    }
+
+    // Parse straight into the next free slot of the queue, or drop the line if the queue is full
+    csv_sample_t *sample = sample_queue_reserve(&sample_queue);
+    if (sample == NULL) {
+        unsigned long dropped = atomic_fetch_add_explicit(&csv_samples_dropped, 1, memory_order_relaxed) + 1;
+        if (dropped % 1000 == 1) {
+            fprintf(stderr, "Sample queue full, dropped %lu samples\n", dropped);
+        }
+        return 0;
+    }
+
+    // Parse the x value followed by one value per channel
+    int count = csv_parse_values(line, length, sample->values, CSV_MAX_CHANNELS + 1);
+    if (count < 2) {
+        fprintf(stderr, "Invalid csv format: %.*s\n", (int)length, line);
+        return -1;
+    }
+
+    // The first valid line sets the number of channels, later lines must match it
+    if (serial_channels == 0) {
+        serial_channels = count - 1;
+    } else if (count - 1 != serial_channels) {
+        fprintf(stderr, "Expected %d channels: %.*s\n", serial_channels, (int)length, line);
+        return -1;
+    }
+
+    // Add the sample to the current batch
+    sample->channels = serial_channels;
+    sample_queue_commit(&sample_queue);
 
     return 0;
 }
 
+// A function to parse every complete line in a buffer of csv text (batch mode)
+// Returns the number of bytes consumed, a trailing partial line is left for the caller
+size_t csv_parse_buffer(const char *data, size_t size) {
+    size_t consumed = 0;
+
+    // Hand each line between line breaks to csv_parse_line
+    const char *end;
+    while ((end = find_either_char(data + consumed, size - consumed, '\n', '\r')) != NULL) {
+        size_t length = end - (data + consumed);
+        if (length > 0 && csv_parse_line(data + consumed, length) == -1) {
+            fprintf(stderr, "Failed to parse csv line: %.*s\n", (int)length, data + consumed);
+        }
+        consumed += length + 1;
+    }
+
+    // Publish the whole batch at once
+    sample_queue_publish(&sample_queue);
+
+    return consumed;
+}
+
 // A function to read and parse csv data from the serial port in a separate thread
 void *serial_thread(void *arg) {
-    // Create a buffer to store the serial line
-    char buffer[SERIAL_BUFFER_SIZE];
+    // Create a buffered reader for the serial port (static to keep it off the thread stack)
+    static serial_reader_t reader;
 
     // Create a file descriptor set for the select function
     fd_set fds;
@@ -239,13 +1032,33 @@ void *serial_thread(void *arg) {
             continue;
         }
         else {
-            // Data available, read a line from the serial port
-            if (serial_read_line(buffer, SERIAL_BUFFER_SIZE) > 0) {
-                // Parse the line and store the data in the global array
-                if (csv_parse_line(buffer) == -1) {
-                    fprintf(stderr, "Failed to parse csv line: %s\n", buffer);
+            // Data available, read everything the kernel has buffered in one call
+            size_t written = sample_queue.written;
+            ssize_t count = serial_reader_fill(&reader, serial_fd);
+            if (count == -2) {
+                fprintf(stderr, "Serial port closed, no more data will be read\n");
+                break;
+            }
+            if (count < 0) {
+                perror("read");
+                break;
+            }
+
+            // Parse every complete line, a trailing partial line stays in the reader for the next read
+            char *line;
+            size_t length;
+            while ((line = serial_reader_next_line(&reader, &length)) != NULL) {
+                if (length > 0 && csv_parse_line(line, length) == -1) {
+                    fprintf(stderr, "Failed to parse csv line: %s\n", line);
                 }
             }
+
+            // Publish every sample parsed from this read with a single release store and wake the main loop,
+            // a read that only completed part of a line has nothing to publish
+            if (sample_queue.written != written) {
+                sample_queue_publish(&sample_queue);
+                data_event_signal();
+            }
         }
     }
 
@@ -253,6 +1066,116 @@ void *serial_thread(void *arg) {
     return NULL;
 }
 
+// A function to zoom the view in (factor below 1) or out (factor above 1) around a window x position
+// Zooming out past the whole csv data goes back to following it
+void view_zoom(double factor, double window_x) {
+    if (csv_data_size == 0) {
+        return;
+    }
+
+    // Start from the whole csv data when the view follows it
+    if (view_follow) {
+        view_min_x = csv_data_range.min_x;
+        view_max_x = csv_data_range.max_x;
+    }
+
+    // Keep the x value under the pointer in place
+    double center = (window_x - view_offset_x) / view_scale_x;
+    double min_x = center - (center - view_min_x) * factor;
+    double max_x = center + (view_max_x - center) * factor;
+
+    if (min_x <= csv_data_range.min_x && max_x >= csv_data_range.max_x) {
+        view_follow = 1;
+    } else if (max_x > min_x) {
+        view_min_x = min_x;
+        view_max_x = max_x;
+        view_follow = 0;
+    }
+}
+
+// A function to handle the pointer enter event and store the pointer position
+void pointer_enter(void *data, struct wl_pointer *pointer, uint32_t serial, struct wl_surface *surface,
+                   wl_fixed_t surface_x, wl_fixed_t surface_y) {
+    pointer_x = wl_fixed_to_double(surface_x);
+}
+
+// A function to handle the pointer leave event and stop dragging
+void pointer_leave(void *data, struct wl_pointer *pointer, uint32_t serial, struct wl_surface *surface) {
+    pointer_dragging = 0;
+}
+
+// A function to handle the pointer motion event and pan the view while dragging
+void pointer_motion(void *data, struct wl_pointer *pointer, uint32_t time, wl_fixed_t surface_x, wl_fixed_t surface_y) {
+    double x = wl_fixed_to_double(surface_x);
+    if (pointer_dragging) {
+        double shift = (x - pointer_x) / view_scale_x;
+        view_min_x -= shift;
+        view_max_x -= shift;
+        redraw_needed = 1;
+    }
+    pointer_x = x;
+}
+
+// A function to handle the pointer button event
+// The left button drags the view and the right button goes back to following the whole csv data
+void pointer_button(void *data, struct wl_pointer *pointer, uint32_t serial, uint32_t time, uint32_t button, uint32_t state) {
+    if (button == BTN_LEFT) {
+        pointer_dragging = (state == WL_POINTER_BUTTON_STATE_PRESSED) && csv_data_size > 0;
+        if (pointer_dragging && view_follow) {
+            view_min_x = csv_data_range.min_x;
+            view_max_x = csv_data_range.max_x;
+            view_follow = 0;
+        }
+    } else if (button == BTN_RIGHT && state == WL_POINTER_BUTTON_STATE_PRESSED) {
+        view_follow = 1;
+        redraw_needed = 1;
+    }
+}
+
+// A function to handle the pointer axis event and zoom the view with the scroll wheel
+void pointer_axis(void *data, struct wl_pointer *pointer, uint32_t time, uint32_t axis, wl_fixed_t value) {
+    if (axis == WL_POINTER_AXIS_VERTICAL_SCROLL) {
+        view_zoom(wl_fixed_to_double(value) > 0 ? 1.25 : 0.8, pointer_x);
+        redraw_needed = 1;
+    }
+}
+
+// A global variable to store the pointer listener callbacks
+struct wl_pointer_listener pointer_listener = {
+    .enter = pointer_enter,
+    .leave = pointer_leave,
+    .motion = pointer_motion,
+    .button = pointer_button,
+    .axis = pointer_axis,
+};
+
+// A function to handle the seat capabilities event and get the pointer when the seat has one
+void seat_capabilities(void *data, struct wl_seat *seat, uint32_t capabilities) {
+    if ((capabilities & WL_SEAT_CAPABILITY_POINTER) && pointer == NULL) {
+        pointer = wl_seat_get_pointer(seat);
+        wl_pointer_add_listener(pointer, &pointer_listener, NULL);
+    } else if (!(capabilities & WL_SEAT_CAPABILITY_POINTER) && pointer != NULL) {
+        wl_pointer_destroy(pointer);
+        pointer = NULL;
+    }
+}
+
+// A global variable to store the seat listener callbacks
+struct wl_seat_listener seat_listener = {
+    .capabilities = seat_capabilities,
+};
+
+// A function to handle the xdg shell ping event
+void wm_base_ping(void *data, struct xdg_wm_base *wm_base, uint32_t serial) {
+    // Send a pong reply to the compositor
+    xdg_wm_base_pong(wm_base, serial);
+}
+
+// A struct to store the xdg shell listener callbacks
+struct xdg_wm_base_listener wm_base_listener = {
+    .ping = wm_base_ping,
+};
+
 // A function to handle the registry global event
 void registry_global(void *data, struct wl_registry *registry, uint32_t id, const char *interface, uint32_t version) {
     // If the interface is wl_compositor, bind it to the global variable
@@ -263,10 +1186,20 @@ void registry_global(void *data, struct wl_registry *registry, uint32_t id, cons
     else if (strcmp(interface, "wl_shell") == 0) {
         shell = wl_registry_bind(registry, id, &wl_shell_interface, 1);
     }
+    // If the interface is xdg_wm_base, bind it to the global variable and answer its pings
+    else if (strcmp(interface, "xdg_wm_base") == 0) {
+        wm_base = wl_registry_bind(registry, id, &xdg_wm_base_interface, 1);
+        xdg_wm_base_add_listener(wm_base, &wm_base_listener, NULL);
+    }
     // If the interface is wl_shm, bind it to the global variable
     else if (strcmp(interface, "wl_shm") == 0) {
         shm = wl_registry_bind(registry, id, &wl_shm_interface, 1);
     }
+    // If the interface is wl_seat, bind it to the global variable and listen for its pointer
+    else if (strcmp(interface, "wl_seat") == 0 && seat == NULL) {
+        seat = wl_registry_bind(registry, id, &wl_seat_interface, 1);
+        wl_seat_add_listener(seat, &seat_listener, NULL);
+    }
 }
 
 // A function to handle the registry global remove event
@@ -280,6 +1213,26 @@ struct wl_registry_listener registry_listener = {
     .global_remove = registry_global_remove,
 };
 
+// A function to set the window size, kept large enough for the margins and a small plot area
+// The buffers are created again at the new size when they are next drawn into
+void window_resize(int32_t width, int32_t height) {
+    // Keep the current size when the compositor leaves it to the program
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+
+    int min_size = 2 * GRAPH_MARGIN + WINDOW_MIN_PLOT_SIZE;
+    if (width < min_size) width = min_size;
+    if (height < min_size) height = min_size;
+    if (width == graph_width && height == graph_height) {
+        return;
+    }
+
+    graph_width = width;
+    graph_height = height;
+    redraw_needed = 1;
+}
+
 // A function to handle the shell surface ping event
 void shell_surface_ping(void *data, struct wl_shell_surface *shell_surface, uint32_t serial) {
     // Send a pong reply to the compositor
@@ -289,7 +1242,8 @@ void shell_surface_ping(void *data, struct wl_shell_surface *shell_surface, uint
 // A function to handle the shell surface configure event
 void shell_surface_configure(void *data, struct wl_shell_surface *shell_surface,
                              uint32_t edges, int32_t width, int32_t height) {
-    // Do nothing
+    // Follow the size the compositor asks for, e.g. while the user drags a window edge
+    window_resize(width, height);
 }
 
 // A function to handle the shell surface popup done event
@@ -304,48 +1258,394 @@ struct wl_shell_surface_listener shell_surface_listener = {
     .popup_done = shell_surface_popup_done,
 };
 
-// A function to create a wayland buffer with proper shared memory
-struct wl_buffer *create_buffer() {
-    int stride = GRAPH_WIDTH * 4; // 4 bytes per pixel (ARGB)
-    int size = stride * GRAPH_HEIGHT;
+// A function to handle the xdg surface configure event, it ends a sequence of configure events
+void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface, uint32_t serial) {
+    // Acknowledge the configure event, the next commit applies it
+    xdg_surface_ack_configure(xdg_surface, serial);
+
+    // Apply the size the toplevel configure event asked for and draw a frame at that size
+    window_resize(configure_width, configure_height);
+    configured = 1;
+    redraw_needed = 1;
+}
+
+// A struct to store the xdg surface listener callbacks
+struct xdg_surface_listener xdg_surface_listener = {
+    .configure = xdg_surface_configure,
+};
+
+// A function to handle the xdg toplevel configure event, the size is applied by the xdg surface configure event
+void xdg_toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
+                            int32_t width, int32_t height, struct wl_array *states) {
+    configure_width = width;
+    configure_height = height;
+}
+
+// A function to handle the xdg toplevel close event
+void xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel) {
+    window_closed = 1;
+}
+
+// A struct to store the xdg toplevel listener callbacks
+struct xdg_toplevel_listener xdg_toplevel_listener = {
+    .configure = xdg_toplevel_configure,
+    .close = xdg_toplevel_close,
+};
+
+// A function to handle the buffer release event, the compositor no longer reads the buffer
+void buffer_release(void *data, struct wl_buffer *buffer) {
+    shm_buffer_t *shm_buffer = data;
+    shm_buffer->busy = 0;
+}
+
+// A global variable to store the buffer listener callbacks
+struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+// A function to handle the frame callback done event, the compositor is ready for the next frame
+// Frame callbacks are not sent while the window is hidden, so nothing is drawn then
+void frame_done(void *data, struct wl_callback *callback, uint32_t time) {
+    wl_callback_destroy(callback);
+    frame_pending = 0;
+}
+
+// A global variable to store the frame callback listener callbacks
+struct wl_callback_listener frame_listener = {
+    .done = frame_done,
+};
+
+// A function to grow the shared memory pool so that each buffer slot holds at least size bytes
+// Slots grow in power of two buckets, so resizing the window inside a bucket reuses the pool as it is
+// The new slots are added after the old ones, so buffers the compositor still holds keep their pixels
+int shm_pool_grow(size_t size) {
+    size_t slot_size = SHM_BUCKET_MIN_SIZE;
+    while (slot_size < size) {
+        slot_size *= 2;
+    }
+    size_t offset = shm_size;
+    size_t new_size = offset + slot_size * SHM_BUFFER_COUNT;
+    if (new_size > INT32_MAX) {
+        fprintf(stderr, "The window is too large for the shared memory pool\n");
+        return -1;
+    }
 
-    // Create shared memory file
-    shm_fd = create_shm_file(size);
+    // Create the shared memory file, or grow it
     if (shm_fd < 0) {
-        return NULL;
+        shm_fd = create_shm_file(new_size);
+        if (shm_fd < 0) {
+            return -1;
+        }
+    } else if (ftruncate(shm_fd, new_size) < 0) {
+        perror("ftruncate");
+        return -1;
     }
 
-    // Map the shared memory
-    shm_data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (shm_data == MAP_FAILED) {
+    // Map the shared memory, the file keeps the pixels of the old mapping
+    void *data = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (data == MAP_FAILED) {
         perror("mmap");
-        close(shm_fd);
-        return NULL;
+        return -1;
+    }
+    if (shm_data != NULL) {
+        munmap(shm_data, shm_size);
     }
+    shm_data = data;
 
-    // Create a wl_shm_pool from the shared memory
-    struct wl_shm_pool *pool = wl_shm_create_pool(shm, shm_fd, size);
+    // Create a wl_shm_pool from the shared memory, or tell the compositor it grew
+    if (shm_pool == NULL) {
+        shm_pool = wl_shm_create_pool(shm, shm_fd, new_size);
+        if (shm_pool == NULL) {
+            fprintf(stderr, "Failed to create the wayland shm pool\n");
+            return -1;
+        }
+    } else {
+        wl_shm_pool_resize(shm_pool, new_size);
+    }
+    shm_size = new_size;
+    shm_slot_offset = offset;
+    shm_slot_size = slot_size;
 
-    // Create a wl_buffer from the pool
-    struct wl_buffer *buffer = wl_shm_pool_create_buffer(pool, 0, GRAPH_WIDTH, GRAPH_HEIGHT, 
-                                                         stride, WL_SHM_FORMAT_ARGB8888);
+    // Point the buffers at the new mapping
+    for (int i = 0; i < SHM_BUFFER_COUNT; i++) {
+        shm_buffers[i].data = (char *)shm_data + shm_buffers[i].offset;
+    }
 
-    // Destroy the pool (buffer is still valid)
-    wl_shm_pool_destroy(pool);
+    return 0;
+}
 
-    return buffer;
+// A function to make a buffer the size of the window, its wl_buffer is only created again when the size changed
+// Each buffer uses its own slot of the pool, which only grows when the window outgrows the slots
+int shm_buffer_prepare(shm_buffer_t *target) {
+    if (target->buffer != NULL && target->width == graph_width && target->height == graph_height) {
+        return 0;
+    }
+
+    // Grow the pool when the buffer no longer fits in a slot
+    int stride = graph_width * 4; // 4 bytes per pixel (ARGB)
+    size_t size = (size_t)stride * graph_height;
+    if (size > shm_slot_size && shm_pool_grow(size) == -1) {
+        return -1;
+    }
+
+    // Create a wl_buffer for the slot of this buffer and listen for its release
+    if (target->buffer != NULL) {
+        wl_buffer_destroy(target->buffer);
+    }
+    target->offset = shm_slot_offset + (size_t)(target - shm_buffers) * shm_slot_size;
+    target->buffer = wl_shm_pool_create_buffer(shm_pool, (int32_t)target->offset, graph_width, graph_height,
+                                               stride, WL_SHM_FORMAT_ARGB8888);
+    if (target->buffer == NULL) {
+        fprintf(stderr, "Failed to create the wayland buffer\n");
+        return -1;
+    }
+    target->data = (char *)shm_data + target->offset;
+    target->width = graph_width;
+    target->height = graph_height;
+    wl_buffer_add_listener(target->buffer, &buffer_listener, target);
+
+    return 0;
 }
 
-// A function to draw a graph on the shared memory buffer
-void draw_graph() {
-    if (shm_data == NULL) {
-        return;
+// A function to get a buffer the compositor does not hold, sized for the window
+// Returns NULL when every buffer is still held
+shm_buffer_t *get_free_buffer() {
+    for (int i = 0; i < SHM_BUFFER_COUNT; i++) {
+        if (!shm_buffers[i].busy) {
+            return (shm_buffer_prepare(&shm_buffers[i]) == 0) ? &shm_buffers[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+// A struct to store a point of a trace in window coordinates
+typedef struct {
+    double x;
+    double y;
+} plot_point_t;
+
+// A struct to describe a contiguous run of the points of one channel
+typedef struct {
+    const double *x; // the x values
+    const double *y; // the y values of the channel
+    int count; // the number of points
+} plot_segment_t;
+
+// A struct to store the scale and offset factors that map csv values to window coordinates
+typedef struct {
+    double scale_x;
+    double offset_x;
+    double scale_y;
+    double offset_y; // window y is offset_y - y * scale_y (flipped)
+} plot_transform_t;
+
+// A struct to store the points of one pixel column group during M4 decimation
+typedef struct {
+    long column; // the pixel column of the group
+    int count; // the number of points added to the group, 0 when empty
+    plot_point_t first, last, min, max; // the points kept for the group
+    int first_index, last_index, min_index, max_index; // their positions in the trace
+} plot_m4_group_t;
+
+// A global variable to store the decimated points of a trace, reused across frames
+plot_point_t *plot_points = NULL;
+
+// A global variable to store the number of points plot_points can hold
+int plot_points_capacity = 0;
+
+// A function to get the index of the pixel column containing a window x coordinate
+long plot_column(double x) {
+    long column = (long)x;
+    return (x < column) ? column - 1 : column;
+}
+
+// A function to make room for count points in the decimation output buffer
+int plot_points_reserve(int count) {
+    if (count <= plot_points_capacity) {
+        return 0;
     }
 
+    int capacity = (plot_points_capacity > 0) ? plot_points_capacity : 1024;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    plot_point_t *new_points = realloc(plot_points, sizeof(plot_point_t) * capacity);
+    if (new_points == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    plot_points = new_points;
+    plot_points_capacity = capacity;
+
+    return 0;
+}
+
+// A function to add a point to an M4 group
+void plot_m4_add(plot_m4_group_t *group, plot_point_t point, long column, int index) {
+    if (group->count == 0) {
+        group->column = column;
+        group->first = group->last = group->min = group->max = point;
+        group->first_index = group->last_index = group->min_index = group->max_index = index;
+    } else {
+        group->last = point;
+        group->last_index = index;
+        if (point.y < group->min.y) {
+            group->min = point;
+            group->min_index = index;
+        }
+        if (point.y > group->max.y) {
+            group->max = point;
+            group->max_index = index;
+        }
+    }
+    group->count++;
+}
+
+// A function to append the first, min, max and last points of an M4 group to plot_points and empty the group
+// The points keep their original order and points that coincide are only stored once
+// Returns the new number of points in plot_points or -1 on failure
+int plot_m4_flush(plot_m4_group_t *group, int count) {
+    if (plot_points_reserve(count + 4) == -1) {
+        return -1;
+    }
+
+    int min_first = group->min_index < group->max_index;
+    plot_point_t a = min_first ? group->min : group->max;
+    plot_point_t b = min_first ? group->max : group->min;
+    int a_index = min_first ? group->min_index : group->max_index;
+    int b_index = min_first ? group->max_index : group->min_index;
+
+    plot_points[count++] = group->first;
+    if (a_index != group->first_index && a_index != group->last_index) {
+        plot_points[count++] = a;
+    }
+    if (b_index != group->first_index && b_index != group->last_index && b_index != a_index) {
+        plot_points[count++] = b;
+    }
+    if (group->last_index != group->first_index) {
+        plot_points[count++] = group->last;
+    }
+
+    group->count = 0;
+    return count;
+}
+
+// A function to add a point to the current M4 group, emitting the group first when the point is in another pixel column
+// Returns the new number of points in plot_points or -1 on failure
+int plot_m4_push(plot_m4_group_t *group, plot_point_t point, int index, int count) {
+    long column = plot_column(point.x);
+    if (group->count > 0 && column != group->column) {
+        count = plot_m4_flush(group, count);
+        if (count == -1) {
+            return -1;
+        }
+    }
+    plot_m4_add(group, point, column, index);
+    return count;
+}
+
+// A function to reduce a trace to at most four points per pixel column: first, min, max and last (M4)
+// Consecutive points in the same pixel column form one group. With monotonic x there is one group per
+// column, so the result has at most 4 points per column and draws the same pixels as the full polyline
+// Returns the number of points stored in plot_points or -1 on failure
+int plot_decimate_m4(const plot_segment_t *segments, int segment_count, const plot_transform_t *transform) {
+    plot_m4_group_t group = {0};
+    int count = 0;
+    int index = 0;
+
+    for (int s = 0; s < segment_count; s++) {
+        const double *x = segments[s].x;
+        const double *y = segments[s].y;
+        for (int i = 0; i < segments[s].count; i++, index++) {
+            plot_point_t point;
+            point.x = x[i] * transform->scale_x + transform->offset_x;
+            point.y = transform->offset_y - y[i] * transform->scale_y; // Flip Y
+            count = plot_m4_push(&group, point, index, count);
+            if (count == -1) {
+                return -1;
+            }
+        }
+    }
+
+    // Emit the last group
+    if (group.count > 0) {
+        count = plot_m4_flush(&group, count);
+    }
+
+    return count;
+}
+
+// A function to reduce the points start .. end - 1 of a channel to at most four points per pixel column,
+// reading whole pyramid blocks up to max_level instead of their points
+// Each block stands for its first point, its minimum and maximum (at the x of its middle point) and its
+// last point. This approximates exact M4: a block can straddle two pixel columns, and then its extremes are
+// put in the column of its middle point, in an order guessed from the first point. Blocks are at most half a
+// pixel column wide, so an extreme moves by less than one column and the difference is not visible
+// Returns the number of points stored in plot_points or -1 on failure
+int plot_decimate_lod(int start, int end, int channel, int max_level, const plot_transform_t *transform) {
+    plot_m4_group_t group = {0};
+    int count = 0;
+    int index = 0;
+
+    int i = start;
+    while (i < end && count != -1) {
+        csv_chunk_t *chunk = csv_data.chunks[i / CSV_CHUNK_POINTS];
+        const double *x = chunk->x;
+        const double *y = chunk->y[channel];
+        int offset = i % CSV_CHUNK_POINTS;
+        int level = csv_lod_block_level(i, end, max_level);
+
+        // Read the point on its own when no block fits
+        if (level == -1) {
+            plot_point_t point = { x[offset] * transform->scale_x + transform->offset_x,
+                                   transform->offset_y - y[offset] * transform->scale_y }; // Flip Y
+            count = plot_m4_push(&group, point, index++, count);
+            i++;
+            continue;
+        }
+
+        // Read the block as its first point, its extremes and its last point
+        int size = 1 << csv_lod_shift(level);
+        int slot = csv_lod_slot(level, offset);
+        int last = offset + size - 1;
+        double middle_x = x[offset + size / 2] * transform->scale_x + transform->offset_x;
+        plot_point_t first = { x[offset] * transform->scale_x + transform->offset_x,
+                               transform->offset_y - y[offset] * transform->scale_y }; // Flip Y
+        plot_point_t low = { middle_x, transform->offset_y - chunk->lod_min[channel][slot] * transform->scale_y };
+        plot_point_t high = { middle_x, transform->offset_y - chunk->lod_max[channel][slot] * transform->scale_y };
+        plot_point_t final = { x[last] * transform->scale_x + transform->offset_x,
+                               transform->offset_y - y[last] * transform->scale_y }; // Flip Y
+
+        // Visit the extreme nearer to the first point first
+        if (low.y - first.y > first.y - high.y) {
+            plot_point_t swap = low;
+            low = high;
+            high = swap;
+        }
+        count = plot_m4_push(&group, first, index++, count);
+        if (count != -1) count = plot_m4_push(&group, low, index++, count);
+        if (count != -1) count = plot_m4_push(&group, high, index++, count);
+        if (count != -1) count = plot_m4_push(&group, final, index++, count);
+        i += size;
+    }
+    if (count == -1) {
+        return -1;
+    }
+
+    // Emit the last group
+    if (group.count > 0) {
+        count = plot_m4_flush(&group, count);
+    }
+
+    return count;
+}
+
+// A function to draw a graph into the pixels of a shared memory buffer
+void draw_graph(void *pixels) {
     // Create a cairo surface from the shared memory
-    int stride = GRAPH_WIDTH * 4;
+    int stride = graph_width * 4;
     cairo_surface_t *surface = cairo_image_surface_create_for_data(
-        shm_data, CAIRO_FORMAT_ARGB32, GRAPH_WIDTH, GRAPH_HEIGHT, stride);
+        pixels, CAIRO_FORMAT_ARGB32, graph_width, graph_height, stride);
 
     // Create a cairo context from the surface
     cairo_t *cr = cairo_create(surface);
@@ -354,26 +1654,40 @@ void draw_graph() {
     cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
     cairo_paint(cr);
 
-    // Lock the mutex before reading csv_data
-    pthread_mutex_lock(&csv_data_mutex);
+    // Move the samples published by the serial thread into the csv data (the renderer owns the csv data)
+    csv_data_drain();
+
+    // Take a consistent view of the csv data, the frame is drawn from the view only
+    csv_snapshot_t snapshot;
+    csv_data_snapshot(&snapshot);
 
     // Check if we have data to draw
-    if (csv_data_size > 0) {
-        // Set the line width and color for the graph
+    if (snapshot.count > 0) {
+        // Set the line width for the graph
         cairo_set_line_width(cr, 2.0);
-        cairo_set_source_rgb(cr, 1.0, 0.0, 0.0); // red
 
-        // Find the minimum and maximum x and y values in the csv data
-        double min_x = csv_data[0].x;
-        double max_x = csv_data[0].x;
-        double min_y = csv_data[0].y;
-        double max_y = csv_data[0].y;
-        
-        for (int i = 1; i < csv_data_size; i++) {
-            if (csv_data[i].x < min_x) min_x = csv_data[i].x;
-            if (csv_data[i].x > max_x) max_x = csv_data[i].x;
-            if (csv_data[i].y < min_y) min_y = csv_data[i].y;
-            if (csv_data[i].y > max_y) max_y = csv_data[i].y;
+        // Use the range maintained as points were added instead of scanning every point
+        int start = 0;
+        int end = snapshot.count;
+        double min_x = snapshot.range.min_x;
+        double max_x = snapshot.range.max_x;
+        double min_y = snapshot.range.min_y;
+        double max_y = snapshot.range.max_y;
+
+        // When zoomed, draw the points covering the x range of the view (plus one on each side so the
+        // trace reaches the edges) and fit the y axis to them using the pyramid
+        if (!view_follow) {
+            min_x = view_min_x;
+            max_x = view_max_x;
+            start = csv_data_find_x(min_x, snapshot.count) - 1;
+            if (start < 0) start = 0;
+            end = csv_data_find_x(max_x, snapshot.count) + 1;
+            if (end > snapshot.count) end = snapshot.count;
+            csv_data_get_y_range(start, end, &min_y, &max_y);
+
+            // Hide the parts of the trace outside of the graph area
+            cairo_rectangle(cr, GRAPH_MARGIN, GRAPH_MARGIN, graph_width - 2 * GRAPH_MARGIN, graph_height - 2 * GRAPH_MARGIN);
+            cairo_clip(cr);
         }
 
         // Avoid division by zero
@@ -381,37 +1695,76 @@ void draw_graph() {
         if (max_y == min_y) max_y = min_y + 1.0;
 
         // Calculate the scale and offset factors for the x and y axes
-        double scale_x = (GRAPH_WIDTH - 2 * GRAPH_MARGIN) / (max_x - min_x);
+        double scale_x = (graph_width - 2 * GRAPH_MARGIN) / (max_x - min_x);
         double offset_x = GRAPH_MARGIN - min_x * scale_x;
-        double scale_y = (GRAPH_HEIGHT - 2 * GRAPH_MARGIN) / (max_y - min_y);
-        double offset_y = GRAPH_HEIGHT - GRAPH_MARGIN + min_y * scale_y; // Flip Y axis
+        double scale_y = (graph_height - 2 * GRAPH_MARGIN) / (max_y - min_y);
+        double offset_y = graph_height - GRAPH_MARGIN + min_y * scale_y; // Flip Y axis
+
+        // Keep the x scale and offset so pointer positions can be mapped to x values
+        view_scale_x = scale_x;
+        view_offset_x = offset_x;
+
+        // Map csv values to window coordinates
+        plot_transform_t transform = { scale_x, offset_x, scale_y, offset_y };
+
+        // Pick the coarsest pyramid level that still has at least two blocks per pixel column, so a block
+        // that straddles two columns moves its extremes by less than a column
+        int points_per_pixel = (end - start) / (graph_width - 2 * GRAPH_MARGIN);
+        int max_level = -1;
+        while (max_level + 1 < CSV_LOD_LEVELS && (1 << csv_lod_shift(max_level + 1)) <= points_per_pixel / 2) {
+            max_level++;
+        }
 
-        // Move to the first point in the csv data
-        cairo_move_to(cr, 
-                     csv_data[0].x * scale_x + offset_x, 
-                     offset_y - csv_data[0].y * scale_y); // Flip Y
+        // Describe the chunks covered by the view as segments
+        static plot_segment_t segments[CSV_MAX_CHUNKS];
+        int first_chunk = start / CSV_CHUNK_POINTS;
+        int segment_count = (end - 1) / CSV_CHUNK_POINTS - first_chunk + 1;
+
+        // Draw each channel as its own trace
+        for (int c = 0; c < csv_data.channels; c++) {
+            int count;
+            if (max_level >= 0) {
+                // Read whole pyramid blocks, so the cost depends on the graph width instead of the number of points
+                count = plot_decimate_lod(start, end, c, max_level, &transform);
+            } else {
+                for (int k = 0; k < segment_count; k++) {
+                    int chunk_start = (first_chunk + k) * CSV_CHUNK_POINTS;
+                    int a = (start > chunk_start) ? start - chunk_start : 0;
+                    int b = (end < chunk_start + CSV_CHUNK_POINTS) ? end - chunk_start : CSV_CHUNK_POINTS;
+                    segments[k].x = csv_data.chunks[first_chunk + k]->x + a;
+                    segments[k].y = csv_data.chunks[first_chunk + k]->y[c] + a;
+                    segments[k].count = b - a;
+                }
 
-        // Loop through the rest of the csv data and draw lines to each point
-        for (int i = 1; i < csv_data_size; i++) {
-            cairo_line_to(cr, 
-                         csv_data[i].x * scale_x + offset_x, 
-                         offset_y - csv_data[i].y * scale_y); // Flip Y
-        }
+                // Reduce the channel to at most four points per pixel column
+                count = plot_decimate_m4(segments, segment_count, &transform);
+            }
+            if (count <= 0) {
+                continue;
+            }
 
-        // Stroke the graph
-        cairo_stroke(cr);
+            // Set the color of this channel
+            const double *color = trace_colors[c % TRACE_COLOR_COUNT];
+            cairo_set_source_rgb(cr, color[0], color[1], color[2]);
+
+            // Move to the first point and draw lines to each remaining point
+            cairo_move_to(cr, plot_points[0].x, plot_points[0].y);
+            for (int i = 1; i < count; i++) {
+                cairo_line_to(cr, plot_points[i].x, plot_points[i].y);
+            }
+
+            // Stroke the trace
+            cairo_stroke(cr);
+        }
     } else {
         // Draw "Waiting for data..." message
         cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
         cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
         cairo_set_font_size(cr, 20.0);
-        cairo_move_to(cr, GRAPH_WIDTH / 2 - 80, GRAPH_HEIGHT / 2);
+        cairo_move_to(cr, graph_width / 2 - 80, graph_height / 2);
         cairo_show_text(cr, "Waiting for data...");
     }
 
-    // Unlock the mutex
-    pthread_mutex_unlock(&csv_data_mutex);
-
     // Destroy the cairo context
     cairo_destroy(cr);
     
@@ -421,14 +1774,28 @@ void draw_graph() {
 
 // A function to update the wayland surface with the graph
 void update_surface() {
-    // Draw the graph on the shared memory
-    draw_graph();
+    // Skip the frame when the compositor still holds every buffer, the next frame draws the latest data
+    shm_buffer_t *target = get_free_buffer();
+    if (target == NULL) {
+        return;
+    }
 
-    // Damage the entire surface to request a redraw
-    wl_surface_damage(surface, 0, 0, GRAPH_WIDTH, GRAPH_HEIGHT);
+    // Draw the graph into the free buffer
+    draw_graph(target->data);
 
-    // Commit the wayland surface
+    // Attach the buffer and damage the entire surface to request a redraw
+    wl_surface_attach(surface, target->buffer, 0, 0);
+    wl_surface_damage(surface, 0, 0, graph_width, graph_height);
+
+    // Ask the compositor when to draw the next frame, frames follow the display rate
+    struct wl_callback *callback = wl_surface_frame(surface);
+    wl_callback_add_listener(callback, &frame_listener, NULL);
+    frame_pending = 1;
+    redraw_needed = 0;
+
+    // Commit the wayland surface, the buffer is held by the compositor until it is released
     wl_surface_commit(surface);
+    target->busy = 1;
 
     // Flush the display
     wl_display_flush(display);
@@ -456,8 +1823,8 @@ int wayland_init() {
     // Roundtrip the display to get the global objects
     wl_display_roundtrip(display);
 
-    // Check if the compositor, shell, and shm are available
-    if (compositor == NULL || shell == NULL || shm == NULL) {
+    // Check if the compositor, a shell, and shm are available
+    if (compositor == NULL || (wm_base == NULL && shell == NULL) || shm == NULL) {
         fprintf(stderr, "Missing wayland global objects\n");
         return -1;
     }
@@ -469,32 +1836,59 @@ int wayland_init() {
         return -1;
     }
 
-    // Create a wayland shell surface from the shell and the surface
-    shell_surface = wl_shell_get_shell_surface(shell, surface);
-    if (shell_surface == NULL) {
-        fprintf(stderr, "Failed to create the wayland shell surface\n");
-        return -1;
-    }
+    // Make the surface a toplevel window with the xdg shell, or with the wayland shell on older compositors
+    if (wm_base != NULL) {
+        // Create an xdg surface and an xdg toplevel from the surface
+        xdg_surface = xdg_wm_base_get_xdg_surface(wm_base, surface);
+        if (xdg_surface == NULL) {
+            fprintf(stderr, "Failed to create the xdg surface\n");
+            return -1;
+        }
+        xdg_surface_add_listener(xdg_surface, &xdg_surface_listener, NULL);
+        xdg_toplevel = xdg_surface_get_toplevel(xdg_surface);
+        if (xdg_toplevel == NULL) {
+            fprintf(stderr, "Failed to create the xdg toplevel\n");
+            return -1;
+        }
+        xdg_toplevel_add_listener(xdg_toplevel, &xdg_toplevel_listener, NULL);
+
+        // Set the toplevel title and the smallest size that leaves a plot area
+        xdg_toplevel_set_title(xdg_toplevel, "Serial CSV Graph");
+        xdg_toplevel_set_min_size(xdg_toplevel, 2 * GRAPH_MARGIN + WINDOW_MIN_PLOT_SIZE, 2 * GRAPH_MARGIN + WINDOW_MIN_PLOT_SIZE);
+
+        // Commit the surface without a buffer and wait for the first configure event
+        wl_surface_commit(surface);
+        while (!configured) {
+            if (wl_display_dispatch(display) == -1) {
+                fprintf(stderr, "Failed to configure the xdg surface\n");
+                return -1;
+            }
+        }
+    } else {
+        // Create a wayland shell surface from the shell and the surface
+        shell_surface = wl_shell_get_shell_surface(shell, surface);
+        if (shell_surface == NULL) {
+            fprintf(stderr, "Failed to create the wayland shell surface\n");
+            return -1;
+        }
 
-    // Add the shell surface listener callbacks
-    wl_shell_surface_add_listener(shell_surface, &shell_surface_listener, NULL);
+        // Add the shell surface listener callbacks
+        wl_shell_surface_add_listener(shell_surface, &shell_surface_listener, NULL);
 
-    // Set the shell surface title
-    wl_shell_surface_set_title(shell_surface, "Serial CSV Graph");
+        // Set the shell surface title
+        wl_shell_surface_set_title(shell_surface, "Serial CSV Graph");
 
-    // Set the shell surface role as a toplevel window
-    wl_shell_surface_set_toplevel(shell_surface);
+        // Set the shell surface role as a toplevel window
+        wl_shell_surface_set_toplevel(shell_surface);
+        configured = 1;
+    }
 
-    // Create the buffer
-    buffer = create_buffer();
-    if (buffer == NULL) {
-        fprintf(stderr, "Failed to create buffer\n");
+    // Create the shared memory pool for the first size, the buffers are carved from it when drawn into
+    if (shm_pool_grow((size_t)graph_width * 4 * graph_height) == -1) {
+        fprintf(stderr, "Failed to create buffers\n");
         return -1;
     }
 
-    // Attach the buffer to the surface
-    wl_surface_attach(surface, buffer, 0, 0);
-
     // Update the wayland surface with the graph
     update_surface();
 
@@ -503,9 +1897,19 @@ int wayland_init() {
 
 // A function to clean up the wayland display and surface
 void wayland_cleanup() {
+    // Destroy the wayland buffers and the pool they were carved from
+    for (int i = 0; i < SHM_BUFFER_COUNT; i++) {
+        if (shm_buffers[i].buffer != NULL) {
+            wl_buffer_destroy(shm_buffers[i].buffer);
+        }
+    }
+    if (shm_pool != NULL) {
+        wl_shm_pool_destroy(shm_pool);
+    }
+
     // Unmap shared memory
-    if (shm_data != NULL && shm_data != MAP_FAILED) {
-        munmap(shm_data, GRAPH_WIDTH * GRAPH_HEIGHT * 4);
+    if (shm_data != NULL) {
+        munmap(shm_data, shm_size);
     }
 
     // Close shared memory fd
@@ -513,12 +1917,21 @@ void wayland_cleanup() {
         close(shm_fd);
     }
 
-    // Destroy the wayland buffer
-    if (buffer != NULL) {
-        wl_buffer_destroy(buffer);
+    // Destroy the wayland pointer and seat
+    if (pointer != NULL) {
+        wl_pointer_destroy(pointer);
+    }
+    if (seat != NULL) {
+        wl_seat_destroy(seat);
     }
 
-    // Destroy the wayland shell surface
+    // Destroy the xdg toplevel and surface, or the wayland shell surface
+    if (xdg_toplevel != NULL) {
+        xdg_toplevel_destroy(xdg_toplevel);
+    }
+    if (xdg_surface != NULL) {
+        xdg_surface_destroy(xdg_surface);
+    }
     if (shell_surface != NULL) {
         wl_shell_surface_destroy(shell_surface);
     }
@@ -533,7 +1946,10 @@ void wayland_cleanup() {
         wl_shm_destroy(shm);
     }
 
-    // Destroy the wayland shell
+    // Destroy the xdg shell and the wayland shell
+    if (wm_base != NULL) {
+        xdg_wm_base_destroy(wm_base);
+    }
     if (shell != NULL) {
         wl_shell_destroy(shell);
     }
@@ -553,10 +1969,13 @@ void wayland_cleanup() {
         wl_display_disconnect(display);
     }
 
-    // Free the global csv data array
-    if (csv_data != NULL) {
-        free(csv_data);
-    }
+    // Free the global csv data columns
+    csv_data_free();
+
+    // Free the decimation output buffer
+    free(plot_points);
+    plot_points = NULL;
+    plot_points_capacity = 0;
 }
 
 // The main function
@@ -573,6 +1992,13 @@ int main() {
         return -1;
     }
 
+    // Create the eventfd the serial thread uses to wake the main loop
+    data_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (data_event_fd == -1) {
+        perror("eventfd");
+        return -1;
+    }
+
     // Create a pthread for reading and parsing csv data from the serial port
     pthread_t thread;
     if (serial_fd >= 0) {
@@ -582,13 +2008,58 @@ int main() {
         }
     }
 
+    // Wait on the wayland display and on the data eventfd, and only draw when something changed
+    struct pollfd fds[2];
+    fds[0].fd = wl_display_get_fd(display);
+    fds[0].events = POLLIN;
+    fds[1].fd = data_event_fd;
+    fds[1].events = POLLIN;
+
     // Loop until the user closes the window
-    while (wl_display_dispatch(display) != -1) {
-        // Update the wayland surface with the graph
-        update_surface();
-        
-        // Small delay to avoid excessive CPU usage
-        usleep(50000); // 50ms = ~20 FPS
+    while (!window_closed) {
+        // Draw a frame when the graph changed and the compositor is ready for one
+        if (redraw_needed && !frame_pending) {
+            update_surface();
+        }
+
+        // Dispatch queued events, then flush requests and prepare to read new events
+        while (wl_display_prepare_read(display) != 0) {
+            wl_display_dispatch_pending(display);
+        }
+        wl_display_flush(display);
+
+        // Sleep until the compositor or the serial thread has something, without a timeout
+        if (poll(fds, 2, -1) == -1) {
+            wl_display_cancel_read(display);
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        // Read and dispatch the wayland events
+        if (fds[0].revents & POLLIN) {
+            if (wl_display_read_events(display) == -1) {
+                break;
+            }
+        } else {
+            wl_display_cancel_read(display);
+        }
+        if (fds[0].revents & (POLLERR | POLLHUP)) {
+            break;
+        }
+        if (wl_display_dispatch_pending(display) == -1) {
+            break;
+        }
+
+        // Move new samples into the csv data right away, so the queue keeps draining while the window is hidden
+        if (fds[1].revents & POLLIN) {
+            data_event_clear();
+            if (csv_data_drain() > 0) {
+                redraw_needed = 1;
+            }
+        }
     }
 
     // Cancel and join the pthread if it was created
@@ -605,6 +2076,9 @@ int main() {
         close(serial_fd);
     }
 
+    // Close the data eventfd
+    close(data_event_fd);
+
     // Exit the program with success
     return 0;
 }
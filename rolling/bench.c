@@ -0,0 +1,609 @@
+// A micro-benchmark of the stages of the rolling plotter on synthetic data: parse (csv lines and binary packets),
+// store, bounds, decimate and render.
+// It includes graph.c, so every stage runs the plotter's own code, and writes the results as JSON.
+
+#define main graph_main
+#include "graph.c"
+#undef main
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define BENCH_MAX_SIZES 16 // Maximum number of point counts given with --sizes
+#define BENCH_PARSE_BLOCK_LINES 16384 // Lines parsed per block, no more than the sample queue holds
+#define BENCH_PACKET_ROWS 64 // Samples per binary packet (int16 x and y, 262 bytes before framing)
+#define BENCH_DEFAULT_MIN_TIME 200 // Minimum time each measurement is repeated for, in milliseconds
+
+// A struct to store the benchmark options
+typedef struct {
+    long sizes[BENCH_MAX_SIZES]; // the point counts to run every stage at
+    int size_count;
+    const char *output; // the JSON file
+    uint64_t min_time; // the minimum time each measurement is repeated for, in nanoseconds
+} bench_config_t;
+
+// Global benchmark options
+bench_config_t bench_config = {
+    .sizes = { 1000, 100000, 10000000, 100000000 },
+    .size_count = 4,
+    .output = "bench.json",
+    .min_time = BENCH_DEFAULT_MIN_TIME * 1000000ull,
+};
+
+// A struct to store the window sizes draw_graph is measured at
+typedef struct {
+    int width;
+    int height;
+} bench_window_t;
+
+// A global variable to store the window sizes draw_graph is measured at
+const bench_window_t bench_windows[] = { { 800, 600 }, { 1920, 1080 }, { 3840, 2160 } };
+
+// A global variable to count the calls to malloc, calloc and realloc from any thread (cairo included)
+atomic_ulong bench_allocations = 0;
+
+// The glibc allocator, the functions below count the calls and hand them over
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+extern void __libc_free(void *pointer);
+
+// A function to count and forward malloc
+void *malloc(size_t size) {
+    atomic_fetch_add_explicit(&bench_allocations, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+// A function to count and forward calloc
+void *calloc(size_t count, size_t size) {
+    atomic_fetch_add_explicit(&bench_allocations, 1, memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+// A function to count and forward realloc
+void *realloc(void *pointer, size_t size) {
+    atomic_fetch_add_explicit(&bench_allocations, 1, memory_order_relaxed);
+    return __libc_realloc(pointer, size);
+}
+
+// A function to forward free
+void free(void *pointer) {
+    __libc_free(pointer);
+}
+
+// A struct to store a measurement: time, cycles and allocations between bench_begin and bench_end
+typedef struct {
+    uint64_t ns;
+    uint64_t cycles;
+    unsigned long allocations;
+} bench_measure_t;
+
+// A function to read the time stamp counter, 0 where there is none
+uint64_t bench_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+// A function to start a measurement
+void bench_begin(bench_measure_t *measure) {
+    measure->allocations = atomic_load_explicit(&bench_allocations, memory_order_relaxed);
+    measure->cycles = bench_cycles();
+    measure->ns = monotonic_ns();
+}
+
+// A function to end a measurement, adding the time, cycles and allocations since bench_begin
+void bench_end(bench_measure_t *measure, bench_measure_t *total) {
+    uint64_t ns = monotonic_ns();
+    uint64_t cycles = bench_cycles();
+    total->ns += ns - measure->ns;
+    total->cycles += cycles - measure->cycles;
+    total->allocations += atomic_load_explicit(&bench_allocations, memory_order_relaxed) - measure->allocations;
+}
+
+// A global variable to store the JSON output file
+FILE *bench_output = NULL;
+
+// A global variable to store the number of results written
+int bench_results = 0;
+
+// A function to write one result to the JSON file and a summary line to stderr
+// ops is the number of operations measured, bytes the number of input bytes (0 when not meaningful)
+void bench_report(const char *stage, const char *variant, long points, long ops, const bench_measure_t *total,
+                  double bytes) {
+    double ns_per_op = (double)total->ns / ops;
+    double seconds = total->ns * 1e-9;
+
+    fprintf(bench_output, "%s\n    {\"stage\": \"%s\", \"variant\": \"%s\", \"points\": %ld, \"ops\": %ld, "
+            "\"ns_per_op\": %.3f, \"ops_per_s\": %.1f", bench_results > 0 ? "," : "",
+            stage, variant, points, ops, ns_per_op, ops / seconds);
+    if (total->cycles > 0) {
+        fprintf(bench_output, ", \"cycles_per_op\": %.3f", (double)total->cycles / ops);
+    } else {
+        fprintf(bench_output, ", \"cycles_per_op\": null");
+    }
+    fprintf(bench_output, ", \"allocations\": %lu, \"allocations_per_op\": %.6f",
+            total->allocations, (double)total->allocations / ops);
+    if (bytes > 0.0) {
+        fprintf(bench_output, ", \"mb_per_s\": %.3f", bytes / seconds / 1e6);
+    }
+    fprintf(bench_output, "}");
+    bench_results++;
+
+    fprintf(stderr, "%-9s %-16s %11ld points %12.3f ns/op %10.1f cycles/op %8lu allocations\n",
+            stage, variant, points, ns_per_op, total->cycles > 0 ? (double)total->cycles / ops : 0.0,
+            total->allocations);
+}
+
+// A global variable to store the state of the synthetic data generator
+uint64_t bench_random_state = 0x9e3779b97f4a7c15ull;
+
+// A function to get a synthetic y value for a point: a triangle wave with noise, so every pixel column
+// has a spread of values and the min/max bounds keep moving as points roll off
+double bench_value(long index) {
+    bench_random_state = bench_random_state * 6364136223846793005ull + 1442695040888963407ull;
+    double noise = (double)(bench_random_state >> 40) / (double)(1ull << 24) - 0.5;
+    long phase = index % 20000;
+    double wave = (phase < 10000) ? phase : 20000 - phase;
+    return wave * 0.01 + noise * 10.0;
+}
+
+// A function to empty the csv data and set the rolling buffer size
+void bench_store_reset(long points) {
+    csv_data_free();
+    csv_data.channels = 1;
+    csv_buffer_max_size = (int)points;
+}
+
+// A function to fill the csv data with a number of points, the buffer rolls once it holds points
+// Returns -1 when the columns cannot grow
+int bench_store_fill(long start, long count) {
+    double values[2];
+    for (long i = start; i < start + count; i++) {
+        values[0] = (double)i;
+        values[1] = bench_value(i);
+        if (csv_data_append(values) == -1) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// A function to measure csv_parse_line through csv_parse_buffer on blocks of synthetic lines
+// The sample queue is emptied after each block without appending, so only parsing is measured
+void bench_parse(long points) {
+    // Format a block of lines once
+    size_t capacity = (size_t)BENCH_PARSE_BLOCK_LINES * 48;
+    char *block = malloc(capacity);
+    if (block == NULL) {
+        perror("malloc");
+        return;
+    }
+    size_t size = 0;
+    for (int i = 0; i < BENCH_PARSE_BLOCK_LINES; i++) {
+        size += snprintf(block + size, capacity - size, "%d,%.4f\n", i, bench_value(i));
+    }
+    serial_channels = 1;
+
+    // Parse the block until points lines are parsed, at least for the minimum time
+    bench_measure_t measure, total = { 0 };
+    long lines = 0;
+    double bytes = 0.0;
+    do {
+        for (long done = 0; done < points; done += BENCH_PARSE_BLOCK_LINES) {
+            long count = (points - done < BENCH_PARSE_BLOCK_LINES) ? points - done : BENCH_PARSE_BLOCK_LINES;
+            size_t length = (count == BENCH_PARSE_BLOCK_LINES) ? size : 0;
+            if (length == 0) {
+                // Find the end of the last line of a partial block
+                const char *end = block;
+                for (long line = 0; line < count; line++) {
+                    end = memchr(end, '\n', block + size - end) + 1;
+                }
+                length = end - block;
+            }
+
+            bench_begin(&measure);
+            csv_parse_buffer(block, length);
+            bench_end(&measure, &total);
+
+            // Hand the slots back as the consumer would
+            atomic_store_explicit(&sample_queue.head, atomic_load(&sample_queue.tail), memory_order_release);
+            lines += count;
+            bytes += length;
+        }
+    } while (total.ns < bench_config.min_time);
+
+    bench_report("parse", "csv_parse_line", points, lines, &total, bytes);
+    free(block);
+}
+
+// A function to frame a packet for the binary protocol in config.input_protocol, delimiter included
+// Returns the length of the frame
+size_t bench_frame(const uint8_t *packet, size_t size, uint8_t *frame) {
+    size_t length = 0;
+    if (config.input_protocol == INPUT_COBS) {
+        // Each block is a code byte followed by up to 254 non-zero bytes, the code counts them plus one
+        size_t code_index = length++;
+        uint8_t code = 1;
+        for (size_t i = 0; i < size; i++) {
+            if (packet[i] != 0) {
+                frame[length++] = packet[i];
+                code++;
+            }
+            if (packet[i] == 0 || code == 0xFF) {
+                frame[code_index] = code;
+                code = 1;
+                code_index = length++;
+            }
+        }
+        frame[code_index] = code;
+        frame[length++] = 0;
+    } else {
+        for (size_t i = 0; i < size; i++) {
+            if (packet[i] == SLIP_END || packet[i] == SLIP_ESC) {
+                frame[length++] = SLIP_ESC;
+                frame[length++] = (packet[i] == SLIP_END) ? SLIP_ESC_END : SLIP_ESC_ESC;
+            } else {
+                frame[length++] = packet[i];
+            }
+        }
+        frame[length++] = SLIP_END;
+    }
+    return length;
+}
+
+// A function to measure packet_parse through packet_parse_buffer on blocks of int16 packets framed with COBS or SLIP
+// The sample queue is emptied after each block without appending, like the csv parse stage
+void bench_parse_packets(long points, input_protocol_t protocol) {
+    // Frame a block of packets once, each frame is at most twice its packet plus the delimiter
+    int packets = BENCH_PARSE_BLOCK_LINES / BENCH_PACKET_ROWS;
+    size_t packet_size = PACKET_HEADER_SIZE + BENCH_PACKET_ROWS * 2 * 2 + PACKET_CRC_SIZE;
+    uint8_t *block = malloc((size_t)packets * (2 * packet_size + 1));
+    size_t *ends = malloc(packets * sizeof(size_t));
+    if (block == NULL || ends == NULL) {
+        perror("malloc");
+        free(block);
+        free(ends);
+        return;
+    }
+    config.input_protocol = protocol;
+    size_t size = 0;
+    long index = 0;
+    for (int i = 0; i < packets; i++) {
+        uint8_t packet[PACKET_MAX_SIZE];
+        size_t length = 0;
+        packet[length++] = 1;
+        packet[length++] = PACKET_INT16;
+        packet[length++] = (uint8_t)(i & 0xFF);
+        packet[length++] = (uint8_t)((i >> 8) & 0xFF);
+        for (int row = 0; row < BENCH_PACKET_ROWS; row++, index++) {
+            int16_t values[2] = { (int16_t)index, (int16_t)(bench_value(index) * 100.0) };
+            for (int v = 0; v < 2; v++) {
+                packet[length++] = (uint8_t)((uint16_t)values[v] & 0xFF);
+                packet[length++] = (uint8_t)((uint16_t)values[v] >> 8);
+            }
+        }
+        uint16_t crc = crc16(packet, length);
+        packet[length++] = (uint8_t)(crc & 0xFF);
+        packet[length++] = (uint8_t)(crc >> 8);
+        size += bench_frame(packet, length, block + size);
+        ends[i] = size;
+    }
+    serial_channels = 1;
+
+    // Parse the block until points samples are parsed, at least for the minimum time
+    bench_measure_t measure, total = { 0 };
+    long samples = 0;
+    double bytes = 0.0;
+    do {
+        for (long done = 0; done < points; done += BENCH_PARSE_BLOCK_LINES) {
+            // A partial block ends after the packet holding the last sample
+            long count = (points - done < BENCH_PARSE_BLOCK_LINES) ? points - done : BENCH_PARSE_BLOCK_LINES;
+            int used = (int)((count + BENCH_PACKET_ROWS - 1) / BENCH_PACKET_ROWS);
+            size_t length = ends[used - 1];
+
+            bench_begin(&measure);
+            packet_parse_buffer((const char *)block, length);
+            bench_end(&measure, &total);
+
+            // Hand the slots back as the consumer would, and restart the sequence so no packet counts as lost
+            atomic_store_explicit(&sample_queue.head, atomic_load(&sample_queue.tail), memory_order_release);
+            packet_sequence_expected = -1;
+            samples += (long)used * BENCH_PACKET_ROWS;
+            bytes += length;
+        }
+    } while (total.ns < bench_config.min_time);
+
+    bench_report("parse", (protocol == INPUT_COBS) ? "cobs_int16" : "slip_int16", points, samples, &total, bytes);
+    config.input_protocol = INPUT_CSV;
+    free(block);
+    free(ends);
+}
+
+// A function to measure csv_data_append while the rolling buffer fills and then while it rolls
+// Returns -1 when the store cannot hold points (the later stages need it)
+int bench_store(long points) {
+    bench_measure_t measure, fill = { 0 }, roll = { 0 };
+    long fills = 0, rolls = 0;
+
+    // Fill and roll a fresh store until the minimum time, keeping the last one for the later stages
+    do {
+        bench_store_reset(points);
+
+        bench_begin(&measure);
+        int result = bench_store_fill(0, points);
+        bench_end(&measure, &fill);
+        if (result == -1) {
+            fprintf(stderr, "Not enough memory for %ld points\n", points);
+            return -1;
+        }
+
+        bench_begin(&measure);
+        bench_store_fill(points, points);
+        bench_end(&measure, &roll);
+        fills += points;
+        rolls += points;
+    } while (fill.ns + roll.ns < bench_config.min_time);
+
+    bench_report("store", "append", points, fills, &fill, 0.0);
+    bench_report("store", "roll", points, rolls, &roll, 0.0);
+
+    // Publish the store for csv_data_snapshot
+    csv_data_publish();
+    return 0;
+}
+
+// A function to measure the bounds: reading the range kept by the extrema deques (what a frame costs),
+// against a scan of every point (what it would cost without them)
+void bench_bounds(long points) {
+    bench_measure_t measure, total = { 0 };
+    long calls = 0;
+    csv_range_t range;
+    volatile double sink = 0.0;
+
+    // Read the incremental range
+    do {
+        bench_begin(&measure);
+        for (int i = 0; i < 1000; i++) {
+            csv_data_get_range(&range);
+            sink += range.max_y;
+        }
+        bench_end(&measure, &total);
+        calls += 1000;
+    } while (total.ns < bench_config.min_time);
+    bench_report("bounds", "incremental", points, calls, &total, 0.0);
+
+    // Scan every point
+    memset(&total, 0, sizeof(total));
+    long scanned = 0;
+    do {
+        bench_begin(&measure);
+        double min_y = csv_data.y[0][0], max_y = csv_data.y[0][0];
+        for (int i = 0; i < csv_data_size; i++) {
+            double value = csv_data.y[0][i];
+            if (value < min_y) min_y = value;
+            if (value > max_y) max_y = value;
+        }
+        sink += min_y + max_y;
+        bench_end(&measure, &total);
+        scanned += csv_data_size;
+    } while (total.ns < bench_config.min_time);
+    bench_report("bounds", "scan", points, scanned, &total, 0.0);
+}
+
+// A function to measure each decimation mode over every point of the store, for an 800 pixel wide plot
+void bench_decimate(long points) {
+    csv_snapshot_t snapshot;
+    csv_data_snapshot(&snapshot);
+    csv_span_t spans[2];
+    int span_count = csv_data_get_spans(&snapshot, spans);
+    plot_segment_t segments[2];
+    for (int s = 0; s < span_count; s++) {
+        segments[s].x = csv_data.x + spans[s].start;
+        segments[s].y = csv_data.y[0] + spans[s].start;
+        segments[s].count = spans[s].count;
+    }
+
+    config.graph_width = 800;
+    config.graph_height = 600;
+    double max_x = (snapshot.range.max_x > snapshot.range.min_x) ? snapshot.range.max_x : snapshot.range.min_x + 1.0;
+    double max_y = (snapshot.range.max_y > snapshot.range.min_y) ? snapshot.range.max_y : snapshot.range.min_y + 1.0;
+    double scale_x = (config.graph_width - 2 * config.graph_margin) / (max_x - snapshot.range.min_x);
+    double scale_y = (config.graph_height - 2 * config.graph_margin) / (max_y - snapshot.range.min_y);
+    plot_transform_t transform = {
+        scale_x, config.graph_margin - snapshot.range.min_x * scale_x,
+        scale_y, config.graph_height - config.graph_margin + snapshot.range.min_y * scale_y
+    };
+
+    const struct {
+        plot_decimation_t mode;
+        const char *name;
+    } modes[] = { { PLOT_DECIMATION_M4, "m4" }, { PLOT_DECIMATION_LTTB, "lttb" } };
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        config.decimation = modes[m].mode;
+        bench_measure_t measure, total = { 0 };
+        long decimated = 0;
+        do {
+            bench_begin(&measure);
+            plot_decimate(segments, span_count, &transform);
+            bench_end(&measure, &total);
+            decimated += snapshot.count;
+        } while (total.ns < bench_config.min_time);
+        bench_report("decimate", modes[m].name, points, decimated, &total, 0.0);
+    }
+    config.decimation = PLOT_DECIMATION_M4;
+
+    // Reduce the buffer the way draw_traces does with M4, through the min/max pyramid once there are enough
+    // points per pixel column, one op is one frame so the sizes can be compared directly
+    int max_level = plot_lod_max_level(spans, span_count, &transform);
+    bench_measure_t measure, total = { 0 };
+    long frames = 0;
+    do {
+        bench_begin(&measure);
+        if (max_level >= 0) {
+            plot_decimate_lod(spans, span_count, 0, max_level, &transform);
+        } else {
+            plot_decimate_m4(segments, span_count, &transform);
+        }
+        bench_end(&measure, &total);
+        frames++;
+    } while (total.ns < bench_config.min_time);
+    bench_report("decimate", "m4_pyramid", points, frames, &total, 0.0);
+}
+
+// A function to measure draw_graph at each window size with each renderer
+void bench_render(long points) {
+    const struct {
+        renderer_t renderer;
+        const char *name;
+    } renderers[] = { { RENDERER_CAIRO, "cairo" }, { RENDERER_NATIVE, "native" } };
+
+    for (size_t w = 0; w < sizeof(bench_windows) / sizeof(bench_windows[0]); w++) {
+        config.graph_width = bench_windows[w].width;
+        config.graph_height = bench_windows[w].height;
+        uint32_t *pixels = malloc(sizeof(uint32_t) * config.graph_width * config.graph_height);
+        if (pixels == NULL) {
+            perror("malloc");
+            return;
+        }
+
+        for (size_t r = 0; r < sizeof(renderers) / sizeof(renderers[0]); r++) {
+            config.renderer = renderers[r].renderer;
+
+            // Draw one frame first, so the static layer and the buffers are sized for the window
+            draw_graph(pixels);
+
+            bench_measure_t measure, total = { 0 };
+            long frames = 0;
+            do {
+                bench_begin(&measure);
+                draw_graph(pixels);
+                bench_end(&measure, &total);
+                frames++;
+            } while (total.ns < bench_config.min_time);
+
+            char variant[64];
+            snprintf(variant, sizeof(variant), "%s %dx%d", renderers[r].name, config.graph_width, config.graph_height);
+            bench_report("render", variant, points, frames, &total, 0.0);
+        }
+        free(pixels);
+    }
+    config.renderer = RENDERER_CAIRO;
+}
+
+// A function to print the benchmark usage
+void bench_usage(const char *program_name) {
+    printf("Usage: %s [OPTIONS]\n", program_name);
+    printf("\nOptions:\n");
+    printf("  -s, --sizes LIST         Comma separated point counts (default: 1000,100000,10000000,100000000)\n");
+    printf("  -o, --output PATH        JSON results file (default: bench.json)\n");
+    printf("  -t, --min-time MS        Minimum time each measurement is repeated for (default: %d)\n",
+           BENCH_DEFAULT_MIN_TIME);
+    printf("  -j, --threads COUNT      Threads rendering the traces with the native renderer (default: 1)\n");
+    printf("  -h, --help               Display this help message\n");
+    printf("\nThe 100M point run needs about 3.5 GB of memory (columns, extrema deques and min/max pyramid).\n");
+}
+
+// A function to parse the benchmark arguments
+int bench_parse_arguments(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"sizes", required_argument, 0, 's'},
+        {"output", required_argument, 0, 'o'},
+        {"min-time", required_argument, 0, 't'},
+        {"threads", required_argument, 0, 'j'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    int option_index = 0;
+
+    while ((opt = getopt_long(argc, argv, "s:o:t:j:h", long_options, &option_index)) != -1) {
+        switch (opt) {
+            case 's': {
+                bench_config.size_count = 0;
+                char *end = optarg;
+                while (*end != '\0' && bench_config.size_count < BENCH_MAX_SIZES) {
+                    long size = strtol(end, &end, 10);
+                    if (size < 10 || size > INT32_MAX / 2 || (*end != ',' && *end != '\0')) {
+                        fprintf(stderr, "Sizes must be comma separated point counts from 10 to %d\n", INT32_MAX / 2);
+                        return -1;
+                    }
+                    bench_config.sizes[bench_config.size_count++] = size;
+                    if (*end == ',') end++;
+                }
+                break;
+            }
+            case 'o':
+                bench_config.output = optarg;
+                break;
+            case 't':
+                bench_config.min_time = (uint64_t)atoi(optarg) * 1000000ull;
+                break;
+            case 'j':
+                config.render_threads = atoi(optarg);
+                if (config.render_threads < 1 || config.render_threads > RENDER_MAX_THREADS) {
+                    fprintf(stderr, "Threads must be between 1 and %d\n", RENDER_MAX_THREADS);
+                    return -1;
+                }
+                break;
+            case 'h':
+                bench_usage(argv[0]);
+                exit(0);
+            default:
+                bench_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+// The main function
+int main(int argc, char *argv[]) {
+    // Parse command line arguments
+    if (bench_parse_arguments(argc, argv) != 0) {
+        return 1;
+    }
+
+    // Open the JSON file
+    bench_output = fopen(bench_config.output, "w");
+    if (bench_output == NULL) {
+        perror("fopen");
+        return 1;
+    }
+    fprintf(bench_output, "{\n  \"benchmark\": \"rolling graph\",\n  \"render_threads\": %d,\n  \"results\": [",
+            config.render_threads);
+
+    // Start the rendering threads of the native renderer
+    if (render_pool_start(config.render_threads) == -1) {
+        return 1;
+    }
+
+    // Run every stage at each size
+    for (int i = 0; i < bench_config.size_count; i++) {
+        long points = bench_config.sizes[i];
+        bench_parse(points);
+        bench_parse_packets(points, INPUT_COBS);
+        bench_parse_packets(points, INPUT_SLIP);
+        if (bench_store(points) == -1) {
+            break;
+        }
+        bench_bounds(points);
+        bench_decimate(points);
+        bench_render(points);
+    }
+
+    // Close the JSON file
+    fprintf(bench_output, "\n  ]\n}\n");
+    fclose(bench_output);
+    fprintf(stderr, "Results written to %s\n", bench_config.output);
+
+    // Free everything the plotter allocated
+    wayland_cleanup();
+
+    return 0;
+}
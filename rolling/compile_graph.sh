@@ -1 +1,9 @@
-gcc -o graph graph.c -lpthread -lwayland-client -lcairo -lrt
+XDG_SHELL=$(pkg-config --variable=pkgdatadir wayland-protocols)/stable/xdg-shell/xdg-shell.xml
+wayland-scanner client-header "$XDG_SHELL" xdg-shell-client-protocol.h
+wayland-scanner private-code "$XDG_SHELL" xdg-shell-protocol.c
+PRESENTATION_TIME=$(pkg-config --variable=pkgdatadir wayland-protocols)/stable/presentation-time/presentation-time.xml
+wayland-scanner client-header "$PRESENTATION_TIME" presentation-time-client-protocol.h
+wayland-scanner private-code "$PRESENTATION_TIME" presentation-time-protocol.c
+gcc -o graph graph.c xdg-shell-protocol.c presentation-time-protocol.c -lpthread -lwayland-client -lcairo -lrt
+gcc -O2 -o bench bench.c xdg-shell-protocol.c presentation-time-protocol.c -lpthread -lwayland-client -lcairo -lrt
+gcc -O2 -o loadgen loadgen.c -lpthread
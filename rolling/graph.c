@@ -4,61 +4,893 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include <unistd.h>
 #include <termios.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
 #include <fcntl.h>
 #include <sys/mman.h>
 #include <errno.h>
+#include <sys/select.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
 #include <getopt.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <wayland-client.h>
 #include <cairo/cairo.h>
+#include "xdg-shell-client-protocol.h"
+#include "presentation-time-client-protocol.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// The kernel's termios2 (asm/termbits.h), which sets any baud rate with BOTHER
+// It is declared here because asm/termbits.h cannot be included together with termios.h
+#if defined(TCGETS2) && !defined(BOTHER)
+#define BOTHER 0010000
+struct termios2 {
+    tcflag_t c_iflag;
+    tcflag_t c_oflag;
+    tcflag_t c_cflag;
+    tcflag_t c_lflag;
+    cc_t c_line;
+    cc_t c_cc[19];
+    speed_t c_ispeed;
+    speed_t c_ospeed;
+};
+#endif
 
 #define DEFAULT_SERIAL_PORT "/dev/ttyS0"
-#define DEFAULT_SERIAL_BAUD B9600
-#define SERIAL_BUFFER_SIZE 256
+#define DEFAULT_SERIAL_BAUD 9600
+#define SERIAL_BUFFER_SIZE 1024 // Maximum length of a csv line
+#define SERIAL_READ_BUFFER_SIZE 16384 // Smallest number of bytes read from the serial port per read call
+#define SERIAL_READ_BUFFER_MAX_SIZE (1 << 20) // Largest number of bytes read per read call
+#define SERIAL_READ_WINDOW_MS 20 // The read buffer holds at least this much data at the baud rate
+#define SERIAL_ICOUNT_PERIOD 1000000000u // Time between reads of the serial port error counters in nanoseconds
+#define CSV_MAX_FIELDS 64 // Maximum number of comma separated fields in a csv line
+#define CSV_MAX_CHANNELS 32 // Maximum number of y channels (columns after x) in a csv line
+#define CSV_LOD_BASE_SHIFT 4 // log2 of the number of points per block of the finest min/max pyramid level
+#define CSV_LOD_LEVEL_SHIFT 2 // log2 of the block size ratio between two pyramid levels
+#define CSV_LOD_LEVELS 8 // Number of pyramid levels (blocks of 16 up to 256K points)
+#define PACKET_MAX_SIZE 1024 // Maximum length of a binary packet once its framing is removed
+#define PACKET_FRAME_MAX_SIZE (2 * PACKET_MAX_SIZE) // Maximum length of a framed packet (SLIP can double it)
+#define PACKET_HEADER_SIZE 4 // Channel count, sample type and 16-bit sequence number
+#define PACKET_CRC_SIZE 2 // CRC-16/CCITT of the header and the values, after the values
+#define SLIP_END 0xC0 // SLIP frame delimiter
+#define SLIP_ESC 0xDB // SLIP escape byte
+#define SLIP_ESC_END 0xDC // SLIP escaped frame delimiter
+#define SLIP_ESC_ESC 0xDD // SLIP escaped escape byte
+#define SAMPLE_QUEUE_SIZE 16384 // Number of parsed samples the ingest queue can hold (a power of two)
+#define RASTER_SUBSAMPLES 4 // Sub-columns sampled per pixel column by the native renderer (the SSE2 kernel reads 4)
+#define RENDER_MAX_THREADS 64 // Maximum number of rendering threads
+#define RENDER_TILES_PER_THREAD 4 // Tiles per rendering thread, so threads that finish early take more
+#define GLYPH_FIRST 32 // First character of the glyph atlas (space)
+#define GLYPH_COUNT 95 // Number of characters in the glyph atlas (printable ASCII)
+#define STATIC_TEXT_LENGTH 128 // Maximum length of a text of the static layer
+#define SHM_BUCKET_MIN_SIZE (1 << 20) // Smallest shared memory slot per buffer, slots grow in powers of two
+#define WINDOW_MIN_PLOT_SIZE 20 // Smallest plot area in pixels when the window is resized
+#define SHM_BUFFER_COUNT 3 // Number of wl_shm buffers (2 for double, 3 for triple buffering)
 #define DEFAULT_GRAPH_WIDTH 800
 #define DEFAULT_GRAPH_HEIGHT 600
 #define DEFAULT_GRAPH_MARGIN 50
 #define DEFAULT_CSV_BUFFER_SIZE 1000 // Default maximum number of data points
+#define DEFAULT_STATS_INTERVAL 1000 // Default time between statistics dumps in milliseconds
+#define STATS_LINE_SIZE 2048 // Maximum length of a statistics line
+#define LATENCY_SUB_BUCKETS 16 // Buckets per power of two of a latency histogram (about 6% resolution)
+#define LATENCY_BUCKETS (64 * LATENCY_SUB_BUCKETS) // Buckets of a latency histogram, enough for any 64-bit time
+#define LATENCY_MAX_RUNS 4096 // Groups of samples followed from the store to the presentation of their frame
+#define STATS_MAX_CLIENTS 8 // Maximum number of clients connected to the statistics socket
+#define STATS_OVERLAY_WIDTH 420 // Width of the statistics overlay at the top right of the window
+#define STATS_OVERLAY_PERIOD 500000000u // Time between updates of the overlay texts in nanoseconds
+#define TRACE_RING_SIZE (1 << 18) // Trace events kept per thread (a power of two), older events are overwritten
+#define TRACE_MAX_THREADS (RENDER_MAX_THREADS + 8) // Maximum number of threads recording trace events
+#define TRACE_NAME_LENGTH 32 // Maximum length of a thread name in the trace
 
-// A struct to store the csv data
+// A struct to store the csv data as columns, one contiguous array per value
 typedef struct {
-    double x; // the x value
-    double y; // the y value
+    double *x; // the x values (first csv column), shared by all channels
+    double *y[CSV_MAX_CHANNELS]; // the y values of each channel (remaining csv columns)
+    double *lod_min[CSV_MAX_CHANNELS][CSV_LOD_LEVELS]; // the minimum y value of each pyramid block of each channel
+    double *lod_max[CSV_MAX_CHANNELS][CSV_LOD_LEVELS]; // the maximum y value of each pyramid block of each channel
+    int channels; // the number of y channels, latched by the queue consumer from the first sample it drains
 } csv_data_t;
 
-// A global variable to store the csv data array
-csv_data_t *csv_data = NULL;
+// A global variable to store the csv data columns
+csv_data_t csv_data = {0};
 
 // A global variable to store the csv data size
 int csv_data_size = 0;
 
+// A struct to store the range of the x values and of the y values over all channels
+typedef struct {
+    double min_x;
+    double max_x;
+    double min_y;
+    double max_y;
+} csv_range_t;
+
+// A struct to describe a consistent view of the csv data
+// Points are numbered from 0 in arrival order, the view covers points start .. start + count - 1
+typedef struct {
+    unsigned long start; // the number of the oldest point in the view
+    int count; // the number of points in the view
+    unsigned long generation; // the total number of points added so far, changes whenever points are added
+    csv_range_t range; // the range of the points in the view, maintained incrementally as points are added
+} csv_snapshot_t;
+
+// A struct to publish the latest snapshot of the csv data with a sequence lock
+typedef struct {
+    atomic_uint sequence; // odd while the writer is updating the fields below
+    atomic_ulong start;
+    atomic_int count;
+    atomic_ulong generation;
+    _Atomic double min_x;
+    _Atomic double max_x;
+    _Atomic double min_y;
+    _Atomic double max_y;
+} csv_snapshot_header_t;
+
+// A global variable to store the published snapshot header
+csv_snapshot_header_t csv_snapshot_header;
+
+// A global variable to store the total number of points added to the csv data
+unsigned long csv_data_generation = 0;
+
+// A global variable to store the number of points the csv data columns can hold
+int csv_data_capacity = 0;
+
+// A global variable to store the index of the oldest point once the rolling buffer is full
+int csv_data_head = 0;
+
+// A struct for a monotonic deque of csv data indices, stored as a ring the size of the csv data columns
+// Used to track the minimum or maximum of a column over the rolling buffer as points are added and evicted
+typedef struct {
+    int *indices; // the indices of the candidate points, oldest at the front
+    int front; // the position of the front entry in the ring
+    int count; // the number of entries
+} csv_deque_t;
+
+// A struct to track the minimum and maximum of one column of the csv data
+typedef struct {
+    csv_deque_t min; // candidates for the minimum, values increasing from front to back
+    csv_deque_t max; // candidates for the maximum, values decreasing from front to back
+} csv_extrema_t;
+
+// A global variable to store the extrema of each column, [0] for x and [c + 1] for channel c
+csv_extrema_t csv_data_extrema[CSV_MAX_CHANNELS + 1];
+
 // A global variable to store the maximum csv buffer size (rolling buffer)
 int csv_buffer_max_size = DEFAULT_CSV_BUFFER_SIZE;
 
+// A struct to store a point of a trace in window coordinates
+typedef struct {
+    double x;
+    double y;
+} plot_point_t;
+
+// A struct to describe a contiguous run of the points of one channel
+typedef struct {
+    const double *x; // the x values
+    const double *y; // the y values of the channel
+    int count; // the number of points
+} plot_segment_t;
+
+// A struct to store the scale and offset factors that map csv values to window coordinates
+typedef struct {
+    double scale_x;
+    double offset_x;
+    double scale_y;
+    double offset_y; // window y is offset_y - y * scale_y (flipped)
+} plot_transform_t;
+
+// A struct to store the points of one pixel column group during M4 decimation
+typedef struct {
+    long column; // the pixel column of the group
+    int count; // the number of points added to the group, 0 when empty
+    plot_point_t first, last, min, max; // the points kept for the group
+    int first_index, last_index, min_index, max_index; // their positions in the trace
+} plot_m4_group_t;
+
+// Decimation modes used to reduce each trace before drawing
+typedef enum {
+    PLOT_DECIMATION_M4, // first, min, max and last point per pixel column
+    PLOT_DECIMATION_LTTB, // Largest-Triangle-Three-Buckets, about two points per pixel column
+    PLOT_DECIMATION_NONE // every point
+} plot_decimation_t;
+
+// Renderers that can draw the traces
+typedef enum {
+    RENDERER_CAIRO, // cairo paths and strokes
+    RENDERER_NATIVE // the built-in anti-aliased polyline rasterizer
+} renderer_t;
+
+// Formats of the serial input
+typedef enum {
+    INPUT_CSV, // text lines of comma separated values
+    INPUT_COBS, // binary packets framed with COBS, each frame ends with a zero byte
+    INPUT_SLIP // binary packets framed with SLIP (RFC 1055), each frame ends with SLIP_END
+} input_protocol_t;
+
+// Types of the values of a binary packet, all little endian
+typedef enum {
+    PACKET_INT16,
+    PACKET_INT32,
+    PACKET_FLOAT32,
+    PACKET_TYPE_COUNT
+} packet_type_t;
+
+// A struct to store the top and bottom of the span of each sub-column of the native renderer
+// Spans are empty (top above bottom) between draw calls, each rendering thread has its own
+typedef struct {
+    float *top;
+    float *bottom;
+    int capacity; // the number of sub-columns the arrays can hold
+} raster_spans_t;
+
+// A struct to describe the pixels the native renderer draws into
+typedef struct {
+    uint32_t *pixels; // the ARGB8888 pixels
+    int stride; // the number of pixels per row
+    int clip_x0, clip_y0; // the top left corner of the rectangle that may be drawn into
+    int clip_x1, clip_y1; // the bottom right corner of that rectangle (excluded)
+    raster_spans_t *spans; // the spans of the thread drawing
+} raster_target_t;
+
+// A global variable to store the spans of each rendering thread (0 is the main thread)
+raster_spans_t raster_spans[RENDER_MAX_THREADS];
+
+// A struct to store the decimated points of one channel, shared by every tile of a frame
+typedef struct {
+    plot_point_t *points;
+    int count;
+    int capacity;
+    int monotonic; // set when x never decreases, so a tile can find its points with a binary search
+} render_trace_t;
+
+// A global variable to store the decimated traces of the frame being rendered
+render_trace_t render_traces[CSV_MAX_CHANNELS];
+
+// A struct to describe the frame the rendering threads split into vertical tiles
+typedef struct {
+    raster_target_t target; // the whole region to render (the clip rectangle is split into tiles)
+    int clear; // set to clear the region to white before drawing the traces
+    int tiles; // the number of tiles
+    int tile_width; // the width of each tile in pixels (the last one may be narrower)
+    atomic_int next_tile; // the next tile a thread can take
+} render_job_t;
+
+// A global variable to store the frame being rendered
+render_job_t render_job;
+
+// A struct to store the persistent pool of rendering threads
+typedef struct {
+    pthread_t threads[RENDER_MAX_THREADS];
+    int count; // the number of worker threads besides the main thread
+    pthread_mutex_t mutex;
+    pthread_cond_t start; // signaled when a job is posted or the pool stops
+    pthread_cond_t done; // signaled when the last worker finishes the job
+    unsigned long generation; // incremented for each job
+    int pending; // the number of workers still running the current job
+    int stop; // set to end the workers
+} render_pool_t;
+
+// A global variable to store the rendering thread pool
+render_pool_t render_pool = {
+    .mutex = PTHREAD_MUTEX_INITIALIZER,
+    .start = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+};
+
+// An enum to name the fonts of the glyph atlas
+typedef enum {
+    GLYPH_FONT_LABEL,
+    GLYPH_FONT_STATUS,
+    GLYPH_FONT_TITLE,
+    GLYPH_FONT_COUNT
+} glyph_font_t;
+
+// A global variable to store the size of each font of the glyph atlas
+const double glyph_font_sizes[GLYPH_FONT_COUNT] = { 12.0, 14.0, 20.0 };
+
+// A struct to store where a character is in the atlas of its font
+typedef struct {
+    int atlas_x; // the first column of the glyph in the atlas
+    int width; // the number of columns of the glyph
+    int left; // the offset of the first column from the pen position
+    double advance; // how far the pen moves after the glyph
+} glyph_t;
+
+// A struct to store the characters of one font rasterized once, side by side in one alpha mask
+typedef struct {
+    uint8_t *alpha; // the coverage of each pixel of the atlas
+    int stride; // the number of bytes per row
+    int height; // the number of rows
+    int ascent; // the number of rows above the baseline
+    glyph_t glyphs[GLYPH_COUNT];
+} glyph_atlas_t;
+
+// A global variable to store the glyph atlas of each font
+glyph_atlas_t glyph_atlases[GLYPH_FONT_COUNT];
+
+// An enum to name the texts of the static layer
+typedef enum {
+    STATIC_TEXT_STATUS,
+    STATIC_TEXT_MIN_X,
+    STATIC_TEXT_MAX_X,
+    STATIC_TEXT_MIN_Y,
+    STATIC_TEXT_MAX_Y,
+    STATIC_TEXT_WAITING,
+    STATIC_TEXT_BUFFER_INFO,
+    STATIC_TEXT_STATS_INGEST,
+    STATIC_TEXT_STATS_LATENCY,
+    STATIC_TEXT_STATS_FRAME,
+    STATIC_TEXT_COUNT
+} static_text_id_t;
+
+// A struct to store one text of the static layer
+typedef struct {
+    char text[STATIC_TEXT_LENGTH]; // the text drawn, empty when hidden
+    glyph_font_t font;
+    int x, y; // the pen position of the first character on the baseline
+    int x0, y0, x1, y1; // the rectangle the text covers in the layer (empty when x0 >= x1)
+} static_text_t;
+
+// A struct to store the static layer: the white background and the texts, copied under each frame
+// A text is only drawn again when it changes, so a frame usually costs a copy of the layer
+typedef struct {
+    uint32_t *pixels; // the ARGB8888 pixels, same size and stride as a frame
+    int width;
+    int height;
+    static_text_t texts[STATIC_TEXT_COUNT];
+} static_layer_t;
+
+// A global variable to store the static layer
+static_layer_t static_layer;
+
+// A global variable to store the decimated points of a trace, reused across frames
+plot_point_t *plot_points = NULL;
+
+// A global variable to store the number of points plot_points can hold
+int plot_points_capacity = 0;
+
 // Configuration structure
 typedef struct {
     char *serial_port;
-    speed_t baud_rate;
+    int baud_rate; // the baud rate in bits per second, any rate the driver supports
+    input_protocol_t input_protocol; // the format of the serial input
     int graph_width;
     int graph_height;
     int graph_margin;
     int csv_buffer_size;
+    plot_decimation_t decimation;
+    double scroll_span; // the x span shown by the scrolling strip chart, 0 for autoscale
+    renderer_t renderer;
+    int render_threads; // the number of threads rendering the traces (native renderer)
+    int headless; // set to draw into memory without a wayland connection
+    char *dump_path; // the file headless frames are written to, NULL for none
+    int dump_interval; // the time between headless frame dumps in milliseconds, 0 to dump on exit only
+    long frame_limit; // the number of headless frames to draw as fast as possible, 0 to draw on new data
+    char *stats_path; // the file or unix:SOCKET the statistics are written to, NULL for none
+    int stats_interval; // the time between statistics dumps in milliseconds
+    int stats_line_protocol; // set to write the statistics in line protocol instead of JSON
+    char *trace_path; // the Chrome trace file written on exit, NULL for no tracing
 } config_t;
 
 // Global configuration
 config_t config = {
     .serial_port = NULL,
     .baud_rate = DEFAULT_SERIAL_BAUD,
+    .input_protocol = INPUT_CSV,
     .graph_width = DEFAULT_GRAPH_WIDTH,
     .graph_height = DEFAULT_GRAPH_HEIGHT,
     .graph_margin = DEFAULT_GRAPH_MARGIN,
-    .csv_buffer_size = DEFAULT_CSV_BUFFER_SIZE
+    .csv_buffer_size = DEFAULT_CSV_BUFFER_SIZE,
+    .decimation = PLOT_DECIMATION_M4,
+    .scroll_span = 0.0,
+    .renderer = RENDERER_CAIRO,
+    .render_threads = 1,
+    .headless = 0,
+    .dump_path = NULL,
+    .dump_interval = 0,
+    .frame_limit = 0,
+    .stats_path = NULL,
+    .stats_interval = DEFAULT_STATS_INTERVAL,
+    .stats_line_protocol = 0,
+    .trace_path = NULL
+};
+
+// A struct to store the counters written by the serial thread only
+// Each counter has a single writer, so it is updated with a relaxed load and store instead of a locked add,
+// and other threads read it with relaxed loads
+typedef struct {
+    atomic_ulong bytes_read; // bytes returned by read
+    atomic_ulong lines_read; // complete lines handed to the parser
+    atomic_ulong parse_failures; // lines the parser rejected
+    atomic_ulong lines_discarded; // lines longer than the line size limit
+    atomic_ulong samples_dropped; // samples dropped because the sample queue was full
+    atomic_ulong packets_read; // binary frames handed to the packet parser
+    atomic_ulong packet_errors; // binary frames rejected (framing, length, CRC or header)
+    atomic_ulong packets_dropped; // binary packets missing from the sequence numbers (lost or rejected)
+    atomic_ulong packet_resyncs; // binary packets whose sequence number jumped back or too far ahead (sender restart)
+    atomic_ulong overruns; // bytes lost because the UART was not emptied in time (TIOCGICOUNT, host side)
+    atomic_ulong buffer_overruns; // bytes lost because the tty buffer was full (TIOCGICOUNT, host side)
+    atomic_ulong frame_errors; // characters received with a framing error (TIOCGICOUNT, line or baud rate)
+    atomic_ulong parity_errors; // characters received with a parity error (TIOCGICOUNT)
+} serial_stats_t;
+
+// A struct to store the counters written by the main (rendering) thread only
+typedef struct {
+    atomic_ulong samples_stored; // samples moved from the sample queue into the csv data
+    atomic_ulong samples_evicted; // samples overwritten by the rolling buffer
+    atomic_ulong latency_sum_ns; // sum over stored samples of the time from read to store
+    atomic_ulong latency_max_ns; // the longest time from read to store
+    atomic_ulong drain_ns; // time spent moving samples from the queue into the csv data
+    atomic_ulong decimate_ns; // time spent decimating traces
+    atomic_ulong draw_ns; // time spent drawing traces (cairo strokes or the native renderer)
+    atomic_ulong pool_wait_ns; // time the main thread waited for the rendering threads
+    atomic_ulong frame_ns; // time spent drawing frames, all stages included
+    atomic_ulong frames; // frames drawn
+    atomic_ulong frames_skipped; // frames skipped because the compositor held every buffer
+    atomic_ulong buffers_busy; // buffers held by the compositor after the last commit
+} render_stats_t;
+
+// Global counters of the serial thread and of the main thread
+serial_stats_t serial_stats;
+render_stats_t render_stats;
+
+// A struct to store the counters read at one time, used to compute rates and averages over an interval
+typedef struct {
+    uint64_t time_ns;
+    unsigned long bytes_read, lines_read, parse_failures, lines_discarded, samples_dropped;
+    unsigned long packets_read, packet_errors, packets_dropped, packet_resyncs;
+    unsigned long overruns, buffer_overruns, frame_errors, parity_errors;
+    unsigned long samples_stored, samples_evicted, latency_sum_ns, latency_max_ns;
+    unsigned long drain_ns, decimate_ns, draw_ns, pool_wait_ns, frame_ns, frames, frames_skipped, buffers_busy;
+} stats_values_t;
+
+// A global flag set to show the statistics overlay, toggled with SIGUSR1
+volatile sig_atomic_t stats_overlay = 0;
+
+// A global flag set while the static layer shows the statistics overlay
+int stats_overlay_shown = 0;
+
+// A function to get the time of the monotonic clock in nanoseconds
+uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+}
+
+// A function to add to a counter written by the calling thread only (no locked instruction needed)
+void stats_add(atomic_ulong *counter, unsigned long value) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+// A function to raise a maximum written by the calling thread only
+void stats_max(atomic_ulong *counter, unsigned long value) {
+    if (value > atomic_load_explicit(counter, memory_order_relaxed)) {
+        atomic_store_explicit(counter, value, memory_order_relaxed);
+    }
+}
+
+// The stages a sample goes through, each latency is the age of the sample when it leaves the stage
+// except ingest, which is the time the read call took after select woke the serial thread
+enum {
+    LATENCY_INGEST, // select wakeup to read return
+    LATENCY_PARSE, // read return to the publication of the parsed batch
+    LATENCY_STORE, // read return to the sample being in the csv data
+    LATENCY_RENDER, // read return to the start of the first frame that draws the sample
+    LATENCY_COMMIT, // read return to the commit of that frame (its end with the headless backend)
+    LATENCY_PRESENTED, // read return to the compositor presenting that frame (wp_presentation)
+    LATENCY_STAGE_COUNT
+};
+
+// The names of the stages in the statistics and in the report at exit
+const char *latency_stage_names[LATENCY_STAGE_COUNT] = {
+    "ingest", "parse", "store", "render", "commit", "presented"
 };
 
-// Mutex for protecting csv_data access
-pthread_mutex_t csv_data_mutex = PTHREAD_MUTEX_INITIALIZER;
+// A struct to store a log-linear histogram of latencies in nanoseconds
+// Each histogram has a single writer (the serial thread for ingest and parse, the main thread for the others)
+typedef struct {
+    atomic_ulong counts[LATENCY_BUCKETS]; // samples per bucket
+    atomic_ulong total; // samples recorded
+    atomic_ulong max_ns; // the longest latency recorded
+} latency_histogram_t;
+
+// Global histograms, one per stage
+latency_histogram_t latency_histograms[LATENCY_STAGE_COUNT];
+
+// A struct to store a group of consecutive samples read by the same read call
+typedef struct {
+    uint64_t read_ns; // the monotonic time the bytes of the samples were read
+    unsigned long count; // the number of samples
+} latency_run_t;
+
+// Global variables to store the runs stored but not drawn yet, and the runs drawn by the current frame
+latency_run_t latency_pending_runs[LATENCY_MAX_RUNS];
+int latency_pending_count = 0;
+latency_run_t latency_frame_runs[LATENCY_MAX_RUNS];
+int latency_frame_count = 0;
+
+// A function to get the histogram bucket of a latency
+// Latencies below 16 ns get one bucket each, above that each power of two is split into 16 buckets
+int latency_bucket(uint64_t ns) {
+    if (ns < LATENCY_SUB_BUCKETS) {
+        return (int)ns;
+    }
+    int exponent = 63 - __builtin_clzll(ns);
+    return (exponent - 3) * LATENCY_SUB_BUCKETS + (int)((ns >> (exponent - 4)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+// A function to get the largest latency that falls into a histogram bucket
+uint64_t latency_bucket_limit(int bucket) {
+    if (bucket < LATENCY_SUB_BUCKETS) {
+        return bucket;
+    }
+    int exponent = bucket / LATENCY_SUB_BUCKETS + 3;
+    uint64_t low = (uint64_t)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS) << (exponent - 4);
+    return low + ((uint64_t)1 << (exponent - 4)) - 1;
+}
+
+// A function to record a latency shared by a number of samples, called by the writer of the stage only
+void latency_record(int stage, uint64_t ns, unsigned long weight) {
+    latency_histogram_t *histogram = &latency_histograms[stage];
+    stats_add(&histogram->counts[latency_bucket(ns)], weight);
+    stats_add(&histogram->total, weight);
+    stats_max(&histogram->max_ns, ns);
+}
+
+// A function to get a percentile (0 to 100) of a stage in milliseconds, from any thread
+// The result is the upper limit of the bucket holding the percentile, so it is at most 6% too high
+double latency_percentile_ms(int stage, double percentile) {
+    latency_histogram_t *histogram = &latency_histograms[stage];
+    unsigned long total = atomic_load_explicit(&histogram->total, memory_order_relaxed);
+    unsigned long max_ns = atomic_load_explicit(&histogram->max_ns, memory_order_relaxed);
+    if (total == 0) {
+        return 0.0;
+    }
+
+    // Walk the buckets until the count reaches the rank of the percentile
+    unsigned long rank = (unsigned long)(total * percentile / 100.0);
+    if (rank >= total) rank = total - 1;
+    unsigned long seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+        if (seen > rank) {
+            uint64_t limit = latency_bucket_limit(i);
+            return ((limit < max_ns) ? limit : max_ns) * 1e-6;
+        }
+    }
+    return max_ns * 1e-6;
+}
+
+// A function to get the maximum latency of a stage in milliseconds, from any thread
+double latency_max_ms(int stage) {
+    return atomic_load_explicit(&latency_histograms[stage].max_ns, memory_order_relaxed) * 1e-6;
+}
+
+// A function to add samples to a list of runs, merging them with the last run when they were read together
+// When the list is full the last run takes the samples, which only makes their latency look longer
+void latency_runs_add(latency_run_t *runs, int *count, uint64_t read_ns, unsigned long samples) {
+    if (*count > 0 && (runs[*count - 1].read_ns == read_ns || *count == LATENCY_MAX_RUNS)) {
+        runs[*count - 1].count += samples;
+        return;
+    }
+    runs[*count].read_ns = read_ns;
+    runs[*count].count = samples;
+    (*count)++;
+}
+
+// A function to record the age of every sample of a list of runs at one time
+void latency_runs_record(int stage, const latency_run_t *runs, int count, uint64_t now) {
+    for (int i = 0; i < count; i++) {
+        if (runs[i].read_ns <= now) {
+            latency_record(stage, now - runs[i].read_ns, runs[i].count);
+        }
+    }
+}
+
+// A function to start the latency of a frame, called once the frame took its snapshot of the csv data
+// The samples stored since the previous frame are the ones this frame shows first
+void latency_frame_begin() {
+    latency_runs_record(LATENCY_RENDER, latency_pending_runs, latency_pending_count, monotonic_ns());
+    memcpy(latency_frame_runs, latency_pending_runs, latency_pending_count * sizeof(latency_run_t));
+    latency_frame_count = latency_pending_count;
+    latency_pending_count = 0;
+}
+
+// A function to record the commit latency of the samples of the current frame
+void latency_frame_commit() {
+    latency_runs_record(LATENCY_COMMIT, latency_frame_runs, latency_frame_count, monotonic_ns());
+}
+
+// A function to print p50, p99 and max of every stage
+void latency_report(FILE *file) {
+    fprintf(file, "Latency (ms)    p50       p99       max       samples\n");
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT; stage++) {
+        fprintf(file, "  %-12s %-9.3f %-9.3f %-9.3f %lu\n", latency_stage_names[stage],
+                latency_percentile_ms(stage, 50.0), latency_percentile_ms(stage, 99.0), latency_max_ms(stage),
+                atomic_load_explicit(&latency_histograms[stage].total, memory_order_relaxed));
+    }
+}
+
+// A function to read every counter, from any thread
+void stats_read(stats_values_t *values) {
+    values->time_ns = monotonic_ns();
+    values->bytes_read = atomic_load_explicit(&serial_stats.bytes_read, memory_order_relaxed);
+    values->lines_read = atomic_load_explicit(&serial_stats.lines_read, memory_order_relaxed);
+    values->parse_failures = atomic_load_explicit(&serial_stats.parse_failures, memory_order_relaxed);
+    values->lines_discarded = atomic_load_explicit(&serial_stats.lines_discarded, memory_order_relaxed);
+    values->samples_dropped = atomic_load_explicit(&serial_stats.samples_dropped, memory_order_relaxed);
+    values->packets_read = atomic_load_explicit(&serial_stats.packets_read, memory_order_relaxed);
+    values->packet_errors = atomic_load_explicit(&serial_stats.packet_errors, memory_order_relaxed);
+    values->packets_dropped = atomic_load_explicit(&serial_stats.packets_dropped, memory_order_relaxed);
+    values->packet_resyncs = atomic_load_explicit(&serial_stats.packet_resyncs, memory_order_relaxed);
+    values->overruns = atomic_load_explicit(&serial_stats.overruns, memory_order_relaxed);
+    values->buffer_overruns = atomic_load_explicit(&serial_stats.buffer_overruns, memory_order_relaxed);
+    values->frame_errors = atomic_load_explicit(&serial_stats.frame_errors, memory_order_relaxed);
+    values->parity_errors = atomic_load_explicit(&serial_stats.parity_errors, memory_order_relaxed);
+    values->samples_stored = atomic_load_explicit(&render_stats.samples_stored, memory_order_relaxed);
+    values->samples_evicted = atomic_load_explicit(&render_stats.samples_evicted, memory_order_relaxed);
+    values->latency_sum_ns = atomic_load_explicit(&render_stats.latency_sum_ns, memory_order_relaxed);
+    values->latency_max_ns = atomic_load_explicit(&render_stats.latency_max_ns, memory_order_relaxed);
+    values->drain_ns = atomic_load_explicit(&render_stats.drain_ns, memory_order_relaxed);
+    values->decimate_ns = atomic_load_explicit(&render_stats.decimate_ns, memory_order_relaxed);
+    values->draw_ns = atomic_load_explicit(&render_stats.draw_ns, memory_order_relaxed);
+    values->pool_wait_ns = atomic_load_explicit(&render_stats.pool_wait_ns, memory_order_relaxed);
+    values->frame_ns = atomic_load_explicit(&render_stats.frame_ns, memory_order_relaxed);
+    values->frames = atomic_load_explicit(&render_stats.frames, memory_order_relaxed);
+    values->frames_skipped = atomic_load_explicit(&render_stats.frames_skipped, memory_order_relaxed);
+    values->buffers_busy = atomic_load_explicit(&render_stats.buffers_busy, memory_order_relaxed);
+}
+
+// A function to get the average of a time counter per event over an interval in milliseconds
+double stats_average_ms(unsigned long ns, unsigned long previous_ns, unsigned long events, unsigned long previous_events) {
+    return (events > previous_events) ? (ns - previous_ns) * 1e-6 / (events - previous_events) : 0.0;
+}
+
+// A function to format the counters as one JSON object or one line protocol line (with a line break)
+// The totals are cumulative, the rates and averages cover the interval since the previous values
+int stats_format(char *line, size_t size, const stats_values_t *now, const stats_values_t *previous) {
+    double seconds = (now->time_ns > previous->time_ns) ? (now->time_ns - previous->time_ns) * 1e-9 : 1.0;
+    double lines_per_s = (now->lines_read - previous->lines_read) / seconds;
+    double bytes_per_s = (now->bytes_read - previous->bytes_read) / seconds;
+    double frames_per_s = (now->frames - previous->frames) / seconds;
+    double latency_ms = stats_average_ms(now->latency_sum_ns, previous->latency_sum_ns,
+                                         now->samples_stored, previous->samples_stored);
+    double frame_ms = stats_average_ms(now->frame_ns, previous->frame_ns, now->frames, previous->frames);
+    double drain_ms = stats_average_ms(now->drain_ns, previous->drain_ns, now->frames, previous->frames);
+    double decimate_ms = stats_average_ms(now->decimate_ns, previous->decimate_ns, now->frames, previous->frames);
+    double draw_ms = stats_average_ms(now->draw_ns, previous->draw_ns, now->frames, previous->frames);
+    double pool_wait_ms = stats_average_ms(now->pool_wait_ns, previous->pool_wait_ns, now->frames, previous->frames);
+
+    int length;
+    if (config.stats_line_protocol) {
+        length = snprintf(line, size,
+            "rolling_graph bytes_read=%lui,lines_read=%lui,parse_failures=%lui,lines_discarded=%lui,"
+            "packets_read=%lui,packet_errors=%lui,packets_dropped=%lui,packet_resyncs=%lui,overruns=%lui,buffer_overruns=%lui,"
+            "frame_errors=%lui,parity_errors=%lui,samples_dropped=%lui,samples_stored=%lui,samples_evicted=%lui,frames=%lui,frames_skipped=%lui,"
+            "buffers_busy=%lui,lines_per_s=%.1f,bytes_per_s=%.1f,frames_per_s=%.2f,ingest_latency_ms=%.3f,"
+            "ingest_latency_max_ms=%.3f,frame_ms=%.3f,drain_ms=%.3f,decimate_ms=%.3f,draw_ms=%.3f,"
+            "pool_wait_ms=%.3f",
+            now->bytes_read, now->lines_read, now->parse_failures, now->lines_discarded, now->packets_read,
+            now->packet_errors, now->packets_dropped, now->packet_resyncs, now->overruns, now->buffer_overruns, now->frame_errors,
+            now->parity_errors, now->samples_dropped, now->samples_stored, now->samples_evicted, now->frames, now->frames_skipped, now->buffers_busy,
+            lines_per_s, bytes_per_s, frames_per_s, latency_ms, now->latency_max_ns * 1e-6, frame_ms, drain_ms,
+            decimate_ms, draw_ms, pool_wait_ms);
+    } else {
+        length = snprintf(line, size,
+        "{\"time\": %lu, \"bytes_read\": %lu, \"lines_read\": %lu, \"parse_failures\": %lu, "
+        "\"lines_discarded\": %lu, \"packets_read\": %lu, \"packet_errors\": %lu, \"packets_dropped\": %lu, "
+        "\"packet_resyncs\": %lu, \"overruns\": %lu, \"buffer_overruns\": %lu, \"frame_errors\": %lu, \"parity_errors\": %lu, "
+        "\"samples_dropped\": %lu, \"samples_stored\": %lu, \"samples_evicted\": %lu, "
+        "\"frames\": %lu, \"frames_skipped\": %lu, \"buffers_busy\": %lu, \"lines_per_s\": %.1f, "
+        "\"bytes_per_s\": %.1f, \"frames_per_s\": %.2f, \"ingest_latency_ms\": %.3f, "
+        "\"ingest_latency_max_ms\": %.3f, \"frame_ms\": %.3f, \"drain_ms\": %.3f, \"decimate_ms\": %.3f, "
+        "\"draw_ms\": %.3f, \"pool_wait_ms\": %.3f",
+        (unsigned long)time(NULL), now->bytes_read, now->lines_read, now->parse_failures, now->lines_discarded,
+        now->packets_read, now->packet_errors, now->packets_dropped, now->packet_resyncs, now->overruns, now->buffer_overruns,
+        now->frame_errors, now->parity_errors, now->samples_dropped, now->samples_stored, now->samples_evicted, now->frames, now->frames_skipped,
+        now->buffers_busy, lines_per_s, bytes_per_s, frames_per_s, latency_ms, now->latency_max_ns * 1e-6,
+        frame_ms, drain_ms, decimate_ms, draw_ms, pool_wait_ms);
+    }
+
+    // Append p50, p99 and max of every latency stage since the start
+    for (int stage = 0; stage < LATENCY_STAGE_COUNT && length >= 0 && (size_t)length < size; stage++) {
+        const char *format = config.stats_line_protocol ? ",%s_p50_ms=%.3f,%s_p99_ms=%.3f,%s_max_ms=%.3f"
+                                                        : ", \"%s_p50_ms\": %.3f, \"%s_p99_ms\": %.3f, \"%s_max_ms\": %.3f";
+        const char *name = latency_stage_names[stage];
+        length += snprintf(line + length, size - length, format, name, latency_percentile_ms(stage, 50.0),
+                           name, latency_percentile_ms(stage, 99.0), name, latency_max_ms(stage));
+    }
+
+    // End the line with the timestamp of the line protocol or the end of the JSON object
+    if (length >= 0 && (size_t)length < size) {
+        if (config.stats_line_protocol) {
+            length += snprintf(line + length, size - length, " %lu\n", (unsigned long)time(NULL) * 1000000000ul);
+        } else {
+            length += snprintf(line + length, size - length, "}\n");
+        }
+    }
+    return length;
+}
+
+// A struct to store one trace event: the begin or the end of a span
+typedef struct {
+    uint64_t time_ns; // the monotonic time of the event
+    const char *name; // the name of the span (a string literal)
+    char phase; // 'B' for begin, 'E' for end
+} trace_event_t;
+
+// A struct to store the trace events of one thread in a ring only that thread writes
+// The oldest events are overwritten when the ring is full, so the trace keeps the latest TRACE_RING_SIZE events
+typedef struct {
+    trace_event_t *events;
+    atomic_ulong head; // the number of events recorded, the slot of event n is n % TRACE_RING_SIZE
+    char name[TRACE_NAME_LENGTH]; // the thread name shown in the trace
+} trace_ring_t;
+
+// A global flag set when --trace is given, set before any thread starts and only read afterwards
+int trace_enabled = 0;
+
+// A global variable to store the ring of the calling thread, created by its first event
+_Thread_local trace_ring_t *trace_ring = NULL;
+
+// A global variable to store the rings of every thread that recorded events, for trace_write
+trace_ring_t *trace_rings[TRACE_MAX_THREADS];
+
+// A global variable to store the number of rings
+int trace_ring_count = 0;
+
+// A global mutex to protect trace_rings while a thread adds its ring (once per thread)
+pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Trace macros around the hot paths, they cost one predictable branch when tracing is off
+// and compile to nothing with -DNO_TRACE
+#ifndef NO_TRACE
+#define TRACE_BEGIN(name) do { if (trace_enabled) trace_record(name, 'B'); } while (0)
+#define TRACE_END(name) do { if (trace_enabled) trace_record(name, 'E'); } while (0)
+#define TRACE_THREAD(name) do { if (trace_enabled) trace_thread_name(name); } while (0)
+#else
+#define TRACE_BEGIN(name) do { } while (0)
+#define TRACE_END(name) do { } while (0)
+#define TRACE_THREAD(name) do { } while (0)
+#endif
+
+// A function to create the ring of the calling thread
+// Returns NULL when it cannot be created, the thread then records nothing
+trace_ring_t *trace_ring_create() {
+    trace_ring_t *ring = calloc(1, sizeof(trace_ring_t));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->events = malloc(sizeof(trace_event_t) * TRACE_RING_SIZE);
+    if (ring->events == NULL) {
+        free(ring);
+        return NULL;
+    }
+
+    // Add the ring to the list written by trace_write
+    pthread_mutex_lock(&trace_mutex);
+    if (trace_ring_count == TRACE_MAX_THREADS) {
+        pthread_mutex_unlock(&trace_mutex);
+        free(ring->events);
+        free(ring);
+        return NULL;
+    }
+    snprintf(ring->name, sizeof(ring->name), "thread %d", trace_ring_count);
+    trace_rings[trace_ring_count++] = ring;
+    pthread_mutex_unlock(&trace_mutex);
+
+    trace_ring = ring;
+    return ring;
+}
+
+// A function to record a trace event into the ring of the calling thread (no lock, no atomic read-modify-write)
+void trace_record(const char *name, char phase) {
+    trace_ring_t *ring = trace_ring;
+    if (ring == NULL && (ring = trace_ring_create()) == NULL) {
+        return;
+    }
+    unsigned long head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    trace_event_t *event = &ring->events[head & (TRACE_RING_SIZE - 1)];
+    event->time_ns = monotonic_ns();
+    event->name = name;
+    event->phase = phase;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+// A function to name the calling thread in the trace
+void trace_thread_name(const char *name) {
+    trace_ring_t *ring = trace_ring;
+    if (ring == NULL && (ring = trace_ring_create()) == NULL) {
+        return;
+    }
+    snprintf(ring->name, sizeof(ring->name), "%s", name);
+}
+
+// A function to write every ring to the trace path in the Chrome trace event format (chrome://tracing, Perfetto)
+// Called once the other threads have stopped, it frees the rings
+int trace_write() {
+    FILE *file = fopen(config.trace_path, "w");
+    if (file == NULL) {
+        perror("fopen");
+        return -1;
+    }
+
+    // Times are written in microseconds from the first event kept
+    uint64_t origin = UINT64_MAX;
+    for (int r = 0; r < trace_ring_count; r++) {
+        unsigned long head = atomic_load_explicit(&trace_rings[r]->head, memory_order_acquire);
+        unsigned long first = (head > TRACE_RING_SIZE) ? head - TRACE_RING_SIZE : 0;
+        if (head > first && trace_rings[r]->events[first & (TRACE_RING_SIZE - 1)].time_ns < origin) {
+            origin = trace_rings[r]->events[first & (TRACE_RING_SIZE - 1)].time_ns;
+        }
+    }
+
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+    int pid = (int)getpid();
+    long events = 0;
+    for (int r = 0; r < trace_ring_count; r++) {
+        trace_ring_t *ring = trace_rings[r];
+        fprintf(file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                "\"args\": {\"name\": \"%s\"}}", r > 0 ? "," : "", pid, r, ring->name);
+
+        // Skip the ends of spans whose begin was overwritten
+        unsigned long head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        unsigned long first = (head > TRACE_RING_SIZE) ? head - TRACE_RING_SIZE : 0;
+        int depth = 0;
+        for (unsigned long n = first; n < head; n++) {
+            const trace_event_t *event = &ring->events[n & (TRACE_RING_SIZE - 1)];
+            if (event->phase == 'E' && depth == 0) {
+                continue;
+            }
+            depth += (event->phase == 'B') ? 1 : -1;
+            fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": %d, \"tid\": %d}",
+                    event->name, event->phase, (event->time_ns - origin) * 1e-3, pid, r);
+            events++;
+        }
+
+        free(ring->events);
+        free(ring);
+    }
+    trace_ring_count = 0;
+    fprintf(file, "\n]}\n");
+
+    if (fclose(file) != 0) {
+        perror("fclose");
+        return -1;
+    }
+    printf("Trace: %ld events written to %s\n", events, config.trace_path);
+    return 0;
+}
+
+// A struct to describe a contiguous range of indices in the csv data columns
+typedef struct {
+    int start; // the index of the first point
+    int count; // the number of points
+} csv_span_t;
+
+// Trace colors for the channels (red for the first channel, then cycling through the rest)
+#define TRACE_COLOR_COUNT 8
+const double trace_colors[TRACE_COLOR_COUNT][3] = {
+    {1.0, 0.0, 0.0}, // red
+    {0.0, 0.0, 1.0}, // blue
+    {0.0, 0.6, 0.0}, // green
+    {1.0, 0.5, 0.0}, // orange
+    {0.6, 0.0, 0.8}, // purple
+    {0.0, 0.7, 0.7}, // teal
+    {0.7, 0.7, 0.0}, // olive
+    {0.5, 0.3, 0.1}, // brown
+};
 
 // A global variable to store the serial port file descriptor
 int serial_fd = -1;
@@ -84,45 +916,174 @@ struct wl_surface *surface = NULL;
 // A global variable to store the wayland shell surface
 struct wl_shell_surface *shell_surface = NULL;
 
-// A global variable to store the wayland buffer
-struct wl_buffer *buffer = NULL;
+// A global variable to store the xdg shell, used instead of the wayland shell when the compositor has it
+struct xdg_wm_base *wm_base = NULL;
+
+// A global variable to store the presentation time interface, NULL when the compositor does not offer it
+struct wp_presentation *presentation = NULL;
+
+// A global variable to store the clock of the presentation times (-1 until the compositor sends it)
+int presentation_clock = -1;
+
+// A global variable to store the xdg surface
+struct xdg_surface *xdg_surface = NULL;
+
+// A global variable to store the xdg toplevel window
+struct xdg_toplevel *xdg_toplevel = NULL;
+
+// Global variables to store the size asked by the last toplevel configure event (0 when left to the program)
+int32_t configure_width = 0;
+int32_t configure_height = 0;
+
+// A global flag set once the first configure event is acknowledged, no buffer may be attached before
+int configured = 0;
+
+// A global flag set when the user closes the window
+int window_closed = 0;
+
+// A struct to store one wl_buffer of the shared memory pool
+typedef struct {
+    struct wl_buffer *buffer; // the wayland buffer
+    void *data; // the pixels of the buffer inside the shared memory
+    int busy; // set from commit until the compositor releases the buffer
+    size_t offset; // the offset of the pixels in the shared memory pool
+    int width; // the size of the buffer, it is created again when the window size changes
+    int height;
+    int scroll_valid; // set when the buffer holds a scroll mode frame that can be shifted
+    long scroll_last_column; // the pixel column of the newest point of that frame
+    unsigned long scroll_y_generation; // the sticky y range that frame was drawn with
+} shm_buffer_t;
+
+// A struct to describe a damaged rectangle of the surface
+typedef struct {
+    int x;
+    int y;
+    int width;
+    int height;
+} damage_rect_t;
+
+// Global variables to store the sticky y range of scroll mode, it only grows so shifted pixels stay valid
+int scroll_y_valid = 0;
+double scroll_min_y = 0.0;
+double scroll_max_y = 1.0;
+unsigned long scroll_y_generation = 0;
+
+// A global variable to store the wayland buffers, drawn into in turn so a held buffer is never redrawn
+shm_buffer_t shm_buffers[SHM_BUFFER_COUNT];
 
-// Shared memory file descriptor and data
+// A global variable to store the shared memory pool the buffers are carved from, kept for the whole run
+struct wl_shm_pool *shm_pool = NULL;
+
+// Shared memory file descriptor, data and size, mapped once for all buffers and mapped again when the pool grows
 int shm_fd = -1;
 void *shm_data = NULL;
+size_t shm_size = 0;
+
+// Global variables to store where the current buffer slots start in the pool and the size of each slot
+size_t shm_slot_offset = 0;
+size_t shm_slot_size = 0;
+
+// A global flag set when the graph has to be drawn again (new data, input or the first frame)
+int redraw_needed = 1;
+
+// A global flag set from a commit until the compositor asks for the next frame with the frame callback
+int frame_pending = 0;
 
 // Function to print usage information
 void print_usage(const char *program_name) {
     printf("Usage: %s [OPTIONS]\n", program_name);
     printf("\nOptions:\n");
     printf("  -p, --port PORT          Serial port device (default: %s)\n", DEFAULT_SERIAL_PORT);
-    printf("  -b, --baud BAUD          Baud rate: 9600, 19200, 38400, 57600, 115200 (default: 9600)\n");
+    printf("  -b, --baud BAUD          Baud rate, any rate the driver supports, e.g. 115200 or 3000000 (default: %d)\n",
+           DEFAULT_SERIAL_BAUD);
+    printf("  -P, --protocol NAME      Serial input format: csv, cobs, slip (default: csv)\n");
     printf("  -s, --buffer-size SIZE   Maximum CSV buffer size (default: %d)\n", DEFAULT_CSV_BUFFER_SIZE);
     printf("  -W, --width WIDTH        Graph width in pixels (default: %d)\n", DEFAULT_GRAPH_WIDTH);
     printf("  -H, --height HEIGHT      Graph height in pixels (default: %d)\n", DEFAULT_GRAPH_HEIGHT);
     printf("  -m, --margin MARGIN      Graph margin in pixels (default: %d)\n", DEFAULT_GRAPH_MARGIN);
+    printf("  -d, --decimation MODE    Trace decimation: m4, lttb, none (default: m4)\n");
+    printf("  -x, --scroll SPAN        Scrolling strip chart of the last SPAN x units (default: off)\n");
+    printf("  -r, --renderer NAME      Trace renderer: cairo, native (default: cairo)\n");
+    printf("  -j, --threads COUNT      Threads rendering the traces with the native renderer (default: 1)\n");
+    printf("  -n, --headless           Draw into memory without a wayland display\n");
+    printf("  -o, --dump PATH          Write headless frames to PATH (.png, or raw ARGB8888 otherwise),\n");
+    printf("                           a %%d in PATH is replaced by the dump number\n");
+    printf("  -i, --dump-interval MS   Write a headless frame every MS milliseconds (default: on exit only)\n");
+    printf("  -f, --frames COUNT       Draw COUNT headless frames as fast as possible, then exit\n");
+    printf("  -O, --overlay            Show the statistics overlay (toggle at run time with SIGUSR1)\n");
+    printf("  -S, --stats PATH         Append the statistics to a file, or serve them on unix:SOCKET\n");
+    printf("  -I, --stats-interval MS  Time between statistics lines (default: %d)\n", DEFAULT_STATS_INTERVAL);
+    printf("  -L, --stats-format NAME  Statistics format: json, line (default: json)\n");
+    printf("  -T, --trace PATH         Record spans of the hot paths and write them on exit as a Chrome trace\n");
     printf("  -h, --help               Display this help message\n");
     printf("\nDescription:\n");
-    printf("  Reads CSV data (x,y pairs) from a serial port and displays a real-time graph.\n");
+    printf("  Reads CSV data (x,y1[,y2,...] lines, up to %d channels) from a serial port and\n", CSV_MAX_CHANNELS);
+    printf("  displays a real-time graph with one trace per channel.\n");
     printf("  When buffer size is reached, oldest data points are removed (rolling buffer).\n");
     printf("\nExamples:\n");
     printf("  %s -p /dev/ttyUSB0 -b 115200 -s 500\n", program_name);
     printf("  %s --port /dev/ttyACM0 --buffer-size 2000 --width 1024 --height 768\n", program_name);
 }
 
-// Function to parse baud rate string to speed_t
-speed_t parse_baud_rate(const char *baud_str) {
-    int baud = atoi(baud_str);
-    switch (baud) {
-        case 9600: return B9600;
-        case 19200: return B19200;
-        case 38400: return B38400;
-        case 57600: return B57600;
-        case 115200: return B115200;
-        default:
-            fprintf(stderr, "Unsupported baud rate: %s, using default 9600\n", baud_str);
-            return B9600;
+// A struct to map a baud rate to its termios constant
+typedef struct {
+    int rate;
+    speed_t constant;
+} baud_rate_t;
+
+// The baud rates that have a termios constant, other rates are set with termios2
+const baud_rate_t baud_rates[] = {
+    { 50, B50 }, { 75, B75 }, { 110, B110 }, { 134, B134 }, { 150, B150 }, { 200, B200 }, { 300, B300 },
+    { 600, B600 }, { 1200, B1200 }, { 1800, B1800 }, { 2400, B2400 }, { 4800, B4800 }, { 9600, B9600 },
+    { 19200, B19200 }, { 38400, B38400 }, { 57600, B57600 }, { 115200, B115200 }, { 230400, B230400 },
+#ifdef B4000000
+    { 460800, B460800 }, { 500000, B500000 }, { 576000, B576000 }, { 921600, B921600 }, { 1000000, B1000000 },
+    { 1152000, B1152000 }, { 1500000, B1500000 }, { 2000000, B2000000 }, { 2500000, B2500000 },
+    { 3000000, B3000000 }, { 3500000, B3500000 }, { 4000000, B4000000 },
+#endif
+};
+
+// A function to get the termios constant of a baud rate, B0 when it has none
+speed_t baud_rate_constant(int rate) {
+    for (size_t i = 0; i < sizeof(baud_rates) / sizeof(baud_rates[0]); i++) {
+        if (baud_rates[i].rate == rate) {
+            return baud_rates[i].constant;
+        }
+    }
+    return B0;
+}
+
+// Function to parse baud rate string to a rate in bits per second
+// Returns -1 when it is not a positive number
+int parse_baud_rate(const char *baud_str) {
+    char *end;
+    long baud = strtol(baud_str, &end, 10);
+    if (end == baud_str || *end != '\0' || baud <= 0 || baud > 100000000) {
+        return -1;
+    }
+    return (int)baud;
+}
+
+// A function to check that a dump path is safe to use as a printf format with one int argument
+// Returns 1 when it only contains %% and at most one %d with flags or a width
+int dump_path_valid(const char *path) {
+    int conversions = 0;
+    for (const char *c = path; *c != '\0'; c++) {
+        if (*c != '%') {
+            continue;
+        }
+        c++;
+        if (*c == '%') {
+            continue;
+        }
+        while (*c == '0' || *c == '-' || *c == ' ' || *c == '+' || (*c >= '1' && *c <= '9')) {
+            c++;
+        }
+        if (*c != 'd' || ++conversions > 1) {
+            return 0;
+        }
     }
+    return 1;
 }
 
 // Function to parse command line arguments
@@ -130,10 +1091,24 @@ int parse_arguments(int argc, char *argv[]) {
     static struct option long_options[] = {
         {"port", required_argument, 0, 'p'},
         {"baud", required_argument, 0, 'b'},
+        {"protocol", required_argument, 0, 'P'},
         {"buffer-size", required_argument, 0, 's'},
         {"width", required_argument, 0, 'W'},
         {"height", required_argument, 0, 'H'},
         {"margin", required_argument, 0, 'm'},
+        {"decimation", required_argument, 0, 'd'},
+        {"scroll", required_argument, 0, 'x'},
+        {"renderer", required_argument, 0, 'r'},
+        {"threads", required_argument, 0, 'j'},
+        {"headless", no_argument, 0, 'n'},
+        {"dump", required_argument, 0, 'o'},
+        {"dump-interval", required_argument, 0, 'i'},
+        {"frames", required_argument, 0, 'f'},
+        {"overlay", no_argument, 0, 'O'},
+        {"stats", required_argument, 0, 'S'},
+        {"stats-interval", required_argument, 0, 'I'},
+        {"stats-format", required_argument, 0, 'L'},
+        {"trace", required_argument, 0, 'T'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
@@ -141,13 +1116,29 @@ int parse_arguments(int argc, char *argv[]) {
     int opt;
     int option_index = 0;
 
-    while ((opt = getopt_long(argc, argv, "p:b:s:W:H:m:h", long_options, &option_index)) != -1) {
+    while ((opt = getopt_long(argc, argv, "p:b:P:s:W:H:m:d:x:r:j:no:i:f:OS:I:L:T:h", long_options, &option_index)) != -1) {
         switch (opt) {
             case 'p':
                 config.serial_port = strdup(optarg);
                 break;
             case 'b':
                 config.baud_rate = parse_baud_rate(optarg);
+                if (config.baud_rate == -1) {
+                    fprintf(stderr, "Baud rate must be a positive number of bits per second\n");
+                    return -1;
+                }
+                break;
+            case 'P':
+                if (strcmp(optarg, "csv") == 0) {
+                    config.input_protocol = INPUT_CSV;
+                } else if (strcmp(optarg, "cobs") == 0) {
+                    config.input_protocol = INPUT_COBS;
+                } else if (strcmp(optarg, "slip") == 0) {
+                    config.input_protocol = INPUT_SLIP;
+                } else {
+                    fprintf(stderr, "Protocol must be csv, cobs or slip\n");
+                    return -1;
+                }
                 break;
             case 's':
                 config.csv_buffer_size = atoi(optarg);
@@ -155,10 +1146,6 @@ int parse_arguments(int argc, char *argv[]) {
                     fprintf(stderr, "Buffer size too small, minimum is 10\n");
                     return -1;
                 }
-                if (config.csv_buffer_size > 100000) {
-                    fprintf(stderr, "Buffer size too large, maximum is 100000\n");
-                    return -1;
-                }
                 break;
             case 'W':
                 config.graph_width = atoi(optarg);
@@ -181,6 +1168,99 @@ int parse_arguments(int argc, char *argv[]) {
                     return -1;
                 }
                 break;
+            case 'd':
+                if (strcmp(optarg, "m4") == 0) {
+                    config.decimation = PLOT_DECIMATION_M4;
+                } else if (strcmp(optarg, "lttb") == 0) {
+                    config.decimation = PLOT_DECIMATION_LTTB;
+                } else if (strcmp(optarg, "none") == 0) {
+                    config.decimation = PLOT_DECIMATION_NONE;
+                } else {
+                    fprintf(stderr, "Decimation must be m4, lttb or none\n");
+                    return -1;
+                }
+                break;
+            case 'x':
+                config.scroll_span = atof(optarg);
+                if (config.scroll_span <= 0.0) {
+                    fprintf(stderr, "Scroll span must be greater than 0\n");
+                    return -1;
+                }
+                break;
+            case 'r':
+                if (strcmp(optarg, "cairo") == 0) {
+                    config.renderer = RENDERER_CAIRO;
+                } else if (strcmp(optarg, "native") == 0) {
+                    config.renderer = RENDERER_NATIVE;
+                } else {
+                    fprintf(stderr, "Renderer must be cairo or native\n");
+                    return -1;
+                }
+                break;
+            case 'j':
+                config.render_threads = atoi(optarg);
+                if (config.render_threads < 1 || config.render_threads > RENDER_MAX_THREADS) {
+                    fprintf(stderr, "Threads must be between 1 and %d\n", RENDER_MAX_THREADS);
+                    return -1;
+                }
+                break;
+            case 'n':
+                config.headless = 1;
+                break;
+            case 'o':
+                if (!dump_path_valid(optarg)) {
+                    fprintf(stderr, "Dump path may only contain one %%d (or %%05d ...) conversion\n");
+                    return -1;
+                }
+                config.dump_path = strdup(optarg);
+                break;
+            case 'i':
+                config.dump_interval = atoi(optarg);
+                if (config.dump_interval <= 0) {
+                    fprintf(stderr, "Dump interval must be greater than 0\n");
+                    return -1;
+                }
+                break;
+            case 'f':
+                config.frame_limit = atol(optarg);
+                if (config.frame_limit <= 0) {
+                    fprintf(stderr, "Frames must be greater than 0\n");
+                    return -1;
+                }
+                break;
+            case 'O':
+                stats_overlay = 1;
+                break;
+            case 'S':
+                free(config.stats_path);
+                config.stats_path = strdup(optarg);
+                break;
+            case 'I':
+                config.stats_interval = atoi(optarg);
+                if (config.stats_interval <= 0) {
+                    fprintf(stderr, "Statistics interval must be greater than 0\n");
+                    return -1;
+                }
+                break;
+            case 'L':
+                if (strcmp(optarg, "json") == 0) {
+                    config.stats_line_protocol = 0;
+                } else if (strcmp(optarg, "line") == 0) {
+                    config.stats_line_protocol = 1;
+                } else {
+                    fprintf(stderr, "Statistics format must be json or line\n");
+                    return -1;
+                }
+                break;
+            case 'T':
+#ifndef NO_TRACE
+                free(config.trace_path);
+                config.trace_path = strdup(optarg);
+                trace_enabled = 1;
+#else
+                fprintf(stderr, "Tracing was compiled out (NO_TRACE)\n");
+#endif
+                break;
             case 'h':
                 print_usage(argv[0]);
                 exit(0);
@@ -190,6 +1270,12 @@ int parse_arguments(int argc, char *argv[]) {
         }
     }
 
+    // The dump and frame options only apply to the headless backend
+    if (!config.headless && (config.dump_path != NULL || config.dump_interval > 0 || config.frame_limit > 0)) {
+        fprintf(stderr, "--dump, --dump-interval and --frames need --headless\n");
+        return -1;
+    }
+
     // Set default serial port if not specified
     if (config.serial_port == NULL) {
         config.serial_port = strdup(DEFAULT_SERIAL_PORT);
@@ -225,7 +1311,102 @@ int create_shm_file(size_t size) {
     return fd;
 }
 
-// A function to initialize the serial port
+// A struct to store bytes read from the serial port until they form complete lines
+typedef struct {
+    char *data; // the received bytes, size + 1 bytes (+1 so a line can always be null terminated)
+    size_t size; // the number of bytes the buffer holds
+    size_t head; // the index of the first byte not yet handed out as a line
+    size_t tail; // the index one past the last byte received
+    size_t scanned; // the number of bytes after head already searched for a line break
+    int discarding; // set while skipping the rest of an overlong line
+} serial_reader_t;
+
+// A global variable to store the buffered reader of the serial port, used by the serial thread
+serial_reader_t serial_reader;
+
+// A function to allocate the buffer of a reader
+int serial_reader_init(serial_reader_t *reader, size_t size) {
+    memset(reader, 0, sizeof(*reader));
+    reader->data = malloc(size + 1);
+    if (reader->data == NULL) {
+        perror("malloc");
+        return -1;
+    }
+    reader->size = size;
+    return 0;
+}
+
+// A function to set a baud rate that has no termios constant, with termios2 and BOTHER
+// The driver picks the closest rate it can generate, which is printed when it differs
+int serial_set_custom_rate(int fd, int rate) {
+#ifdef TCGETS2
+    struct termios2 options;
+    if (ioctl(fd, TCGETS2, &options) == -1) {
+        perror("ioctl TCGETS2");
+        return -1;
+    }
+
+    // Replace the output rate constant by BOTHER, and clear the input rate so it follows the output rate
+    options.c_cflag &= ~CBAUD;
+    options.c_cflag |= BOTHER;
+#ifdef CIBAUD
+    options.c_cflag &= ~CIBAUD;
+#endif
+    options.c_ispeed = rate;
+    options.c_ospeed = rate;
+    if (ioctl(fd, TCSETS2, &options) == -1) {
+        perror("ioctl TCSETS2");
+        return -1;
+    }
+
+    // Read back the rate the driver actually set
+    if (ioctl(fd, TCGETS2, &options) == 0 && options.c_ospeed != (speed_t)rate) {
+        printf("Serial port runs at %u baud, the closest rate to %d the driver supports\n",
+               (unsigned int)options.c_ospeed, rate);
+    }
+    return 0;
+#else
+    fprintf(stderr, "Baud rate %d needs termios2, which this system does not have\n", rate);
+    return -1;
+#endif
+}
+
+// A function to ask the driver to hand received bytes to the tty layer without delay
+// USB serial drivers shorten their latency timer (16 ms by default on FTDI) and UART drivers skip the
+// deferred work queue. Returns -1 when the driver does not support it (USB-CDC, ptys)
+int serial_set_low_latency(int fd) {
+    struct serial_struct serial;
+    if (ioctl(fd, TIOCGSERIAL, &serial) == -1) {
+        return -1;
+    }
+    serial.flags |= ASYNC_LOW_LATENCY;
+    return ioctl(fd, TIOCSSERIAL, &serial);
+}
+
+// A global variable to store the serial port error counters when the port was opened
+struct serial_icounter_struct serial_icount_start;
+
+// A global flag set when the driver reports error counters with TIOCGICOUNT
+int serial_icount_supported = 0;
+
+// A function to read the error counters of the serial port into the statistics, called by the serial thread
+// The kernel counts since the driver was loaded, so the counts at open are subtracted
+void serial_icount_update() {
+    struct serial_icounter_struct count;
+    if (!serial_icount_supported || ioctl(serial_fd, TIOCGICOUNT, &count) == -1) {
+        return;
+    }
+    atomic_store_explicit(&serial_stats.overruns, (unsigned long)(count.overrun - serial_icount_start.overrun),
+                          memory_order_relaxed);
+    atomic_store_explicit(&serial_stats.buffer_overruns,
+                          (unsigned long)(count.buf_overrun - serial_icount_start.buf_overrun), memory_order_relaxed);
+    atomic_store_explicit(&serial_stats.frame_errors, (unsigned long)(count.frame - serial_icount_start.frame),
+                          memory_order_relaxed);
+    atomic_store_explicit(&serial_stats.parity_errors, (unsigned long)(count.parity - serial_icount_start.parity),
+                          memory_order_relaxed);
+}
+
+// A function to initialize the serial port
 int serial_init() {
     // Open the serial port in read/write mode, non-blocking mode and no controlling terminal mode
     serial_fd = open(config.serial_port, O_RDWR | O_NOCTTY | O_NONBLOCK);
@@ -241,12 +1422,13 @@ int serial_init() {
         return -1;
     }
 
-    // Set the input and output baud rate
-    if (cfsetispeed(&options, config.baud_rate) == -1) {
+    // Set the input and output baud rate, rates without a constant are set with termios2 below
+    speed_t speed = baud_rate_constant(config.baud_rate);
+    if (cfsetispeed(&options, (speed != B0) ? speed : B38400) == -1) {
         perror("cfsetispeed");
         return -1;
     }
-    if (cfsetospeed(&options, config.baud_rate) == -1) {
+    if (cfsetospeed(&options, (speed != B0) ? speed : B38400) == -1) {
         perror("cfsetospeed");
         return -1;
     }
@@ -257,6 +1439,11 @@ int serial_init() {
     options.c_cflag &= ~PARENB;
     options.c_cflag &= ~CSTOPB;
     options.c_cflag &= ~CRTSCTS;
+    options.c_cflag |= CREAD | CLOCAL;
+
+    // Pass every received byte as it is: no break or parity marking, no stripping of the 8th bit,
+    // no carriage return translation and no software flow control (binary packets use every byte value)
+    options.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON | IXOFF | IXANY);
 
     // Set the raw input mode, no echo, no signal characters and no extended functions
     options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG | IEXTEN);
@@ -264,268 +1451,2772 @@ int serial_init() {
     // Set the raw output mode, no processing of output characters
     options.c_oflag &= ~OPOST;
 
-    // Set the minimum number of characters for non-canonical read and timeout value
-    options.c_cc[VMIN] = 0;
-    options.c_cc[VTIME] = 10;
+    // The port is only read after select reports data and it is non-blocking, so a read returns what is
+    // buffered at once; no minimum count or inter-byte timer may hold bytes back
+    options.c_cc[VMIN] = 1;
+    options.c_cc[VTIME] = 0;
 
     // Apply the new attributes of the serial port
     if (tcsetattr(serial_fd, TCSANOW, &options) == -1) {
         perror("tcsetattr");
         return -1;
     }
+    if (speed == B0 && serial_set_custom_rate(serial_fd, config.baud_rate) == -1) {
+        return -1;
+    }
+
+    // Deliver bytes to the tty layer as soon as they arrive where the driver supports it
+    if (serial_set_low_latency(serial_fd) == 0) {
+        printf("Serial port low latency mode on\n");
+    } else {
+        printf("Serial port low latency mode not supported by the driver\n");
+    }
+
+    // Read enough per call to drain SERIAL_READ_WINDOW_MS of data at the baud rate (10 bits per byte),
+    // so the serial thread empties the kernel's fixed size tty buffers long before they fill up
+    size_t read_size = SERIAL_READ_BUFFER_SIZE;
+    size_t window = (size_t)config.baud_rate / 10 * SERIAL_READ_WINDOW_MS / 1000;
+    while (read_size < window && read_size < SERIAL_READ_BUFFER_MAX_SIZE) {
+        read_size *= 2;
+    }
+    if (serial_reader_init(&serial_reader, read_size) == -1) {
+        return -1;
+    }
+
+    // Take the error counters at open as the starting point, not every driver keeps them
+    if (ioctl(serial_fd, TIOCGICOUNT, &serial_icount_start) == 0) {
+        serial_icount_supported = 1;
+    }
 
     return 0;
 }
 
-// A function to read a line from the serial port
-int serial_read_line(char *buffer, int size) {
-    int index = 0; // the current index of the buffer
-    char c; // the current character read from the serial port
+// A function to find the first occurrence of either of two characters in a block of memory
+const char *find_either_char(const char *data, size_t size, char a, char b) {
+    size_t i = 0;
 
-    // Loop until the buffer is full or a newline character is read
-    while (index < size - 1) {
-        // Read one character from the serial port
-        if (read(serial_fd, &c, 1) == 1) {
-            // If the character is a newline or carriage return, break the loop
-            if (c == '\n' || c == '\r') {
-                break;
+#ifdef __SSE2__
+    // Compare 16 bytes at a time and stop at the first block containing a match
+    const __m128i va = _mm_set1_epi8(a);
+    const __m128i vb = _mm_set1_epi8(b);
+    for (; i + 16 <= size; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(data + i));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(block, va), _mm_cmpeq_epi8(block, vb)));
+        if (mask != 0) {
+            return data + i + __builtin_ctz(mask);
+        }
+    }
+#endif
+
+    // Check the remaining bytes one by one
+    for (; i < size; i++) {
+        if (data[i] == a || data[i] == b) {
+            return data + i;
+        }
+    }
+
+    return NULL;
+}
+
+// A function to read whatever the serial port has buffered into the reader in a single call
+// Returns the number of bytes read (0 when the port is drained), -2 at end of file or -1 on error
+ssize_t serial_reader_fill(serial_reader_t *reader, int fd) {
+    // Move the partial line left over from the previous read to the front of the buffer
+    if (reader->head > 0) {
+        size_t pending = reader->tail - reader->head;
+        memmove(reader->data, reader->data + reader->head, pending);
+        reader->head = 0;
+        reader->tail = pending;
+    }
+
+    // Read as many bytes as fit in the remaining space
+    ssize_t count = read(fd, reader->data + reader->tail, reader->size - reader->tail);
+    if (count > 0) {
+        reader->tail += count;
+    } else if (count == 0) {
+        // Nothing to read although select reported the port readable, the other end was closed
+        count = -2;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+        // The port is drained, the caller should go back to select
+        count = 0;
+    }
+
+    return count;
+}
+
+// A function to get the next complete line from the reader without copying it
+// Returns a null terminated pointer into the reader buffer (valid until the next fill) or NULL
+char *serial_reader_next_line(serial_reader_t *reader, size_t *length) {
+    while (1) {
+        char *line = reader->data + reader->head;
+        size_t pending = reader->tail - reader->head;
+
+        // Search only the bytes that were not searched by a previous call
+        const char *end = find_either_char(line + reader->scanned, pending - reader->scanned, '\n', '\r');
+        if (end == NULL) {
+            reader->scanned = pending;
+
+            // A line that does not fit the line size limit is dropped up to its line break
+            if (pending >= SERIAL_BUFFER_SIZE) {
+                if (!reader->discarding) {
+                    fprintf(stderr, "Discarding serial line longer than %d characters\n", SERIAL_BUFFER_SIZE - 1);
+                    stats_add(&serial_stats.lines_discarded, 1);
+                }
+                reader->discarding = 1;
+                reader->head = reader->tail;
+                reader->scanned = 0;
             }
-            // Otherwise, store the character in the buffer and increment the index
-            buffer[index] = c;
-            index++;
+            return NULL;
+        }
+
+        // Terminate the line in place and advance past the line break
+        size_t size = end - line;
+        line[size] = '\0';
+        reader->head += size + 1;
+        reader->scanned = 0;
+
+        // Skip the tail of a line that was discarded because it was too long
+        if (reader->discarding) {
+            reader->discarding = 0;
+            continue;
+        }
+        if (size >= SERIAL_BUFFER_SIZE) {
+            fprintf(stderr, "Discarding serial line longer than %d characters\n", SERIAL_BUFFER_SIZE - 1);
+            stats_add(&serial_stats.lines_discarded, 1);
+            continue;
         }
+
+        *length = size;
+        return line;
     }
+}
+
+// A function to get the next complete frame of a binary packet (the bytes before a delimiter) without copying it
+// Returns a pointer into the reader buffer (valid until the next fill) or NULL, the frame may be empty
+char *serial_reader_next_frame(serial_reader_t *reader, char delimiter, size_t *length) {
+    while (1) {
+        char *frame = reader->data + reader->head;
+        size_t pending = reader->tail - reader->head;
 
-    // Terminate the buffer with a null character
-    buffer[index] = '\0';
+        // Search only the bytes that were not searched by a previous call
+        const char *end = find_either_char(frame + reader->scanned, pending - reader->scanned, delimiter, delimiter);
+        if (end == NULL) {
+            reader->scanned = pending;
+
+            // A frame that does not fit the frame size limit is dropped up to its delimiter
+            if (pending >= PACKET_FRAME_MAX_SIZE) {
+                if (!reader->discarding) {
+                    fprintf(stderr, "Failed to decode packet: frame longer than %d bytes\n", PACKET_FRAME_MAX_SIZE - 1);
+                    stats_add(&serial_stats.packet_errors, 1);
+                }
+                reader->discarding = 1;
+                reader->head = reader->tail;
+                reader->scanned = 0;
+            }
+            return NULL;
+        }
+
+        // Advance past the delimiter
+        size_t size = end - frame;
+        reader->head += size + 1;
+        reader->scanned = 0;
+
+        // Skip the tail of a frame that was discarded because it was too long
+        if (reader->discarding) {
+            reader->discarding = 0;
+            continue;
+        }
+        if (size >= PACKET_FRAME_MAX_SIZE) {
+            fprintf(stderr, "Failed to decode packet: frame longer than %d bytes\n", PACKET_FRAME_MAX_SIZE - 1);
+            stats_add(&serial_stats.packet_errors, 1);
+            continue;
+        }
 
-    // Return the number of characters read
-    return index;
+        *length = size;
+        return frame;
+    }
 }
 
-// A function to parse a csv line and store the data in the global array (with rolling buffer)
-int csv_parse_line(char *line) {
-    // Skip empty lines
-    if (strlen(line) == 0) {
-        return 0;
+// Powers of ten that are exactly representable as doubles, used by the fast float parser
+const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// A function to find the positions of the commas in a csv line (16 bytes at a time with SSE2)
+// Returns the number of commas found, at most max_commas
+int csv_find_delimiters(const char *line, size_t length, size_t *commas, int max_commas) {
+    int count = 0;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // Build a bit mask of the commas in each block and walk its set bits
+    const __m128i comma = _mm_set1_epi8(',');
+    for (; i + 16 <= length; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(line + i));
+        unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, comma));
+        while (mask != 0) {
+            if (count == max_commas) {
+                return count;
+            }
+            commas[count++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+#endif
+
+    // Check the remaining bytes one by one
+    for (; i < length; i++) {
+        if (line[i] == ',') {
+            if (count == max_commas) {
+                return count;
+            }
+            commas[count++] = i;
+        }
     }
 
-    // Allocate memory for a new csv data struct
-    csv_data_t data;
+    return count;
+}
 
-    // Scan the line for two double values separated by a comma
-    if (sscanf(line, "%lf,%lf", &data.x, &data.y) != 2) {
-        fprintf(stderr, "Invalid csv format: %s\n", line);
+// A function to parse a double from the characters between start and end, without locale or allocation
+// Plain integers and decimals are converted exactly in a fast path, anything else is handed to strtod,
+// so the result is always bit-identical to strtod. Returns 0 on success or -1 if the field is not a number.
+int parse_double(const char *start, const char *end, double *value) {
+    // Trim surrounding spaces and tabs
+    while (start < end && (*start == ' ' || *start == '\t')) {
+        start++;
+    }
+    while (end > start && (end[-1] == ' ' || end[-1] == '\t')) {
+        end--;
+    }
+    if (start == end) {
         return -1;
     }
 
-    // Lock the mutex before modifying csv_data
-    pthread_mutex_lock(&csv_data_mutex);
+    const char *p = start;
+    int negative = 0;
+    if (*p == '+' || *p == '-') {
+        negative = (*p == '-');
+        p++;
+    }
 
-    // Check if buffer is full - implement rolling buffer
-    if (csv_data_size >= csv_buffer_max_size) {
-        // Remove the oldest entry by shifting all data left
-        memmove(&csv_data[0], &csv_data[1], sizeof(csv_data_t) * (csv_data_size - 1));
-        // Add new data at the end
-        csv_data[csv_data_size - 1] = data;
-        // Size remains the same
-        
-        // Optional: Print rolling buffer notification (only occasionally to avoid spam)
-        static int roll_count = 0;
-        if (++roll_count % 100 == 0) {
-            printf("Rolling buffer: removed oldest entries (total: %d, buffer full)\n", roll_count);
+    // Accumulate the significant digits of the integer and fraction parts
+    uint64_t mantissa = 0;
+    int digits = 0; // the number of significant digits in the mantissa
+    int exponent = 0; // the decimal exponent applied to the mantissa
+    int seen_digit = 0;
+    for (; p < end && (unsigned)(*p - '0') < 10; p++) {
+        if (mantissa != 0 || *p != '0') {
+            digits++;
         }
-    } else {
-        // Buffer not full yet - reallocate and add new data
-        csv_data_t *new_data = realloc(csv_data, sizeof(csv_data_t) * (csv_data_size + 1));
-        if (new_data == NULL) {
-            perror("realloc");
-            pthread_mutex_unlock(&csv_data_mutex);
+        mantissa = mantissa * 10 + (*p - '0');
+        seen_digit = 1;
+    }
+    if (p < end && *p == '.') {
+        p++;
+        for (; p < end && (unsigned)(*p - '0') < 10; p++) {
+            if (mantissa != 0 || *p != '0') {
+                digits++;
+            }
+            mantissa = mantissa * 10 + (*p - '0');
+            exponent--;
+            seen_digit = 1;
+        }
+    }
+
+    // Let strtod handle inf, nan, hex floats and mantissas that may not fit 64 bits
+    if (!seen_digit || digits > 19) {
+        goto fallback;
+    }
+
+    // Parse an optional exponent
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        int exponent_negative = 0;
+        if (p < end && (*p == '+' || *p == '-')) {
+            exponent_negative = (*p == '-');
+            p++;
+        }
+        if (p == end || (unsigned)(*p - '0') >= 10) {
             return -1;
         }
-        csv_data = new_data;
+        int explicit_exponent = 0;
+        for (; p < end && (unsigned)(*p - '0') < 10; p++) {
+            if (explicit_exponent < 100000) {
+                explicit_exponent = explicit_exponent * 10 + (*p - '0');
+            }
+        }
+        exponent += exponent_negative ? -explicit_exponent : explicit_exponent;
+    }
 
-        // Store the new data in the global array and increment the size
-        csv_data[csv_data_size] = data;
-        csv_data_size++;
+    // Anything left over is either garbage or a form only strtod understands
+    if (p != end) {
+        goto fallback;
+    }
+
+    if (mantissa == 0) {
+        *value = negative ? -0.0 : 0.0;
+        return 0;
+    }
+
+    // Both the mantissa and the power of ten are exact doubles, so a single
+    // correctly rounded multiply or divide gives the same result as strtod
+    if (mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        double result = (double)mantissa;
+        if (exponent < 0) {
+            result /= exact_powers_of_ten[-exponent];
+        } else {
+            result *= exact_powers_of_ten[exponent];
+        }
+        *value = negative ? -result : result;
+        return 0;
     }
 
-    // Unlock the mutex
-    pthread_mutex_unlock(&csv_data_mutex);
+fallback:;
+    // Copy the field so strtod cannot read past its end
+    char field[128];
+    size_t size = end - start;
+    if (size >= sizeof(field)) {
+        return -1;
+    }
+    memcpy(field, start, size);
+    field[size] = '\0';
 
+    char *stop;
+    double result = strtod(field, &stop);
+    if (stop != field + size) {
+        return -1;
+    }
+    *value = result;
     return 0;
 }
 
-// A function to read and parse csv data from the serial port in a separate thread
-void *serial_thread(void *arg) {
-    // Create a buffer to store the serial line
-    char buffer[SERIAL_BUFFER_SIZE];
+// A function to split a csv line into fields and parse each field as a double
+// Returns the number of values stored, or -1 if a field is not a number or the line has more than max_values fields
+int csv_parse_values(const char *line, size_t length, double *values, int max_values) {
+    size_t commas[CSV_MAX_FIELDS];
 
-    // Create a file descriptor set for the select function
-    fd_set fds;
+    // Look for one comma more than max_values fields need, finding it means the line has too many fields
+    int comma_count = csv_find_delimiters(line, length, commas, max_values);
+    if (comma_count == max_values) {
+        return -1;
+    }
+    int count = comma_count + 1;
 
-    // Create a timeval struct for the select timeout
-    struct timeval tv;
+    // Parse the fields between consecutive commas
+    size_t field_start = 0;
+    for (int i = 0; i < count; i++) {
+        size_t field_end = (i < comma_count) ? commas[i] : length;
+        if (parse_double(line + field_start, line + field_end, &values[i]) == -1) {
+            return -1;
+        }
+        field_start = field_end + 1;
+    }
 
-    // Loop until the thread is canceled
-    while (1) {
-        // Clear the file descriptor set
-        FD_ZERO(&fds);
+    return count;
+}
 
-        // Add the serial port file descriptor to the set
-        FD_SET(serial_fd, &fds);
+// A struct to store one parsed csv line on its way from the serial thread to the csv data
+typedef struct {
+    double values[CSV_MAX_CHANNELS + 1]; // the x value followed by one value per channel
+    uint64_t read_ns; // the monotonic time the bytes of the line were read, 0 when unknown
+    int channels; // the number of channel values after the x value
+} csv_sample_t;
 
-        // Set the timeout to 1 second
-        tv.tv_sec = 1;
-        tv.tv_usec = 0;
+// A struct for the lock-free single-producer/single-consumer queue between the serial thread and the csv data
+// Head and tail count samples since the start and only ever grow, the slot of sample n is n % SAMPLE_QUEUE_SIZE
+typedef struct {
+    csv_sample_t samples[SAMPLE_QUEUE_SIZE]; // the queued samples
+    _Alignas(64) atomic_size_t head; // the number of samples consumed (stored by the consumer only)
+    _Alignas(64) atomic_size_t tail; // the number of samples published (stored by the producer only)
+    _Alignas(64) size_t written; // the number of samples written by the producer, published in batches
+    size_t head_cache; // the value of head last seen by the producer
+} sample_queue_t;
 
-        // Call the select function to check if the serial port is ready for reading
-        int ret = select(serial_fd + 1, &fds, NULL, NULL, &tv);
-        if (ret == -1) {
-            perror("select");
-            break;
-        }
-        else if (ret == 0) {
-            // Timeout, no data available
-            continue;
-        }
-        else {
-            // Data available, read a line from the serial port
-            if (serial_read_line(buffer, SERIAL_BUFFER_SIZE) > 0) {
-                // Parse the line and store the data in the global array
-                if (csv_parse_line(buffer) == -1) {
-                    fprintf(stderr, "Failed to parse csv line: %s\n", buffer);
-                }
-            }
+// A global variable to store the queue of parsed samples
+sample_queue_t sample_queue;
+
+// A global variable to store the monotonic time of the last read of the serial port (producer side)
+uint64_t serial_read_ns = 0;
+
+// A global variable to store the number of channels set by the first valid line or packet (producer side)
+// The consumer never reads it, each sample carries its channel count through the queue instead
+int serial_channels = 0;
+
+// A global variable to store the eventfd the serial thread signals to wake the main loop when it publishes samples
+int data_event_fd = -1;
+
+// A global flag set when data_event_fd has been signaled and not yet read, so the serial thread writes
+// to it at most once per wakeup of the main loop
+atomic_int data_event_signaled = 0;
+
+// A function to get the next free slot of a sample queue (producer side)
+// Returns NULL when the queue is full
+csv_sample_t *sample_queue_reserve(sample_queue_t *queue) {
+    // Only reload the consumer position when the cached one says the queue is full
+    if (queue->written - queue->head_cache == SAMPLE_QUEUE_SIZE) {
+        queue->head_cache = atomic_load_explicit(&queue->head, memory_order_acquire);
+        if (queue->written - queue->head_cache == SAMPLE_QUEUE_SIZE) {
+            return NULL;
         }
     }
+    return &queue->samples[queue->written & (SAMPLE_QUEUE_SIZE - 1)];
+}
 
-    // Return NULL as the thread exit value
-    return NULL;
+// A function to add the sample written into the reserved slot to the current batch (producer side)
+void sample_queue_commit(sample_queue_t *queue) {
+    queue->written++;
 }
 
-// A function to handle the registry global event
-void registry_global(void *data, struct wl_registry *registry, uint32_t id, const char *interface, uint32_t version) {
-    // If the interface is wl_compositor, bind it to the global variable
-    if (strcmp(interface, "wl_compositor") == 0) {
-        compositor = wl_registry_bind(registry, id, &wl_compositor_interface, 1);
+// A function to make every committed sample visible to the consumer with a single release store (producer side)
+void sample_queue_publish(sample_queue_t *queue) {
+    atomic_store_explicit(&queue->tail, queue->written, memory_order_release);
+}
+
+// A function to count samples dropped because the sample queue was full (producer side)
+// The running count is printed every 1000 drops
+void sample_queue_dropped(unsigned long count) {
+    unsigned long before = atomic_load_explicit(&serial_stats.samples_dropped, memory_order_relaxed);
+    stats_add(&serial_stats.samples_dropped, count);
+    if (before / 1000 != (before + count) / 1000 || before == 0) {
+        fprintf(stderr, "Sample queue full, dropped %lu samples\n", before + count);
     }
-    // If the interface is wl_shell, bind it to the global variable
-    else if (strcmp(interface, "wl_shell") == 0) {
-        shell = wl_registry_bind(registry, id, &wl_shell_interface, 1);
+}
+
+// A function to wake the main loop after samples are published (producer side)
+void data_event_signal() {
+    if (data_event_fd >= 0 && atomic_exchange(&data_event_signaled, 1) == 0) {
+        uint64_t one = 1;
+        if (write(data_event_fd, &one, sizeof(one)) == -1) {
+            perror("write");
+        }
     }
-    // If the interface is wl_shm, bind it to the global variable
-    else if (strcmp(interface, "wl_shm") == 0) {
-        shm = wl_registry_bind(registry, id, &wl_shm_interface, 1);
+}
+
+// A function to wake the main loop from a signal handler, the same as data_event_signal without stdio
+// A failed write only loses a wakeup the main loop also gets from the interrupted poll, so it is ignored
+void data_event_signal_safe() {
+    if (data_event_fd >= 0 && atomic_exchange(&data_event_signaled, 1) == 0) {
+        uint64_t one = 1;
+        ssize_t written = write(data_event_fd, &one, sizeof(one));
+        (void)written;
     }
 }
 
-// A function to handle the registry global remove event
-void registry_global_remove(void *data, struct wl_registry *registry, uint32_t id) {
-    // Do nothing
+// A function to consume the wakeup of the main loop (consumer side)
+// Samples published before a signal that was skipped because the flag was still set are visible
+// once the flag is cleared here, so the drain that follows never misses them
+void data_event_clear() {
+    uint64_t value;
+    if (read(data_event_fd, &value, sizeof(value)) == -1 && errno != EAGAIN) {
+        perror("read");
+    }
+    atomic_exchange(&data_event_signaled, 0);
 }
 
-// A struct to store the registry listener callbacks
-struct wl_registry_listener registry_listener = {
-    .global = registry_global,
-    .global_remove = registry_global_remove,
-};
+// A function to get log2 of the number of points per block of a pyramid level
+int csv_lod_shift(int level) {
+    return CSV_LOD_BASE_SHIFT + level * CSV_LOD_LEVEL_SHIFT;
+}
 
-// A function to handle the shell surface ping event
-void shell_surface_ping(void *data, struct wl_shell_surface *shell_surface, uint32_t serial) {
-    // Send a pong reply to the compositor
-    wl_shell_surface_pong(shell_surface, serial);
+// A function to resize every column of the csv data to hold capacity points
+int csv_data_resize(int capacity) {
+    double *new_x = realloc(csv_data.x, sizeof(double) * capacity);
+    if (new_x == NULL) {
+        return -1;
+    }
+    csv_data.x = new_x;
+
+    for (int c = 0; c < csv_data.channels; c++) {
+        double *new_y = realloc(csv_data.y[c], sizeof(double) * capacity);
+        if (new_y == NULL) {
+            return -1;
+        }
+        csv_data.y[c] = new_y;
+    }
+
+    // Block b of a pyramid level covers the indices from b << shift, the last block may be partial
+    for (int c = 0; c < csv_data.channels; c++) {
+        for (int level = 0; level < CSV_LOD_LEVELS; level++) {
+            size_t blocks = ((size_t)(capacity - 1) >> csv_lod_shift(level)) + 1;
+            double *new_min = realloc(csv_data.lod_min[c][level], sizeof(double) * blocks);
+            if (new_min == NULL) {
+                return -1;
+            }
+            csv_data.lod_min[c][level] = new_min;
+
+            double *new_max = realloc(csv_data.lod_max[c][level], sizeof(double) * blocks);
+            if (new_max == NULL) {
+                return -1;
+            }
+            csv_data.lod_max[c][level] = new_max;
+        }
+    }
+
+    // The deques never hold more entries than there are points. They only lose front entries
+    // once the buffer is full and no longer grows, so their front is still 0 here
+    for (int c = 0; c <= csv_data.channels; c++) {
+        int *new_min = realloc(csv_data_extrema[c].min.indices, sizeof(int) * capacity);
+        if (new_min == NULL) {
+            return -1;
+        }
+        csv_data_extrema[c].min.indices = new_min;
+
+        int *new_max = realloc(csv_data_extrema[c].max.indices, sizeof(int) * capacity);
+        if (new_max == NULL) {
+            return -1;
+        }
+        csv_data_extrema[c].max.indices = new_max;
+    }
+
+    return 0;
 }
 
-// A function to handle the shell surface configure event
-void shell_surface_configure(void *data, struct wl_shell_surface *shell_surface,
-                             uint32_t edges, int32_t width, int32_t height) {
-    // Do nothing
+// A function to store the x value and channel values of one csv line at an index of the columns
+void csv_data_set(int index, const double *values) {
+    csv_data.x[index] = values[0];
+    for (int c = 0; c < csv_data.channels; c++) {
+        csv_data.y[c][index] = values[c + 1];
+    }
 }
 
-// A function to handle the shell surface popup done event
-void shell_surface_popup_done(void *data, struct wl_shell_surface *shell_surface) {
-    // Do nothing
+// A function to free every column of the csv data
+void csv_data_free() {
+    free(csv_data.x);
+    for (int c = 0; c < csv_data.channels; c++) {
+        free(csv_data.y[c]);
+        for (int level = 0; level < CSV_LOD_LEVELS; level++) {
+            free(csv_data.lod_min[c][level]);
+            free(csv_data.lod_max[c][level]);
+        }
+    }
+    for (int c = 0; c <= csv_data.channels; c++) {
+        free(csv_data_extrema[c].min.indices);
+        free(csv_data_extrema[c].max.indices);
+    }
+    memset(&csv_data, 0, sizeof(csv_data));
+    memset(csv_data_extrema, 0, sizeof(csv_data_extrema));
+    csv_data_size = 0;
+    csv_data_capacity = 0;
+    csv_data_head = 0;
+    csv_data_generation = 0;
 }
 
-// A struct to store the shell surface listener callbacks
-struct wl_shell_surface_listener shell_surface_listener = {
-    .ping = shell_surface_ping,
-    .configure = shell_surface_configure,
-    .popup_done = shell_surface_popup_done,
-};
+// A function to add the point at an index to the pyramid block holding it at every level (O(levels) per point)
+// Points are written in index order, also when the oldest point is overwritten, so a block starts over at its
+// first index. Until the last index is written again the block holds old and new points, but it then contains
+// both the newest and the oldest point of the ring, so it spans the wrap around and is never read whole
+void csv_data_add_lod(int index) {
+    for (int level = 0; level < CSV_LOD_LEVELS; level++) {
+        int shift = csv_lod_shift(level);
+        int block = index >> shift;
+        int first = (index & ((1 << shift) - 1)) == 0;
+        for (int c = 0; c < csv_data.channels; c++) {
+            double value = csv_data.y[c][index];
+            if (first || value < csv_data.lod_min[c][level][block]) csv_data.lod_min[c][level][block] = value;
+            if (first || value > csv_data.lod_max[c][level][block]) csv_data.lod_max[c][level][block] = value;
+        }
+    }
+}
 
-// A function to create a wayland buffer with proper shared memory
-struct wl_buffer *create_buffer() {
-    int stride = config.graph_width * 4; // 4 bytes per pixel (ARGB)
-    int size = stride * config.graph_height;
+// A function to get the level of the largest pyramid block that starts at an index and ends before end,
+// up to max_level. Returns -1 when no block fits and the point has to be read on its own
+int csv_lod_block_level(int index, int end, int max_level) {
+    for (int level = max_level; level >= 0; level--) {
+        int size = 1 << csv_lod_shift(level);
+        if ((index & (size - 1)) == 0 && index + size <= end) {
+            return level;
+        }
+    }
+    return -1;
+}
 
-    // Create shared memory file
-    shm_fd = create_shm_file(size);
-    if (shm_fd < 0) {
-        return NULL;
+// A function to get the points of a snapshot in order from oldest to newest as at most two contiguous spans
+// Point n is stored at index n % capacity, the points stay unchanged until the next csv_data_drain
+// Returns the number of spans (0 when empty, 2 when the rolling buffer has wrapped around)
+int csv_data_get_spans(const csv_snapshot_t *snapshot, csv_span_t spans[2]) {
+    if (snapshot->count == 0) {
+        return 0;
     }
 
-    // Map the shared memory
-    shm_data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (shm_data == MAP_FAILED) {
-        perror("mmap");
-        close(shm_fd);
-        return NULL;
+    // The points from the oldest one to the end of the columns come first
+    int head = snapshot->start % csv_data_capacity;
+    int first = csv_data_capacity - head;
+    if (first >= snapshot->count) {
+        spans[0].start = head;
+        spans[0].count = snapshot->count;
+        return 1;
     }
 
-    // Create a wl_shm_pool from the shared memory
-    struct wl_shm_pool *pool = wl_shm_create_pool(shm, shm_fd, size);
+    // The rest wrapped around to the start of the columns
+    spans[0].start = head;
+    spans[0].count = first;
+    spans[1].start = 0;
+    spans[1].count = snapshot->count - first;
+    return 2;
+}
 
-    // Create a wl_buffer from the pool
-    struct wl_buffer *buffer = wl_shm_pool_create_buffer(pool, 0, config.graph_width, config.graph_height, 
-                                                         stride, WL_SHM_FORMAT_ARGB8888);
+// A function to get the column of the csv data tracked by csv_data_extrema[column]
+const double *csv_data_column(int column) {
+    return (column == 0) ? csv_data.x : csv_data.y[column - 1];
+}
+
+// A function to remove the point at an index from the front of a deque if it is there
+void csv_deque_evict(csv_deque_t *deque, int index) {
+    if (deque->count > 0 && deque->indices[deque->front] == index) {
+        deque->front = (deque->front + 1) % csv_data_capacity;
+        deque->count--;
+    }
+}
+
+// A function to add the point at an index to the back of a deque
+// Entries that can no longer become the extreme because the new point is newer and at least as extreme are dropped
+void csv_deque_push(csv_deque_t *deque, const double *values, int index, int is_max) {
+    double value = values[index];
+    while (deque->count > 0) {
+        int back = deque->indices[(deque->front + deque->count - 1) % csv_data_capacity];
+        if (is_max ? values[back] > value : values[back] < value) {
+            break;
+        }
+        deque->count--;
+    }
+    deque->indices[(deque->front + deque->count) % csv_data_capacity] = index;
+    deque->count++;
+}
+
+// A function to remove the point at an index from the extrema of every column before it is overwritten
+void csv_data_evict_extrema(int index) {
+    for (int c = 0; c <= csv_data.channels; c++) {
+        csv_deque_evict(&csv_data_extrema[c].min, index);
+        csv_deque_evict(&csv_data_extrema[c].max, index);
+    }
+}
+
+// A function to add the point at an index to the extrema of every column (O(1) amortized per column)
+void csv_data_add_extrema(int index) {
+    for (int c = 0; c <= csv_data.channels; c++) {
+        const double *values = csv_data_column(c);
+        csv_deque_push(&csv_data_extrema[c].min, values, index, 0);
+        csv_deque_push(&csv_data_extrema[c].max, values, index, 1);
+    }
+}
+
+// A function to get the range of the csv data from the front of the extrema deques (O(channels))
+void csv_data_get_range(csv_range_t *range) {
+    if (csv_data_size == 0) {
+        memset(range, 0, sizeof(*range));
+        return;
+    }
+
+    range->min_x = csv_data.x[csv_data_extrema[0].min.indices[csv_data_extrema[0].min.front]];
+    range->max_x = csv_data.x[csv_data_extrema[0].max.indices[csv_data_extrema[0].max.front]];
+    range->min_y = csv_data.y[0][csv_data_extrema[1].min.indices[csv_data_extrema[1].min.front]];
+    range->max_y = csv_data.y[0][csv_data_extrema[1].max.indices[csv_data_extrema[1].max.front]];
+    for (int c = 2; c <= csv_data.channels; c++) {
+        const double *values = csv_data.y[c - 1];
+        double min = values[csv_data_extrema[c].min.indices[csv_data_extrema[c].min.front]];
+        double max = values[csv_data_extrema[c].max.indices[csv_data_extrema[c].max.front]];
+        if (min < range->min_y) range->min_y = min;
+        if (max > range->max_y) range->max_y = max;
+    }
+}
+
+// A function to append one sample to the csv data (with rolling buffer), called by the queue consumer only
+int csv_data_append(const double *values) {
+    // Grow the columns geometrically until they can hold the maximum buffer size
+    if (csv_data_size == csv_data_capacity && csv_data_capacity < csv_buffer_max_size) {
+        int capacity = (csv_data_capacity > 0) ? csv_data_capacity : 512;
+        capacity = (capacity > csv_buffer_max_size / 2) ? csv_buffer_max_size : capacity * 2;
+        if (csv_data_resize(capacity) == -1) {
+            perror("realloc");
+            return -1;
+        }
+        csv_data_capacity = capacity;
+    }
+
+    // Check if buffer is full - implement rolling buffer
+    if (csv_data_size >= csv_buffer_max_size) {
+        // Overwrite the oldest entry and advance the head past it (ring buffer, O(1) per point)
+        csv_data_evict_extrema(csv_data_head);
+        csv_data_set(csv_data_head, values);
+        csv_data_add_extrema(csv_data_head);
+        csv_data_add_lod(csv_data_head);
+        csv_data_head++;
+        if (csv_data_head == csv_data_capacity) {
+            csv_data_head = 0;
+        }
+        stats_add(&render_stats.samples_evicted, 1);
+        // Size remains the same
+    } else {
+        // Buffer not full yet - the head is still at index 0, store the new data after the last point
+        csv_data_set(csv_data_size, values);
+        csv_data_add_extrema(csv_data_size);
+        csv_data_add_lod(csv_data_size);
+        csv_data_size++;
+    }
+    csv_data_generation++;
+
+    return 0;
+}
+
+// A function to publish the current extent of the csv data to readers (writer side)
+// The points are written before this is called, so every point in the published view is complete
+void csv_data_publish() {
+    unsigned int sequence = atomic_load_explicit(&csv_snapshot_header.sequence, memory_order_relaxed);
+
+    // Mark the header as being updated, the fence keeps the field stores after this store
+    atomic_store_explicit(&csv_snapshot_header.sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    atomic_store_explicit(&csv_snapshot_header.start, csv_data_generation - csv_data_size, memory_order_relaxed);
+    atomic_store_explicit(&csv_snapshot_header.count, csv_data_size, memory_order_relaxed);
+    atomic_store_explicit(&csv_snapshot_header.generation, csv_data_generation, memory_order_relaxed);
+
+    // The range costs O(1) here because it is maintained as points are added
+    csv_range_t range;
+    csv_data_get_range(&range);
+    atomic_store_explicit(&csv_snapshot_header.min_x, range.min_x, memory_order_relaxed);
+    atomic_store_explicit(&csv_snapshot_header.max_x, range.max_x, memory_order_relaxed);
+    atomic_store_explicit(&csv_snapshot_header.min_y, range.min_y, memory_order_relaxed);
+    atomic_store_explicit(&csv_snapshot_header.max_y, range.max_y, memory_order_relaxed);
+
+    // Mark the header as consistent again and release the points written before it
+    atomic_store_explicit(&csv_snapshot_header.sequence, sequence + 2, memory_order_release);
+}
+
+// A function to take a snapshot of the csv data without blocking the writer
+// Only the small header is retried when the writer updates it at the same time
+void csv_data_snapshot(csv_snapshot_t *snapshot) {
+    unsigned int before, after;
+    do {
+        before = atomic_load_explicit(&csv_snapshot_header.sequence, memory_order_acquire);
+        snapshot->start = atomic_load_explicit(&csv_snapshot_header.start, memory_order_relaxed);
+        snapshot->count = atomic_load_explicit(&csv_snapshot_header.count, memory_order_relaxed);
+        snapshot->generation = atomic_load_explicit(&csv_snapshot_header.generation, memory_order_relaxed);
+        snapshot->range.min_x = atomic_load_explicit(&csv_snapshot_header.min_x, memory_order_relaxed);
+        snapshot->range.max_x = atomic_load_explicit(&csv_snapshot_header.max_x, memory_order_relaxed);
+        snapshot->range.min_y = atomic_load_explicit(&csv_snapshot_header.min_y, memory_order_relaxed);
+        snapshot->range.max_y = atomic_load_explicit(&csv_snapshot_header.max_y, memory_order_relaxed);
+        atomic_thread_fence(memory_order_acquire);
+        after = atomic_load_explicit(&csv_snapshot_header.sequence, memory_order_relaxed);
+    } while ((before & 1) || before != after);
+}
+
+// A function to move every published sample from the sample queue into the csv data without blocking
+// Returns the number of samples moved
+int csv_data_drain() {
+    size_t head = atomic_load_explicit(&sample_queue.head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&sample_queue.tail, memory_order_acquire);
+    if (head == tail) {
+        return 0;
+    }
+    uint64_t start = monotonic_ns();
+    TRACE_BEGIN("csv_data_drain");
+
+    // Store each sample and add up how long it waited since its bytes were read
+    int count = 0;
+    unsigned long latency_sum = 0, latency_max = 0;
+    for (; head != tail; head++) {
+        const csv_sample_t *sample = &sample_queue.samples[head & (SAMPLE_QUEUE_SIZE - 1)];
+        // The first sample sets the number of channels of the csv data, the producer rejects any other count
+        if (csv_data.channels == 0) {
+            csv_data.channels = sample->channels;
+        }
+        if (csv_data_append(sample->values) == -1) {
+            break;
+        }
+        if (sample->read_ns != 0 && sample->read_ns < start) {
+            unsigned long latency = start - sample->read_ns;
+            latency_sum += latency;
+            if (latency > latency_max) latency_max = latency;
+        }
+        count++;
+    }
+    stats_add(&render_stats.samples_stored, count);
+    stats_add(&render_stats.latency_sum_ns, latency_sum);
+    stats_max(&render_stats.latency_max_ns, latency_max);
+
+    // Record the store latency once per group of samples from the same read call,
+    // and keep the groups until a frame draws them (before the slots go back to the producer)
+    uint64_t stored = monotonic_ns();
+    size_t first = head - count;
+    while (first != head) {
+        uint64_t read_ns = sample_queue.samples[first & (SAMPLE_QUEUE_SIZE - 1)].read_ns;
+        size_t last = first + 1;
+        while (last != head && sample_queue.samples[last & (SAMPLE_QUEUE_SIZE - 1)].read_ns == read_ns) {
+            last++;
+        }
+        if (read_ns != 0 && read_ns <= stored) {
+            latency_record(LATENCY_STORE, stored - read_ns, last - first);
+            latency_runs_add(latency_pending_runs, &latency_pending_count, read_ns, last - first);
+        }
+        first = last;
+    }
+
+    // Hand the slots back to the producer with a single release store
+    atomic_store_explicit(&sample_queue.head, head, memory_order_release);
+
+    // Publish the new extent of the csv data to readers
+    if (count > 0) {
+        csv_data_publish();
+    }
+    stats_add(&render_stats.drain_ns, monotonic_ns() - start);
+    TRACE_END("csv_data_drain");
+
+    return count;
+}
+
+// A function to parse a csv line into the sample queue, the sample becomes visible to the
+// consumer with the next sample_queue_publish call
+int csv_parse_line(const char *line, size_t length) {
+    // Skip empty lines
+    if (length == 0) {
+        return 0;
+    }
+
+    // Parse straight into the next free slot of the queue, or drop the line if the queue is full
+    csv_sample_t *sample = sample_queue_reserve(&sample_queue);
+    if (sample == NULL) {
+        sample_queue_dropped(1);
+        return 0;
+    }
+
+    // Parse the x value followed by one value per channel
+    int count = csv_parse_values(line, length, sample->values, CSV_MAX_CHANNELS + 1);
+    if (count < 2) {
+        fprintf(stderr, "Invalid csv format: %.*s\n", (int)length, line);
+        return -1;
+    }
+
+    // The first valid line sets the number of channels, later lines must match it
+    if (serial_channels == 0) {
+        serial_channels = count - 1;
+    } else if (count - 1 != serial_channels) {
+        fprintf(stderr, "Expected %d channels: %.*s\n", serial_channels, (int)length, line);
+        return -1;
+    }
+
+    // Stamp the sample with the time its bytes were read and add it to the current batch
+    sample->read_ns = serial_read_ns;
+    sample->channels = serial_channels;
+    sample_queue_commit(&sample_queue);
+
+    return 0;
+}
+
+// A function to parse every complete line in a buffer of csv text (batch mode)
+// Returns the number of bytes consumed, a trailing partial line is left for the caller
+size_t csv_parse_buffer(const char *data, size_t size) {
+    size_t consumed = 0;
+
+    // Hand each line between line breaks to csv_parse_line
+    const char *end;
+    while ((end = find_either_char(data + consumed, size - consumed, '\n', '\r')) != NULL) {
+        size_t length = end - (data + consumed);
+        if (length > 0 && csv_parse_line(data + consumed, length) == -1) {
+            fprintf(stderr, "Failed to parse csv line: %.*s\n", (int)length, data + consumed);
+        }
+        consumed += length + 1;
+    }
+
+    // Publish the whole batch at once
+    sample_queue_publish(&sample_queue);
+
+    return consumed;
+}
+
+// A global variable to store the lookup table of the packet CRC, filled on first use
+uint16_t crc16_table[256];
+int crc16_table_ready = 0;
+
+// A function to compute the CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF) of a packet, a byte at a time
+uint16_t crc16(const uint8_t *data, size_t size) {
+    if (!crc16_table_ready) {
+        for (int i = 0; i < 256; i++) {
+            uint16_t crc = (uint16_t)(i << 8);
+            for (int bit = 0; bit < 8; bit++) {
+                crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+            }
+            crc16_table[i] = crc;
+        }
+        crc16_table_ready = 1;
+    }
+
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < size; i++) {
+        crc = (uint16_t)((crc << 8) ^ crc16_table[((crc >> 8) ^ data[i]) & 0xFF]);
+    }
+    return crc;
+}
+
+// A function to decode a COBS frame (without its zero delimiter) into a packet
+// Returns the length of the packet, or -1 when the frame is not valid COBS or does not fit
+ssize_t cobs_decode(const uint8_t *frame, size_t size, uint8_t *packet, size_t capacity) {
+    size_t i = 0, length = 0;
+    while (i < size) {
+        // Each code byte is followed by code - 1 bytes copied as they are
+        uint8_t code = frame[i++];
+        size_t run = (size_t)code - 1;
+        if (code == 0 || run > size - i || length + run > capacity) {
+            return -1;
+        }
+        memcpy(packet + length, frame + i, run);
+        length += run;
+        i += run;
+
+        // A code below 0xFF stands for a zero after its bytes, except at the end of the frame
+        if (code < 0xFF && i < size) {
+            if (length == capacity) {
+                return -1;
+            }
+            packet[length++] = 0;
+        }
+    }
+    return length;
+}
+
+// A function to decode a SLIP frame (without its SLIP_END delimiter) into a packet
+// Returns the length of the packet, or -1 when the frame has a bad escape or does not fit
+ssize_t slip_decode(const uint8_t *frame, size_t size, uint8_t *packet, size_t capacity) {
+    size_t i = 0, length = 0;
+    while (i < size) {
+        // Copy the bytes up to the next escape at once (escapes are rare in most data)
+        const char *escape = find_either_char((const char *)frame + i, size - i, (char)SLIP_ESC, (char)SLIP_ESC);
+        size_t run = (escape != NULL) ? (size_t)((const uint8_t *)escape - frame) - i : size - i;
+        if (length + run > capacity) {
+            return -1;
+        }
+        memcpy(packet + length, frame + i, run);
+        length += run;
+        i += run;
+        if (escape == NULL) {
+            break;
+        }
+
+        // Replace the escape sequence by the byte it stands for
+        if (i + 1 >= size || length == capacity) {
+            return -1;
+        }
+        if (frame[i + 1] == SLIP_ESC_END) {
+            packet[length++] = SLIP_END;
+        } else if (frame[i + 1] == SLIP_ESC_ESC) {
+            packet[length++] = SLIP_ESC;
+        } else {
+            return -1;
+        }
+        i += 2;
+    }
+    return length;
+}
+
+// The size in bytes of one value of each packet type
+const size_t packet_type_sizes[PACKET_TYPE_COUNT] = { 2, 4, 4 };
+
+// A function to convert the little endian values of a packet to doubles (8 or 4 at a time with SSE2)
+void packet_convert(const uint8_t *data, packet_type_t type, size_t count, double *values) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // x86 is little endian, so the values can be loaded as they are
+    if (type == PACKET_INT16) {
+        for (; i + 8 <= count; i += 8) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(data + i * 2));
+            // Sign extend to 32 bits by moving each value to the top half and shifting it back down
+            __m128i low = _mm_srai_epi32(_mm_unpacklo_epi16(block, block), 16);
+            __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(block, block), 16);
+            _mm_storeu_pd(values + i, _mm_cvtepi32_pd(low));
+            _mm_storeu_pd(values + i + 2, _mm_cvtepi32_pd(_mm_shuffle_epi32(low, 0xEE)));
+            _mm_storeu_pd(values + i + 4, _mm_cvtepi32_pd(high));
+            _mm_storeu_pd(values + i + 6, _mm_cvtepi32_pd(_mm_shuffle_epi32(high, 0xEE)));
+        }
+    } else if (type == PACKET_INT32) {
+        for (; i + 4 <= count; i += 4) {
+            __m128i block = _mm_loadu_si128((const __m128i *)(data + i * 4));
+            _mm_storeu_pd(values + i, _mm_cvtepi32_pd(block));
+            _mm_storeu_pd(values + i + 2, _mm_cvtepi32_pd(_mm_shuffle_epi32(block, 0xEE)));
+        }
+    } else {
+        for (; i + 4 <= count; i += 4) {
+            __m128 block = _mm_loadu_ps((const float *)(data + i * 4));
+            _mm_storeu_pd(values + i, _mm_cvtps_pd(block));
+            _mm_storeu_pd(values + i + 2, _mm_cvtps_pd(_mm_movehl_ps(block, block)));
+        }
+    }
+#endif
+
+    // Convert the remaining values one by one, assembling the bytes so any host byte order works
+    for (; i < count; i++) {
+        if (type == PACKET_INT16) {
+            const uint8_t *value = data + i * 2;
+            values[i] = (int16_t)(value[0] | value[1] << 8);
+        } else {
+            const uint8_t *value = data + i * 4;
+            uint32_t bits = (uint32_t)value[0] | (uint32_t)value[1] << 8 | (uint32_t)value[2] << 16 |
+                            (uint32_t)value[3] << 24;
+            if (type == PACKET_INT32) {
+                values[i] = (int32_t)bits;
+            } else {
+                float real;
+                memcpy(&real, &bits, sizeof(real));
+                values[i] = real;
+            }
+        }
+    }
+}
+
+// A global variable to store the sequence number expected in the next packet, -1 before the first packet
+int packet_sequence_expected = -1;
+
+// A function to parse a framed binary packet into the sample queue, the samples become visible to the
+// consumer with the next sample_queue_publish call
+// A packet is a header (channel count, sample type, 16-bit sequence number), rows of the x value followed by
+// one value per channel, and the CRC-16 of everything before it, all little endian
+int packet_parse(const uint8_t *frame, size_t size) {
+    // Remove the framing
+    uint8_t packet[PACKET_MAX_SIZE];
+    ssize_t length = (config.input_protocol == INPUT_COBS) ? cobs_decode(frame, size, packet, sizeof(packet))
+                                                           : slip_decode(frame, size, packet, sizeof(packet));
+    if (length == -1) {
+        fprintf(stderr, "Failed to decode packet: bad %s framing\n",
+                (config.input_protocol == INPUT_COBS) ? "COBS" : "SLIP");
+        return -1;
+    }
+    if (length < PACKET_HEADER_SIZE + PACKET_CRC_SIZE) {
+        fprintf(stderr, "Failed to decode packet: %zd bytes is too short\n", length);
+        return -1;
+    }
+
+    // Check the CRC before trusting the header
+    size_t crc_offset = length - PACKET_CRC_SIZE;
+    uint16_t crc = (uint16_t)(packet[crc_offset] | packet[crc_offset + 1] << 8);
+    if (crc16(packet, crc_offset) != crc) {
+        fprintf(stderr, "Failed to decode packet: CRC mismatch\n");
+        return -1;
+    }
+
+    // Count the packets missing between the previous packet and this one
+    // A step back or of half the sequence space or more is a restart of the sender, not a loss
+    unsigned int sequence = packet[2] | packet[3] << 8;
+    if (packet_sequence_expected >= 0 && sequence != (unsigned int)packet_sequence_expected) {
+        unsigned int gap = (sequence - packet_sequence_expected) & 0xFFFF;
+        if (gap < 0x8000) {
+            stats_add(&serial_stats.packets_dropped, gap);
+        } else {
+            stats_add(&serial_stats.packet_resyncs, 1);
+        }
+    }
+    packet_sequence_expected = (sequence + 1) & 0xFFFF;
+
+    // Check the header and that the values form whole rows
+    int channels = packet[0];
+    packet_type_t type = packet[1];
+    if (channels < 1 || channels > CSV_MAX_CHANNELS || type >= PACKET_TYPE_COUNT) {
+        fprintf(stderr, "Failed to decode packet: %d channels of type %d\n", channels, (int)type);
+        return -1;
+    }
+    size_t row_size = (size_t)(channels + 1) * packet_type_sizes[type];
+    size_t values_size = crc_offset - PACKET_HEADER_SIZE;
+    if (values_size == 0 || values_size % row_size != 0) {
+        fprintf(stderr, "Failed to decode packet: %zu bytes of values for rows of %zu bytes\n", values_size, row_size);
+        return -1;
+    }
+
+    // The first valid packet or line sets the number of channels, later ones must match it
+    if (serial_channels == 0) {
+        serial_channels = channels;
+    } else if (channels != serial_channels) {
+        fprintf(stderr, "Failed to decode packet: expected %d channels, got %d\n", serial_channels, channels);
+        return -1;
+    }
+
+    // Convert every value at once, then copy each row into the next free slot of the queue
+    double values[PACKET_MAX_SIZE / 2];
+    size_t count = values_size / packet_type_sizes[type];
+    packet_convert(packet + PACKET_HEADER_SIZE, type, count, values);
+    for (size_t row = 0; row < count; row += channels + 1) {
+        csv_sample_t *sample = sample_queue_reserve(&sample_queue);
+        if (sample == NULL) {
+            sample_queue_dropped((count - row) / (channels + 1));
+            break;
+        }
+        memcpy(sample->values, values + row, (channels + 1) * sizeof(double));
+        sample->read_ns = serial_read_ns;
+        sample->channels = channels;
+        sample_queue_commit(&sample_queue);
+    }
+
+    return 0;
+}
+
+// A function to get the byte that ends each frame of the binary input protocol
+char packet_delimiter() {
+    return (config.input_protocol == INPUT_COBS) ? 0 : (char)SLIP_END;
+}
+
+// A function to parse every complete frame in a buffer of binary packets (batch mode)
+// Returns the number of bytes consumed, a trailing partial frame is left for the caller
+size_t packet_parse_buffer(const char *data, size_t size) {
+    size_t consumed = 0;
+    char delimiter = packet_delimiter();
+
+    // Hand each frame between delimiters to packet_parse
+    const char *end;
+    while ((end = find_either_char(data + consumed, size - consumed, delimiter, delimiter)) != NULL) {
+        size_t length = end - (data + consumed);
+        if (length > 0) {
+            packet_parse((const uint8_t *)data + consumed, length);
+        }
+        consumed += length + 1;
+    }
+
+    // Publish the whole batch at once
+    sample_queue_publish(&sample_queue);
+
+    return consumed;
+}
+
+// A function to read and parse csv data from the serial port in a separate thread
+void *serial_thread(void *arg) {
+    TRACE_THREAD("serial");
+
+    // Use the buffered reader sized for the baud rate by serial_init
+    serial_reader_t *reader = &serial_reader;
+    uint64_t icount_next = 0;
+
+    // Create a file descriptor set for the select function
+    fd_set fds;
+
+    // Create a timeval struct for the select timeout
+    struct timeval tv;
+
+    // Loop until the thread is canceled
+    while (1) {
+        // Read the error counters of the port once a second
+        uint64_t now = monotonic_ns();
+        if (now >= icount_next) {
+            serial_icount_update();
+            icount_next = now + SERIAL_ICOUNT_PERIOD;
+        }
+
+        // Clear the file descriptor set
+        FD_ZERO(&fds);
+
+        // Add the serial port file descriptor to the set
+        FD_SET(serial_fd, &fds);
+
+        // Set the timeout to 1 second
+        tv.tv_sec = 1;
+        tv.tv_usec = 0;
+
+        // Call the select function to check if the serial port is ready for reading
+        int ret = select(serial_fd + 1, &fds, NULL, NULL, &tv);
+        if (ret == -1) {
+            perror("select");
+            break;
+        }
+        else if (ret == 0) {
+            // Timeout, no data available
+            continue;
+        }
+        else {
+            // Data available, read everything the kernel has buffered in one call
+            uint64_t woken = monotonic_ns();
+            size_t written = sample_queue.written;
+            TRACE_BEGIN("serial_read");
+            ssize_t count = serial_reader_fill(reader, serial_fd);
+            TRACE_END("serial_read");
+            if (count == -2) {
+                fprintf(stderr, "Serial port closed, no more data will be read\n");
+                break;
+            }
+            if (count < 0) {
+                perror("read");
+                break;
+            }
+            serial_read_ns = monotonic_ns();
+            stats_add(&serial_stats.bytes_read, count);
+
+            // Parse every complete line or packet, a trailing partial one stays in the reader for the next read
+            char *line;
+            size_t length;
+            if (config.input_protocol == INPUT_CSV) {
+                while ((line = serial_reader_next_line(reader, &length)) != NULL) {
+                    stats_add(&serial_stats.lines_read, 1);
+                    TRACE_BEGIN("csv_parse_line");
+                    int parsed = (length > 0) ? csv_parse_line(line, length) : 0;
+                    TRACE_END("csv_parse_line");
+                    if (parsed == -1) {
+                        fprintf(stderr, "Failed to parse csv line: %s\n", line);
+                        stats_add(&serial_stats.parse_failures, 1);
+                    }
+                }
+            } else {
+                // Empty frames (a delimiter sent before each frame to flush line noise) are skipped
+                char delimiter = packet_delimiter();
+                while ((line = serial_reader_next_frame(reader, delimiter, &length)) != NULL) {
+                    if (length == 0) {
+                        continue;
+                    }
+                    stats_add(&serial_stats.packets_read, 1);
+                    TRACE_BEGIN("packet_parse");
+                    int parsed = packet_parse((const uint8_t *)line, length);
+                    TRACE_END("packet_parse");
+                    if (parsed == -1) {
+                        stats_add(&serial_stats.packet_errors, 1);
+                    }
+                }
+            }
+
+            // Publish every sample parsed from this read with a single release store and wake the main loop,
+            // a read that only completed part of a line or packet has nothing to publish
+            size_t samples = sample_queue.written - written;
+            if (samples > 0) {
+                sample_queue_publish(&sample_queue);
+                uint64_t published = monotonic_ns();
+                data_event_signal();
+
+                // Record the time the read took and the age of the samples when published, once per read
+                latency_record(LATENCY_INGEST, serial_read_ns - woken, samples);
+                latency_record(LATENCY_PARSE, published - serial_read_ns, samples);
+            }
+        }
+    }
+
+    // Return NULL as the thread exit value
+    return NULL;
+}
+
+// A function to handle the xdg shell ping event
+void wm_base_ping(void *data, struct xdg_wm_base *wm_base, uint32_t serial) {
+    // Send a pong reply to the compositor
+    xdg_wm_base_pong(wm_base, serial);
+}
+
+// A struct to store the xdg shell listener callbacks
+struct xdg_wm_base_listener wm_base_listener = {
+    .ping = wm_base_ping,
+};
+
+// A function to handle the presentation clock event, the clock of every presentation time
+void presentation_clock_id(void *data, struct wp_presentation *presentation, uint32_t clock_id) {
+    presentation_clock = (int)clock_id;
+}
+
+// A struct to store the presentation time listener callbacks
+struct wp_presentation_listener presentation_listener = {
+    .clock_id = presentation_clock_id,
+};
+
+// A function to handle the registry global event
+void registry_global(void *data, struct wl_registry *registry, uint32_t id, const char *interface, uint32_t version) {
+    // If the interface is wl_compositor, bind it to the global variable
+    if (strcmp(interface, "wl_compositor") == 0) {
+        compositor = wl_registry_bind(registry, id, &wl_compositor_interface, version < 4 ? version : 4);
+    }
+    // If the interface is wl_shell, bind it to the global variable
+    else if (strcmp(interface, "wl_shell") == 0) {
+        shell = wl_registry_bind(registry, id, &wl_shell_interface, 1);
+    }
+    // If the interface is xdg_wm_base, bind it to the global variable and answer its pings
+    else if (strcmp(interface, "xdg_wm_base") == 0) {
+        wm_base = wl_registry_bind(registry, id, &xdg_wm_base_interface, 1);
+        xdg_wm_base_add_listener(wm_base, &wm_base_listener, NULL);
+    }
+    // If the interface is wl_shm, bind it to the global variable
+    else if (strcmp(interface, "wl_shm") == 0) {
+        shm = wl_registry_bind(registry, id, &wl_shm_interface, 1);
+    }
+    // If the interface is wp_presentation, bind it to measure when frames reach the screen
+    else if (strcmp(interface, "wp_presentation") == 0) {
+        presentation = wl_registry_bind(registry, id, &wp_presentation_interface, 1);
+        wp_presentation_add_listener(presentation, &presentation_listener, NULL);
+    }
+}
+
+// A function to handle the registry global remove event
+void registry_global_remove(void *data, struct wl_registry *registry, uint32_t id) {
+    // Do nothing
+}
+
+// A struct to store the registry listener callbacks
+struct wl_registry_listener registry_listener = {
+    .global = registry_global,
+    .global_remove = registry_global_remove,
+};
+
+// A function to set the window size, kept large enough for the margins and a small plot area
+// The buffers are created again at the new size when they are next drawn into
+void window_resize(int32_t width, int32_t height) {
+    // Keep the current size when the compositor leaves it to the program
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+
+    int min_size = 2 * config.graph_margin + WINDOW_MIN_PLOT_SIZE;
+    if (width < min_size) width = min_size;
+    if (height < min_size) height = min_size;
+    if (width == config.graph_width && height == config.graph_height) {
+        return;
+    }
+
+    config.graph_width = width;
+    config.graph_height = height;
+    redraw_needed = 1;
+}
+
+// A function to handle the shell surface ping event
+void shell_surface_ping(void *data, struct wl_shell_surface *shell_surface, uint32_t serial) {
+    // Send a pong reply to the compositor
+    wl_shell_surface_pong(shell_surface, serial);
+}
+
+// A function to handle the shell surface configure event
+void shell_surface_configure(void *data, struct wl_shell_surface *shell_surface,
+                             uint32_t edges, int32_t width, int32_t height) {
+    // Follow the size the compositor asks for, e.g. while the user drags a window edge
+    window_resize(width, height);
+}
+
+// A function to handle the shell surface popup done event
+void shell_surface_popup_done(void *data, struct wl_shell_surface *shell_surface) {
+    // Do nothing
+}
+
+// A struct to store the shell surface listener callbacks
+struct wl_shell_surface_listener shell_surface_listener = {
+    .ping = shell_surface_ping,
+    .configure = shell_surface_configure,
+    .popup_done = shell_surface_popup_done,
+};
+
+// A function to handle the xdg surface configure event, it ends a sequence of configure events
+void xdg_surface_configure(void *data, struct xdg_surface *xdg_surface, uint32_t serial) {
+    // Acknowledge the configure event, the next commit applies it
+    xdg_surface_ack_configure(xdg_surface, serial);
+
+    // Apply the size the toplevel configure event asked for and draw a frame at that size
+    window_resize(configure_width, configure_height);
+    configured = 1;
+    redraw_needed = 1;
+}
+
+// A struct to store the xdg surface listener callbacks
+struct xdg_surface_listener xdg_surface_listener = {
+    .configure = xdg_surface_configure,
+};
+
+// A function to handle the xdg toplevel configure event, the size is applied by the xdg surface configure event
+void xdg_toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel,
+                            int32_t width, int32_t height, struct wl_array *states) {
+    configure_width = width;
+    configure_height = height;
+}
+
+// A function to handle the xdg toplevel close event
+void xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel) {
+    window_closed = 1;
+}
+
+// A struct to store the xdg toplevel listener callbacks
+struct xdg_toplevel_listener xdg_toplevel_listener = {
+    .configure = xdg_toplevel_configure,
+    .close = xdg_toplevel_close,
+};
+
+// A function to handle the buffer release event, the compositor no longer reads the buffer
+void buffer_release(void *data, struct wl_buffer *buffer) {
+    shm_buffer_t *shm_buffer = data;
+    shm_buffer->busy = 0;
+}
+
+// A global variable to store the buffer listener callbacks
+struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+// A function to handle the frame callback done event, the compositor is ready for the next frame
+// Frame callbacks are not sent while the window is hidden, so nothing is drawn then
+void frame_done(void *data, struct wl_callback *callback, uint32_t time) {
+    wl_callback_destroy(callback);
+    frame_pending = 0;
+}
+
+// A global variable to store the frame callback listener callbacks
+struct wl_callback_listener frame_listener = {
+    .done = frame_done,
+};
+
+// A struct to store the samples a frame showed first, until the compositor presents or discards the frame
+typedef struct {
+    int count;
+    latency_run_t runs[];
+} presentation_frame_t;
+
+// A function to handle the presentation sync output event (the output is not used)
+void presentation_sync_output(void *data, struct wp_presentation_feedback *feedback, struct wl_output *output) {
+}
+
+// A function to handle the presented event, the frame is on the screen since the given time
+void presentation_presented(void *data, struct wp_presentation_feedback *feedback, uint32_t tv_sec_hi,
+                            uint32_t tv_sec_lo, uint32_t tv_nsec, uint32_t refresh, uint32_t seq_hi,
+                            uint32_t seq_lo, uint32_t flags) {
+    presentation_frame_t *frame = data;
+
+    // The read times come from the monotonic clock, other clocks cannot be compared with them
+    if (presentation_clock == CLOCK_MONOTONIC) {
+        uint64_t presented = (((uint64_t)tv_sec_hi << 32) | tv_sec_lo) * 1000000000u + tv_nsec;
+        latency_runs_record(LATENCY_PRESENTED, frame->runs, frame->count, presented);
+    }
+    wp_presentation_feedback_destroy(feedback);
+    free(frame);
+}
+
+// A function to handle the discarded event, the frame was replaced before it reached the screen
+// Its samples are shown by a later frame but are not followed further
+void presentation_discarded(void *data, struct wp_presentation_feedback *feedback) {
+    wp_presentation_feedback_destroy(feedback);
+    free(data);
+}
+
+// A struct to store the presentation feedback listener callbacks
+struct wp_presentation_feedback_listener presentation_feedback_listener = {
+    .sync_output = presentation_sync_output,
+    .presented = presentation_presented,
+    .discarded = presentation_discarded,
+};
+
+// A function to ask the compositor when the next commit reaches the screen, called before the commit
+// Only frames that showed new samples are followed
+void presentation_request() {
+    if (presentation == NULL || latency_frame_count == 0) {
+        return;
+    }
+    presentation_frame_t *frame = malloc(sizeof(presentation_frame_t) + latency_frame_count * sizeof(latency_run_t));
+    if (frame == NULL) {
+        perror("malloc");
+        return;
+    }
+    frame->count = latency_frame_count;
+    memcpy(frame->runs, latency_frame_runs, latency_frame_count * sizeof(latency_run_t));
+    struct wp_presentation_feedback *feedback = wp_presentation_feedback(presentation, surface);
+    wp_presentation_feedback_add_listener(feedback, &presentation_feedback_listener, frame);
+}
+
+// A function to grow the shared memory pool so that each buffer slot holds at least size bytes
+// Slots grow in power of two buckets, so resizing the window inside a bucket reuses the pool as it is
+// The new slots are added after the old ones, so buffers the compositor still holds keep their pixels
+int shm_pool_grow(size_t size) {
+    size_t slot_size = SHM_BUCKET_MIN_SIZE;
+    while (slot_size < size) {
+        slot_size *= 2;
+    }
+    size_t offset = shm_size;
+    size_t new_size = offset + slot_size * SHM_BUFFER_COUNT;
+    if (new_size > INT32_MAX) {
+        fprintf(stderr, "The window is too large for the shared memory pool\n");
+        return -1;
+    }
+
+    // Create the shared memory file, or grow it
+    if (shm_fd < 0) {
+        shm_fd = create_shm_file(new_size);
+        if (shm_fd < 0) {
+            return -1;
+        }
+    } else if (ftruncate(shm_fd, new_size) < 0) {
+        perror("ftruncate");
+        return -1;
+    }
+
+    // Map the shared memory, the file keeps the pixels of the old mapping
+    void *data = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    if (shm_data != NULL) {
+        munmap(shm_data, shm_size);
+    }
+    shm_data = data;
+
+    // Create a wl_shm_pool from the shared memory, or tell the compositor it grew
+    if (shm_pool == NULL) {
+        shm_pool = wl_shm_create_pool(shm, shm_fd, new_size);
+        if (shm_pool == NULL) {
+            fprintf(stderr, "Failed to create the wayland shm pool\n");
+            return -1;
+        }
+    } else {
+        wl_shm_pool_resize(shm_pool, new_size);
+    }
+    shm_size = new_size;
+    shm_slot_offset = offset;
+    shm_slot_size = slot_size;
+
+    // Point the buffers at the new mapping
+    for (int i = 0; i < SHM_BUFFER_COUNT; i++) {
+        shm_buffers[i].data = (char *)shm_data + shm_buffers[i].offset;
+    }
+
+    return 0;
+}
+
+// A function to make a buffer the size of the window, its wl_buffer is only created again when the size changed
+// Each buffer uses its own slot of the pool, which only grows when the window outgrows the slots
+int shm_buffer_prepare(shm_buffer_t *target) {
+    if (target->buffer != NULL && target->width == config.graph_width && target->height == config.graph_height) {
+        return 0;
+    }
+
+    // Grow the pool when the buffer no longer fits in a slot
+    int stride = config.graph_width * 4; // 4 bytes per pixel (ARGB)
+    size_t size = (size_t)stride * config.graph_height;
+    if (size > shm_slot_size && shm_pool_grow(size) == -1) {
+        return -1;
+    }
+
+    // Create a wl_buffer for the slot of this buffer and listen for its release
+    if (target->buffer != NULL) {
+        wl_buffer_destroy(target->buffer);
+    }
+    target->offset = shm_slot_offset + (size_t)(target - shm_buffers) * shm_slot_size;
+    target->buffer = wl_shm_pool_create_buffer(shm_pool, (int32_t)target->offset, config.graph_width, config.graph_height,
+                                               stride, WL_SHM_FORMAT_ARGB8888);
+    if (target->buffer == NULL) {
+        fprintf(stderr, "Failed to create the wayland buffer\n");
+        return -1;
+    }
+    target->data = (char *)shm_data + target->offset;
+    target->width = config.graph_width;
+    target->height = config.graph_height;
+    target->scroll_valid = 0;
+    wl_buffer_add_listener(target->buffer, &buffer_listener, target);
+
+    return 0;
+}
+
+// A function to get a buffer the compositor does not hold, sized for the window
+// Returns NULL when every buffer is still held
+shm_buffer_t *get_free_buffer() {
+    for (int i = 0; i < SHM_BUFFER_COUNT; i++) {
+        if (!shm_buffers[i].busy) {
+            return (shm_buffer_prepare(&shm_buffers[i]) == 0) ? &shm_buffers[i] : NULL;
+        }
+    }
+    return NULL;
+}
+
+// A function to get the index of the pixel column containing a window x coordinate
+long plot_column(double x) {
+    long column = (long)x;
+    return (x < column) ? column - 1 : column;
+}
+
+// A function to make room for count points in the decimation output buffer
+int plot_points_reserve(int count) {
+    if (count <= plot_points_capacity) {
+        return 0;
+    }
+
+    int capacity = (plot_points_capacity > 0) ? plot_points_capacity : 1024;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    plot_point_t *new_points = realloc(plot_points, sizeof(plot_point_t) * capacity);
+    if (new_points == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    plot_points = new_points;
+    plot_points_capacity = capacity;
+
+    return 0;
+}
+
+// A function to add a point to an M4 group
+void plot_m4_add(plot_m4_group_t *group, plot_point_t point, long column, int index) {
+    if (group->count == 0) {
+        group->column = column;
+        group->first = group->last = group->min = group->max = point;
+        group->first_index = group->last_index = group->min_index = group->max_index = index;
+    } else {
+        group->last = point;
+        group->last_index = index;
+        if (point.y < group->min.y) {
+            group->min = point;
+            group->min_index = index;
+        }
+        if (point.y > group->max.y) {
+            group->max = point;
+            group->max_index = index;
+        }
+    }
+    group->count++;
+}
+
+// A function to append the first, min, max and last points of an M4 group to plot_points and empty the group
+// The points keep their original order and points that coincide are only stored once
+// Returns the new number of points in plot_points or -1 on failure
+int plot_m4_flush(plot_m4_group_t *group, int count) {
+    if (plot_points_reserve(count + 4) == -1) {
+        return -1;
+    }
+
+    int min_first = group->min_index < group->max_index;
+    plot_point_t a = min_first ? group->min : group->max;
+    plot_point_t b = min_first ? group->max : group->min;
+    int a_index = min_first ? group->min_index : group->max_index;
+    int b_index = min_first ? group->max_index : group->min_index;
+
+    plot_points[count++] = group->first;
+    if (a_index != group->first_index && a_index != group->last_index) {
+        plot_points[count++] = a;
+    }
+    if (b_index != group->first_index && b_index != group->last_index && b_index != a_index) {
+        plot_points[count++] = b;
+    }
+    if (group->last_index != group->first_index) {
+        plot_points[count++] = group->last;
+    }
+
+    group->count = 0;
+    return count;
+}
+
+// A function to add a point to the current M4 group, emitting the group first when the point is in another pixel column
+// Returns the new number of points in plot_points or -1 on failure
+int plot_m4_push(plot_m4_group_t *group, plot_point_t point, int index, int count) {
+    long column = plot_column(point.x);
+    if (group->count > 0 && column != group->column) {
+        count = plot_m4_flush(group, count);
+        if (count == -1) {
+            return -1;
+        }
+    }
+    plot_m4_add(group, point, column, index);
+    return count;
+}
+
+// A function to reduce a trace to at most four points per pixel column: first, min, max and last (M4)
+// Consecutive points in the same pixel column form one group. With monotonic x there is one group per
+// column, so the result has at most 4 points per column and draws the same pixels as the full polyline
+// Returns the number of points stored in plot_points or -1 on failure
+int plot_decimate_m4(const plot_segment_t *segments, int segment_count, const plot_transform_t *transform) {
+    plot_m4_group_t group = {0};
+    int count = 0;
+    int index = 0;
+
+    for (int s = 0; s < segment_count; s++) {
+        const double *x = segments[s].x;
+        const double *y = segments[s].y;
+        for (int i = 0; i < segments[s].count; i++, index++) {
+            plot_point_t point;
+            point.x = x[i] * transform->scale_x + transform->offset_x;
+            point.y = transform->offset_y - y[i] * transform->scale_y; // Flip Y
+            count = plot_m4_push(&group, point, index, count);
+            if (count == -1) {
+                return -1;
+            }
+        }
+    }
+
+    // Emit the last group
+    if (group.count > 0) {
+        count = plot_m4_flush(&group, count);
+    }
+
+    return count;
+}
+
+// A function to reduce the spans of a channel to at most four points per pixel column like plot_decimate_m4,
+// reading whole pyramid blocks up to max_level instead of their points
+// Each block stands for its first point, its minimum and maximum (at the x of its middle point) and its
+// last point. This approximates exact M4: a block can straddle two pixel columns, and then its extremes are
+// put in the column of its middle point, in an order guessed from the first point. Blocks are at most half a
+// pixel column wide, so an extreme moves by less than one column and the difference is not visible
+// Returns the number of points stored in plot_points or -1 on failure
+int plot_decimate_lod(const csv_span_t *spans, int span_count, int channel, int max_level, const plot_transform_t *transform) {
+    plot_m4_group_t group = {0};
+    int count = 0;
+    int index = 0;
+    const double *x = csv_data.x;
+    const double *y = csv_data.y[channel];
+
+    for (int s = 0; s < span_count && count != -1; s++) {
+        int i = spans[s].start;
+        int end = spans[s].start + spans[s].count;
+        while (i < end && count != -1) {
+            int level = csv_lod_block_level(i, end, max_level);
+
+            // Read the point on its own when no block fits
+            if (level == -1) {
+                plot_point_t point = { x[i] * transform->scale_x + transform->offset_x,
+                                       transform->offset_y - y[i] * transform->scale_y }; // Flip Y
+                count = plot_m4_push(&group, point, index++, count);
+                i++;
+                continue;
+            }
+
+            // Read the block as its first point, its extremes and its last point
+            int size = 1 << csv_lod_shift(level);
+            int block = i >> csv_lod_shift(level);
+            int last = i + size - 1;
+            double middle_x = x[i + size / 2] * transform->scale_x + transform->offset_x;
+            plot_point_t first = { x[i] * transform->scale_x + transform->offset_x,
+                                   transform->offset_y - y[i] * transform->scale_y }; // Flip Y
+            plot_point_t low = { middle_x, transform->offset_y - csv_data.lod_min[channel][level][block] * transform->scale_y };
+            plot_point_t high = { middle_x, transform->offset_y - csv_data.lod_max[channel][level][block] * transform->scale_y };
+            plot_point_t final = { x[last] * transform->scale_x + transform->offset_x,
+                                   transform->offset_y - y[last] * transform->scale_y }; // Flip Y
+
+            // Visit the extreme nearer to the first point first
+            if (low.y - first.y > first.y - high.y) {
+                plot_point_t swap = low;
+                low = high;
+                high = swap;
+            }
+            count = plot_m4_push(&group, first, index++, count);
+            if (count != -1) count = plot_m4_push(&group, low, index++, count);
+            if (count != -1) count = plot_m4_push(&group, high, index++, count);
+            if (count != -1) count = plot_m4_push(&group, final, index++, count);
+            i += size;
+        }
+    }
+    if (count == -1) {
+        return -1;
+    }
+
+    // Emit the last group
+    if (group.count > 0) {
+        count = plot_m4_flush(&group, count);
+    }
+
+    return count;
+}
+
+// A function to get a point of a trace, given its position across the segments, in window coordinates
+plot_point_t plot_segment_point(const plot_segment_t *segments, int segment_count, int index, const plot_transform_t *transform) {
+    // Find the segment holding the point
+    int s = 0;
+    while (s < segment_count - 1 && index >= segments[s].count) {
+        index -= segments[s].count;
+        s++;
+    }
+
+    plot_point_t point;
+    point.x = segments[s].x[index] * transform->scale_x + transform->offset_x;
+    point.y = transform->offset_y - segments[s].y[index] * transform->scale_y; // Flip Y
+    return point;
+}
+
+// A function to store every point of a trace in plot_points without decimation
+// Returns the number of points stored in plot_points or -1 on failure
+int plot_decimate_none(const plot_segment_t *segments, int segment_count, const plot_transform_t *transform) {
+    int count = 0;
+    for (int s = 0; s < segment_count; s++) {
+        count += segments[s].count;
+    }
+    if (plot_points_reserve(count) == -1) {
+        return -1;
+    }
+
+    int index = 0;
+    for (int s = 0; s < segment_count; s++) {
+        for (int i = 0; i < segments[s].count; i++) {
+            plot_points[index].x = segments[s].x[i] * transform->scale_x + transform->offset_x;
+            plot_points[index].y = transform->offset_y - segments[s].y[i] * transform->scale_y; // Flip Y
+            index++;
+        }
+    }
+
+    return count;
+}
+
+// A function to reduce a trace to threshold points with the Largest-Triangle-Three-Buckets algorithm (LTTB)
+// The first and last points are kept, and from each bucket in between the point forming the largest
+// triangle with the previously kept point and the average of the next bucket is kept
+// Returns the number of points stored in plot_points or -1 on failure
+int plot_decimate_lttb(const plot_segment_t *segments, int segment_count, const plot_transform_t *transform, int threshold) {
+    int count = 0;
+    for (int s = 0; s < segment_count; s++) {
+        count += segments[s].count;
+    }
+
+    // Nothing to reduce
+    if (threshold >= count || threshold < 3) {
+        return plot_decimate_none(segments, segment_count, transform);
+    }
+    if (plot_points_reserve(threshold) == -1) {
+        return -1;
+    }
+
+    // Keep the first point
+    int kept = 0;
+    plot_point_t a = plot_segment_point(segments, segment_count, 0, transform);
+    plot_points[kept++] = a;
+
+    // Split the points between the first and the last into threshold - 2 buckets
+    double every = (double)(count - 2) / (threshold - 2);
+    for (int b = 0; b < threshold - 2; b++) {
+        // Get the average of the next bucket (the last point for the last bucket)
+        int next_start = (int)((b + 1) * every) + 1;
+        int next_end = (int)((b + 2) * every) + 1;
+        if (next_end > count) {
+            next_end = count;
+        }
+        if (next_start >= next_end) {
+            next_start = next_end - 1;
+        }
+        double avg_x = 0.0;
+        double avg_y = 0.0;
+        for (int i = next_start; i < next_end; i++) {
+            plot_point_t point = plot_segment_point(segments, segment_count, i, transform);
+            avg_x += point.x;
+            avg_y += point.y;
+        }
+        avg_x /= next_end - next_start;
+        avg_y /= next_end - next_start;
+
+        // Find the point of this bucket forming the largest triangle
+        int start = (int)(b * every) + 1;
+        int end = (int)((b + 1) * every) + 1;
+        double max_area = -1.0;
+        plot_point_t max_point = a;
+        for (int i = start; i < end; i++) {
+            plot_point_t point = plot_segment_point(segments, segment_count, i, transform);
+            double area = (a.x - avg_x) * (point.y - a.y) - (a.x - point.x) * (avg_y - a.y);
+            if (area < 0) {
+                area = -area;
+            }
+            if (area > max_area) {
+                max_area = area;
+                max_point = point;
+            }
+        }
+
+        plot_points[kept++] = max_point;
+        a = max_point;
+    }
+
+    // Keep the last point
+    plot_points[kept++] = plot_segment_point(segments, segment_count, count - 1, transform);
 
-    // Destroy the pool (buffer is still valid)
-    wl_shm_pool_destroy(pool);
+    return kept;
+}
+
+// A function to get the square root of a non-negative number without libm
+double raster_sqrt(double value) {
+#ifdef __SSE2__
+    return _mm_cvtsd_f64(_mm_sqrt_sd(_mm_setzero_pd(), _mm_set_sd(value)));
+#else
+    // Newton iterations from a power of two near the root
+    if (value <= 0.0) {
+        return 0.0;
+    }
+    double root = 1.0;
+    while (root * root < value) root *= 2.0;
+    for (int i = 0; i < 64; i++) {
+        double next = 0.5 * (root + value / root);
+        if (next >= root) break;
+        root = next;
+    }
+    return root;
+#endif
+}
+
+// A function to make room for the spans of a number of pixel columns, new spans start empty
+int raster_spans_reserve(raster_spans_t *spans, int columns) {
+    int count = columns * RASTER_SUBSAMPLES;
+    if (count <= spans->capacity) {
+        return 0;
+    }
+
+    float *new_top = realloc(spans->top, sizeof(float) * count);
+    if (new_top == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    spans->top = new_top;
+    float *new_bottom = realloc(spans->bottom, sizeof(float) * count);
+    if (new_bottom == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    spans->bottom = new_bottom;
+    for (int i = spans->capacity; i < count; i++) {
+        spans->top[i] = 1e30f;
+        spans->bottom[i] = -1e30f;
+    }
+    spans->capacity = count;
+
+    return 0;
+}
+
+// A function to widen the span of a sub-column with an interval of y values
+void raster_span_add(raster_spans_t *spans, int index, double top, double bottom) {
+    if (top < spans->top[index]) spans->top[index] = (float)top;
+    if (bottom > spans->bottom[index]) spans->bottom[index] = (float)bottom;
+}
+
+// A function to add a segment of a line of a given width (with round ends) to the sub-column spans
+// Each sub-column gets the interval where its center line crosses the segment swept by a disk
+// The range of sub-columns that have spans (first .. last) is widened with the sub-columns the segment reaches
+void raster_spans_add_segment(const raster_target_t *target, plot_point_t a, plot_point_t b, double width,
+                              int *span_first, int *span_last) {
+    double radius = width / 2.0;
+
+    // Order the ends by x
+    if (b.x < a.x) {
+        plot_point_t swap = a;
+        a = b;
+        b = swap;
+    }
+    double dx = b.x - a.x;
+    double dy = b.y - a.y;
+    double length2 = dx * dx + dy * dy;
+    double reach = radius * raster_sqrt(length2); // the largest |dy * (x - a.x) - dx * (y - a.y)| inside the line
+
+    // Visit the sub-columns the segment and its round ends can reach, inside the clip rectangle
+    long first = plot_column((a.x - radius) * RASTER_SUBSAMPLES);
+    long last = plot_column((b.x + radius) * RASTER_SUBSAMPLES);
+    if (first < (long)target->clip_x0 * RASTER_SUBSAMPLES) first = (long)target->clip_x0 * RASTER_SUBSAMPLES;
+    if (last >= (long)target->clip_x1 * RASTER_SUBSAMPLES) last = (long)target->clip_x1 * RASTER_SUBSAMPLES - 1;
+    if (first > last) {
+        return;
+    }
+    if (first - (long)target->clip_x0 * RASTER_SUBSAMPLES < *span_first) *span_first = (int)(first - (long)target->clip_x0 * RASTER_SUBSAMPLES);
+    if (last - (long)target->clip_x0 * RASTER_SUBSAMPLES > *span_last) *span_last = (int)(last - (long)target->clip_x0 * RASTER_SUBSAMPLES);
+
+    for (long s = first; s <= last; s++) {
+        int index = (int)(s - (long)target->clip_x0 * RASTER_SUBSAMPLES);
+        double x = (s + 0.5) / RASTER_SUBSAMPLES;
+
+        // The rectangle between the ends: within radius of the line, and projecting between the ends
+        if (length2 > 0.0) {
+            double u = x - a.x;
+            double top = -1e30;
+            double bottom = 1e30;
+            if (dx > 0.0) {
+                top = a.y + (dy * u - reach) / dx;
+                bottom = a.y + (dy * u + reach) / dx;
+            } else if (u * dy > reach || -u * dy > reach) {
+                top = bottom = 0.0; // vertical segment out of reach
+            }
+            if (dy > 0.0) {
+                double low = a.y - u * dx / dy;
+                double high = a.y + (length2 - u * dx) / dy;
+                if (low > top) top = low;
+                if (high < bottom) bottom = high;
+            } else if (dy < 0.0) {
+                double low = a.y + (length2 - u * dx) / dy;
+                double high = a.y - u * dx / dy;
+                if (low > top) top = low;
+                if (high < bottom) bottom = high;
+            } else if (u < 0.0 || u > dx) {
+                top = bottom = 0.0; // horizontal segment, outside of its ends
+            }
+            if (top < bottom) {
+                raster_span_add(target->spans, index, top, bottom);
+            }
+        }
+
+        // The round ends
+        double da = x - a.x;
+        if (da * da <= radius * radius) {
+            double h = raster_sqrt(radius * radius - da * da);
+            raster_span_add(target->spans, index, a.y - h, a.y + h);
+        }
+        double db = x - b.x;
+        if (db * db <= radius * radius) {
+            double h = raster_sqrt(radius * radius - db * db);
+            raster_span_add(target->spans, index, b.y - h, b.y + h);
+        }
+    }
+}
+
+// A function to get the coverage of a pixel from the spans of its sub-columns, between 0 and 1
+float raster_coverage(const float *top, const float *bottom, float row) {
+#ifdef __SSE2__
+    // Overlap of [row, row + 1] with the span of each of the four sub-columns at once
+    __m128 low = _mm_max_ps(_mm_loadu_ps(top), _mm_set1_ps(row));
+    __m128 high = _mm_min_ps(_mm_loadu_ps(bottom), _mm_set1_ps(row + 1.0f));
+    __m128 overlap = _mm_max_ps(_mm_sub_ps(high, low), _mm_setzero_ps());
+    overlap = _mm_add_ps(overlap, _mm_movehl_ps(overlap, overlap));
+    overlap = _mm_add_ss(overlap, _mm_shuffle_ps(overlap, overlap, 1));
+    return _mm_cvtss_f32(overlap) * (1.0f / RASTER_SUBSAMPLES);
+#else
+    float overlap[RASTER_SUBSAMPLES];
+    for (int k = 0; k < RASTER_SUBSAMPLES; k++) {
+        float low = (top[k] > row) ? top[k] : row;
+        float high = (bottom[k] < row + 1.0f) ? bottom[k] : row + 1.0f;
+        overlap[k] = (high > low) ? high - low : 0.0f;
+    }
+    // Add the overlaps in the same order as the SSE2 path, so both builds round to the same coverage
+    return ((overlap[0] + overlap[2]) + (overlap[1] + overlap[3])) * (1.0f / RASTER_SUBSAMPLES);
+#endif
+}
+
+// A function to blend an opaque color into a pixel with an alpha between 0 and 128
+void raster_blend(uint32_t *pixel, uint32_t color, int alpha) {
+#ifdef __SSE2__
+    // Blend the four channels of the pixel at once in 16-bit lanes
+    __m128i zero = _mm_setzero_si128();
+    __m128i source = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)color), zero);
+    __m128i target = _mm_unpacklo_epi8(_mm_cvtsi32_si128((int)*pixel), zero);
+    __m128i delta = _mm_mullo_epi16(_mm_sub_epi16(source, target), _mm_set1_epi16((short)alpha));
+    target = _mm_add_epi16(target, _mm_srai_epi16(delta, 7));
+    *pixel = (uint32_t)_mm_cvtsi128_si32(_mm_packus_epi16(target, zero));
+#else
+    uint32_t result = 0;
+    for (int shift = 0; shift < 32; shift += 8) {
+        int source = (color >> shift) & 0xff;
+        int target = (*pixel >> shift) & 0xff;
+        target += ((source - target) * alpha) >> 7;
+        result |= (uint32_t)target << shift;
+    }
+    *pixel = result;
+#endif
+}
+
+// A function to blend the pixel columns holding the sub-column spans first .. last, then empty those spans
+void raster_spans_fill(const raster_target_t *target, int span_first, int span_last, uint32_t color) {
+    for (int column = span_first / RASTER_SUBSAMPLES; column <= span_last / RASTER_SUBSAMPLES; column++) {
+        float *top = target->spans->top + column * RASTER_SUBSAMPLES;
+        float *bottom = target->spans->bottom + column * RASTER_SUBSAMPLES;
+
+        // Get the rows any sub-column covers and the rows every sub-column covers
+        float span_top = top[0];
+        float span_bottom = bottom[0];
+        float inner_top = top[0];
+        float inner_bottom = bottom[0];
+        for (int k = 1; k < RASTER_SUBSAMPLES; k++) {
+            if (top[k] < span_top) span_top = top[k];
+            if (bottom[k] > span_bottom) span_bottom = bottom[k];
+            if (top[k] > inner_top) inner_top = top[k];
+            if (bottom[k] < inner_bottom) inner_bottom = bottom[k];
+        }
+
+        if (span_bottom > span_top) {
+            // Clip the rows to the target
+            int first_row = (int)plot_column(span_top);
+            int last_row = (int)plot_column(span_bottom);
+            if (first_row < target->clip_y0) first_row = target->clip_y0;
+            if (last_row >= target->clip_y1) last_row = target->clip_y1 - 1;
+
+            uint32_t *pixel = target->pixels + (size_t)first_row * target->stride + target->clip_x0 + column;
+            for (int row = first_row; row <= last_row; row++, pixel += target->stride) {
+                // Rows covered by every sub-column take the color as is
+                if (row >= inner_top && row + 1 <= inner_bottom) {
+                    *pixel = color;
+                    continue;
+                }
+                int alpha = (int)(raster_coverage(top, bottom, (float)row) * 128.0f + 0.5f);
+                if (alpha > 0) {
+                    raster_blend(pixel, color, alpha);
+                }
+            }
+        }
+
+        // Empty the spans for the next run
+        for (int k = 0; k < RASTER_SUBSAMPLES; k++) {
+            top[k] = 1e30f;
+            bottom[k] = -1e30f;
+        }
+    }
+}
+
+// A function to draw an anti-aliased polyline of a given width straight into ARGB8888 pixels
+// The polyline is turned into one vertical span per sub-column (RASTER_SUBSAMPLES per pixel column) and
+// each pixel is blended once with the coverage of the spans of its column, so joints are not blended twice.
+// A span per sub-column only holds a run of segments going the same way in x, so the polyline is drawn
+// run by run when x turns back
+// Returns 0 on success or -1 on failure
+int raster_polyline(const raster_target_t *target, const plot_point_t *points, int count, const double *color, double width) {
+    int columns = target->clip_x1 - target->clip_x0;
+    if (count <= 0 || columns <= 0) {
+        return 0;
+    }
+
+    // Make room for the spans of the columns
+    if (raster_spans_reserve(target->spans, columns) == -1) {
+        return -1;
+    }
+
+    // Convert the color to an opaque ARGB8888 pixel
+    uint32_t pixel_color = 0xff000000u |
+                           ((uint32_t)(color[0] * 255.0 + 0.5) << 16) |
+                           ((uint32_t)(color[1] * 255.0 + 0.5) << 8) |
+                           (uint32_t)(color[2] * 255.0 + 0.5);
+
+    // A single point is drawn as a dot
+    int span_first = columns * RASTER_SUBSAMPLES;
+    int span_last = -1;
+    if (count == 1) {
+        raster_spans_add_segment(target, points[0], points[0], width, &span_first, &span_last);
+    }
+
+    // Add every segment, drawing the run so far whenever x turns back
+    int direction = 0;
+    for (int i = 1; i < count; i++) {
+        int segment_direction = (points[i].x > points[i - 1].x) - (points[i].x < points[i - 1].x);
+        if (segment_direction != 0 && direction != 0 && segment_direction != direction && span_last >= 0) {
+            raster_spans_fill(target, span_first, span_last, pixel_color);
+            span_first = columns * RASTER_SUBSAMPLES;
+            span_last = -1;
+        }
+        if (segment_direction != 0) {
+            direction = segment_direction;
+        }
+        raster_spans_add_segment(target, points[i - 1], points[i], width, &span_first, &span_last);
+    }
+    if (span_last >= 0) {
+        raster_spans_fill(target, span_first, span_last, pixel_color);
+    }
+
+    return 0;
+}
+
+// A function to find the first point of a trace whose x is not less than a value, for traces where x never decreases
+int render_trace_find(const render_trace_t *trace, double x) {
+    int low = 0;
+    int high = trace->count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        if (trace->points[middle].x < x) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// A function to rasterize the printable characters of each font once into the glyph atlases
+int glyph_atlas_init() {
+    for (int f = 0; f < GLYPH_FONT_COUNT; f++) {
+        glyph_atlas_t *atlas = &glyph_atlases[f];
+
+        // Measure the font and each character with a scratch surface
+        cairo_surface_t *scratch = cairo_image_surface_create(CAIRO_FORMAT_A8, 1, 1);
+        cairo_t *cr = cairo_create(scratch);
+        cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+        cairo_set_font_size(cr, glyph_font_sizes[f]);
+        cairo_font_extents_t font;
+        cairo_font_extents(cr, &font);
+        atlas->ascent = (int)-plot_column(-font.ascent) + 1;
+        atlas->height = atlas->ascent + (int)-plot_column(-font.descent) + 1;
+
+        // Give each character its columns, with one spare column on each side for anti-aliasing
+        int width = 0;
+        for (int i = 0; i < GLYPH_COUNT; i++) {
+            char text[2] = { (char)(GLYPH_FIRST + i), '\0' };
+            cairo_text_extents_t extents;
+            cairo_text_extents(cr, text, &extents);
+            glyph_t *glyph = &atlas->glyphs[i];
+            glyph->left = (int)plot_column(extents.x_bearing) - 1;
+            glyph->width = (int)-plot_column(-(extents.x_bearing + extents.width)) + 1 - glyph->left;
+            glyph->atlas_x = width;
+            glyph->advance = extents.x_advance;
+            width += glyph->width;
+        }
+        cairo_destroy(cr);
+        cairo_surface_destroy(scratch);
+
+        // Draw every character into its columns
+        cairo_surface_t *image = cairo_image_surface_create(CAIRO_FORMAT_A8, width, atlas->height);
+        cr = cairo_create(image);
+        cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+        cairo_set_font_size(cr, glyph_font_sizes[f]);
+        cairo_set_source_rgba(cr, 0.0, 0.0, 0.0, 1.0);
+        for (int i = 0; i < GLYPH_COUNT; i++) {
+            char text[2] = { (char)(GLYPH_FIRST + i), '\0' };
+            cairo_move_to(cr, atlas->glyphs[i].atlas_x - atlas->glyphs[i].left, atlas->ascent);
+            cairo_show_text(cr, text);
+        }
+        cairo_destroy(cr);
+        cairo_surface_flush(image);
+
+        // Keep a copy of the coverage
+        unsigned char *data = cairo_image_surface_get_data(image);
+        atlas->stride = cairo_image_surface_get_stride(image);
+        atlas->alpha = malloc((size_t)atlas->stride * atlas->height);
+        if (data == NULL || atlas->alpha == NULL) {
+            fprintf(stderr, "Failed to create the glyph atlas\n");
+            cairo_surface_destroy(image);
+            return -1;
+        }
+        memcpy(atlas->alpha, data, (size_t)atlas->stride * atlas->height);
+        cairo_surface_destroy(image);
+    }
+
+    return 0;
+}
+
+// A function to draw a text of the static layer from the glyph atlas, black on white, and store what it covers
+void static_layer_blit(static_text_t *item) {
+    const glyph_atlas_t *atlas = &glyph_atlases[item->font];
+    int top = item->y - atlas->ascent;
+    double pen = item->x;
+
+    item->x0 = static_layer.width;
+    item->x1 = 0;
+    for (const char *c = item->text; *c != '\0'; c++) {
+        int index = (unsigned char)*c - GLYPH_FIRST;
+        if (index < 0 || index >= GLYPH_COUNT) index = '?' - GLYPH_FIRST;
+        const glyph_t *glyph = &atlas->glyphs[index];
+
+        // Clip the glyph to the layer
+        int left = (int)plot_column(pen + 0.5) + glyph->left;
+        int first = (left < 0) ? -left : 0;
+        int last = (left + glyph->width > static_layer.width) ? static_layer.width - left : glyph->width;
+        if (first < last) {
+            if (left + first < item->x0) item->x0 = left + first;
+            if (left + last > item->x1) item->x1 = left + last;
+        }
+
+        // Darken the layer with the coverage, keeping the darkest value where glyphs overlap
+        for (int row = 0; row < atlas->height; row++) {
+            int y = top + row;
+            if (y < 0 || y >= static_layer.height) continue;
+            const uint8_t *alpha = atlas->alpha + (size_t)row * atlas->stride + glyph->atlas_x;
+            uint32_t *pixel = static_layer.pixels + (size_t)y * static_layer.width + left;
+            for (int column = first; column < last; column++) {
+                uint32_t gray = 255u - alpha[column];
+                if (gray < (pixel[column] & 0xffu)) {
+                    pixel[column] = 0xff000000u | gray * 0x010101u;
+                }
+            }
+        }
+        pen += glyph->advance;
+    }
+
+    item->y0 = (top < 0) ? 0 : top;
+    item->y1 = (top + atlas->height > static_layer.height) ? static_layer.height : top + atlas->height;
+}
+
+// A function to set a text of the static layer, the layer is only drawn again when the text or its place changed
+// An empty text hides it
+void static_layer_text(static_text_id_t id, glyph_font_t font, int x, int y, const char *text) {
+    static_text_t *item = &static_layer.texts[id];
+    if (item->font == font && item->x == x && item->y == y && strcmp(item->text, text) == 0) {
+        return;
+    }
+
+    // Clear what the old text covered
+    int x0 = item->x0, y0 = item->y0, x1 = item->x1, y1 = item->y1;
+    for (int row = y0; row < y1 && x0 < x1; row++) {
+        uint32_t *pixel = static_layer.pixels + (size_t)row * static_layer.width;
+        for (int column = x0; column < x1; column++) {
+            pixel[column] = 0xffffffffu;
+        }
+    }
+
+    // Draw the new text
+    snprintf(item->text, sizeof(item->text), "%s", text);
+    item->font = font;
+    item->x = x;
+    item->y = y;
+    item->x0 = item->x1 = 0;
+    if (item->text[0] != '\0') {
+        static_layer_blit(item);
+    }
+
+    // Draw again the other texts that overlapped the cleared rectangle
+    for (int i = 0; i < STATIC_TEXT_COUNT; i++) {
+        static_text_t *other = &static_layer.texts[i];
+        if (i != (int)id && other->text[0] != '\0' &&
+            other->x0 < x1 && x0 < other->x1 && other->y0 < y1 && y0 < other->y1) {
+            static_layer_blit(other);
+        }
+    }
+}
+
+// A function to make the static layer the size of a frame, a new size starts from a white layer without text
+int static_layer_reserve(int width, int height) {
+    if (static_layer.pixels != NULL && static_layer.width == width && static_layer.height == height) {
+        return 0;
+    }
+
+    // Rasterize the glyphs the first time
+    if (glyph_atlases[0].alpha == NULL && glyph_atlas_init() == -1) {
+        return -1;
+    }
+
+    uint32_t *pixels = realloc(static_layer.pixels, sizeof(uint32_t) * (size_t)width * height);
+    if (pixels == NULL) {
+        perror("realloc");
+        return -1;
+    }
+    for (size_t i = 0; i < (size_t)width * height; i++) {
+        pixels[i] = 0xffffffffu;
+    }
+    static_layer.pixels = pixels;
+    static_layer.width = width;
+    static_layer.height = height;
+    memset(static_layer.texts, 0, sizeof(static_layer.texts));
+
+    return 0;
+}
+
+// A function to copy a rectangle of the static layer into a frame
+void static_layer_copy(uint32_t *pixels, int x0, int y0, int x1, int y1) {
+    if (x0 >= x1) {
+        return;
+    }
+
+    // Copy whole rows at once
+    if (x0 == 0 && x1 == static_layer.width) {
+        memcpy(pixels + (size_t)y0 * static_layer.width, static_layer.pixels + (size_t)y0 * static_layer.width,
+               sizeof(uint32_t) * (size_t)static_layer.width * (y1 - y0));
+        return;
+    }
+    for (int row = y0; row < y1; row++) {
+        size_t offset = (size_t)row * static_layer.width + x0;
+        memcpy(pixels + offset, static_layer.pixels + offset, sizeof(uint32_t) * (x1 - x0));
+    }
+}
+
+// A function to set the texts of the static layer to the buffer status and the axis labels with the min/max values
+void static_layer_set_labels(int count, double min_x, double max_x, double min_y, double max_y) {
+    char text[STATIC_TEXT_LENGTH];
+
+    // Buffer status text
+    snprintf(text, sizeof(text), "Points: %d / %d, Channels: %d %s",
+             count, csv_buffer_max_size, csv_data.channels,
+             count >= csv_buffer_max_size ? "(ROLLING)" : "");
+    static_layer_text(STATIC_TEXT_STATUS, GLYPH_FONT_STATUS, 10, 20, text);
+
+    // X-axis min
+    snprintf(text, sizeof(text), "%.2f", min_x);
+    static_layer_text(STATIC_TEXT_MIN_X, GLYPH_FONT_LABEL,
+                      config.graph_margin, config.graph_height - config.graph_margin + 20, text);
+
+    // X-axis max
+    snprintf(text, sizeof(text), "%.2f", max_x);
+    static_layer_text(STATIC_TEXT_MAX_X, GLYPH_FONT_LABEL,
+                      config.graph_width - config.graph_margin - 40, config.graph_height - config.graph_margin + 20, text);
+
+    // Y-axis min
+    snprintf(text, sizeof(text), "%.2f", min_y);
+    static_layer_text(STATIC_TEXT_MIN_Y, GLYPH_FONT_LABEL, 5, config.graph_height - config.graph_margin, text);
+
+    // Y-axis max
+    snprintf(text, sizeof(text), "%.2f", max_y);
+    static_layer_text(STATIC_TEXT_MAX_Y, GLYPH_FONT_LABEL, 5, config.graph_margin, text);
+
+    // Hide the waiting message
+    static_layer_text(STATIC_TEXT_WAITING, GLYPH_FONT_TITLE, 0, 0, "");
+    static_layer_text(STATIC_TEXT_BUFFER_INFO, GLYPH_FONT_STATUS, 0, 0, "");
+}
+
+// A function to set the texts of the static layer to the waiting message
+void static_layer_set_waiting() {
+    char text[STATIC_TEXT_LENGTH];
+
+    // Hide the status and the labels
+    static_layer_text(STATIC_TEXT_STATUS, GLYPH_FONT_STATUS, 0, 0, "");
+    static_layer_text(STATIC_TEXT_MIN_X, GLYPH_FONT_LABEL, 0, 0, "");
+    static_layer_text(STATIC_TEXT_MAX_X, GLYPH_FONT_LABEL, 0, 0, "");
+    static_layer_text(STATIC_TEXT_MIN_Y, GLYPH_FONT_LABEL, 0, 0, "");
+    static_layer_text(STATIC_TEXT_MAX_Y, GLYPH_FONT_LABEL, 0, 0, "");
+
+    // "Waiting for data..." message
+    static_layer_text(STATIC_TEXT_WAITING, GLYPH_FONT_TITLE,
+                      config.graph_width / 2 - 80, config.graph_height / 2, "Waiting for data...");
+
+    // Buffer size info
+    snprintf(text, sizeof(text), "Buffer size: %d points", csv_buffer_max_size);
+    static_layer_text(STATIC_TEXT_BUFFER_INFO, GLYPH_FONT_STATUS,
+                      config.graph_width / 2 - 100, config.graph_height / 2 + 30, text);
+}
+
+// A function to set the texts of the statistics overlay at the top right, next to the status line
+// The texts show rates and averages over the last STATS_OVERLAY_PERIOD, so they only change that often
+void static_layer_set_stats() {
+    static stats_values_t previous;
+    char text[STATIC_TEXT_LENGTH];
+
+    // Hide the overlay
+    if (!stats_overlay) {
+        static_layer_text(STATIC_TEXT_STATS_INGEST, GLYPH_FONT_LABEL, 0, 0, "");
+        static_layer_text(STATIC_TEXT_STATS_LATENCY, GLYPH_FONT_LABEL, 0, 0, "");
+        static_layer_text(STATIC_TEXT_STATS_FRAME, GLYPH_FONT_LABEL, 0, 0, "");
+        stats_overlay_shown = 0;
+        return;
+    }
+
+    // Keep the texts until the period is over, unless the overlay was just shown or the layer was cleared
+    stats_values_t now;
+    stats_read(&now);
+    if (stats_overlay_shown && static_layer.texts[STATIC_TEXT_STATS_INGEST].text[0] != '\0' &&
+        now.time_ns - previous.time_ns < STATS_OVERLAY_PERIOD) {
+        return;
+    }
+    if (!stats_overlay_shown) {
+        previous = now;
+    }
+    stats_overlay_shown = 1;
+
+    double seconds = (now.time_ns > previous.time_ns) ? (now.time_ns - previous.time_ns) * 1e-9 : 1.0;
+    int x = config.graph_width - STATS_OVERLAY_WIDTH;
+    if (config.input_protocol == INPUT_CSV) {
+        snprintf(text, sizeof(text), "In: %.0f lines/s, %.1f kB/s, fail %lu, drop %lu, evict %lu",
+                 (now.lines_read - previous.lines_read) / seconds, (now.bytes_read - previous.bytes_read) / seconds / 1e3,
+                 now.parse_failures + now.lines_discarded, now.samples_dropped, now.samples_evicted);
+    } else {
+        snprintf(text, sizeof(text), "In: %.0f pkt/s, %.1f kB/s, fail %lu, lost %lu, drop %lu",
+                 (now.packets_read - previous.packets_read) / seconds,
+                 (now.bytes_read - previous.bytes_read) / seconds / 1e3, now.packet_errors, now.packets_dropped,
+                 now.samples_dropped);
+    }
+    static_layer_text(STATIC_TEXT_STATS_INGEST, GLYPH_FONT_LABEL, x, 14, text);
+
+    snprintf(text, sizeof(text), "Latency: %.2f ms, max %.2f, %.1f fps, skip %lu, busy %lu",
+             stats_average_ms(now.latency_sum_ns, previous.latency_sum_ns, now.samples_stored, previous.samples_stored),
+             now.latency_max_ns * 1e-6, (now.frames - previous.frames) / seconds, now.frames_skipped,
+             now.buffers_busy);
+    static_layer_text(STATIC_TEXT_STATS_LATENCY, GLYPH_FONT_LABEL, x, 28, text);
+
+    snprintf(text, sizeof(text), "Frame: %.2f ms, drain %.2f, decim %.2f, draw %.2f, wait %.2f",
+             stats_average_ms(now.frame_ns, previous.frame_ns, now.frames, previous.frames),
+             stats_average_ms(now.drain_ns, previous.drain_ns, now.frames, previous.frames),
+             stats_average_ms(now.decimate_ns, previous.decimate_ns, now.frames, previous.frames),
+             stats_average_ms(now.draw_ns, previous.draw_ns, now.frames, previous.frames),
+             stats_average_ms(now.pool_wait_ns, previous.pool_wait_ns, now.frames, previous.frames));
+    static_layer_text(STATIC_TEXT_STATS_FRAME, GLYPH_FONT_LABEL, x, 42, text);
+
+    previous = now;
+}
+
+// A function to render one vertical tile of the current job: clear it, then draw each channel in order
+// Each tile only gets the points whose segments can reach it, and pixels are computed per column, so
+// tiles can be rendered in any order by any thread with the same result as one tile covering everything
+void render_tile(int tile, int worker) {
+    raster_target_t target = render_job.target;
+    target.clip_x0 = render_job.target.clip_x0 + tile * render_job.tile_width;
+    target.clip_x1 = target.clip_x0 + render_job.tile_width;
+    if (target.clip_x1 > render_job.target.clip_x1) target.clip_x1 = render_job.target.clip_x1;
+    if (target.clip_x0 >= target.clip_x1) {
+        return;
+    }
+    target.spans = &raster_spans[worker];
+
+    // Restore the tile from the static layer
+    if (render_job.clear) {
+        static_layer_copy(target.pixels, target.clip_x0, target.clip_y0, target.clip_x1, target.clip_y1);
+    }
+
+    for (int c = 0; c < csv_data.channels; c++) {
+        const render_trace_t *trace = &render_traces[c];
+        int first = 0;
+        int end = trace->count;
+
+        // Keep the points from the last one before the tile (less the line width) to the first one after it
+        if (trace->monotonic) {
+            first = render_trace_find(trace, target.clip_x0 - 1.0) - 1;
+            if (first < 0) first = 0;
+            end = render_trace_find(trace, target.clip_x1 + 1.0) + 1;
+            if (end > trace->count) end = trace->count;
+        }
+        if (end > first) {
+            raster_polyline(&target, trace->points + first, end - first, trace_colors[c % TRACE_COLOR_COUNT], 2.0);
+        }
+    }
+}
+
+// A function to render tiles of the current job until none is left
+void render_run_tiles(int worker) {
+    int tile;
+    while ((tile = atomic_fetch_add(&render_job.next_tile, 1)) < render_job.tiles) {
+        TRACE_BEGIN("render_tile");
+        render_tile(tile, worker);
+        TRACE_END("render_tile");
+    }
+}
+
+// A function run by each rendering thread, it waits for a job, renders tiles and reports when it is done
+void *render_worker(void *arg) {
+    int worker = (int)(intptr_t)arg;
+    unsigned long seen = 0;
+    char name[TRACE_NAME_LENGTH];
+    snprintf(name, sizeof(name), "render %d", worker);
+    TRACE_THREAD(name);
+
+    pthread_mutex_lock(&render_pool.mutex);
+    while (1) {
+        // Wait for the next job
+        while (!render_pool.stop && render_pool.generation == seen) {
+            pthread_cond_wait(&render_pool.start, &render_pool.mutex);
+        }
+        if (render_pool.stop) {
+            break;
+        }
+        seen = render_pool.generation;
+        pthread_mutex_unlock(&render_pool.mutex);
+
+        render_run_tiles(worker);
+
+        // Report that this worker is done with the job
+        pthread_mutex_lock(&render_pool.mutex);
+        render_pool.pending--;
+        if (render_pool.pending == 0) {
+            pthread_cond_signal(&render_pool.done);
+        }
+    }
+    pthread_mutex_unlock(&render_pool.mutex);
+
+    return NULL;
+}
+
+// A function to start the rendering threads, the main thread renders too so threads - 1 are created
+int render_pool_start(int threads) {
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&render_pool.threads[render_pool.count], NULL, render_worker, (void *)(intptr_t)i) != 0) {
+            perror("pthread_create");
+            return -1;
+        }
+        render_pool.count++;
+    }
+    return 0;
+}
+
+// A function to stop and join the rendering threads
+void render_pool_stop() {
+    pthread_mutex_lock(&render_pool.mutex);
+    render_pool.stop = 1;
+    pthread_cond_broadcast(&render_pool.start);
+    pthread_mutex_unlock(&render_pool.mutex);
+
+    for (int i = 0; i < render_pool.count; i++) {
+        pthread_join(render_pool.threads[i], NULL);
+    }
+    render_pool.count = 0;
+}
+
+// A function to render the traces of render_traces into a region split into vertical tiles across the pool
+// The main thread renders tiles as well and returns once every tile is done
+void render_frame(const raster_target_t *target, int clear) {
+    int threads = render_pool.count + 1;
+    int width = target->clip_x1 - target->clip_x0;
+
+    // Post the job
+    render_job.target = *target;
+    render_job.clear = clear;
+    render_job.tiles = (threads == 1) ? 1 : threads * RENDER_TILES_PER_THREAD;
+    render_job.tile_width = (width + render_job.tiles - 1) / render_job.tiles;
+    atomic_store(&render_job.next_tile, 0);
+    if (render_pool.count > 0) {
+        pthread_mutex_lock(&render_pool.mutex);
+        render_pool.pending = render_pool.count;
+        render_pool.generation++;
+        pthread_cond_broadcast(&render_pool.start);
+        pthread_mutex_unlock(&render_pool.mutex);
+    }
+
+    // Render tiles on this thread too
+    render_run_tiles(0);
+
+    // Wait for the workers to finish
+    if (render_pool.count > 0) {
+        uint64_t wait_start = monotonic_ns();
+        TRACE_BEGIN("render_pool_wait");
+        pthread_mutex_lock(&render_pool.mutex);
+        while (render_pool.pending > 0) {
+            pthread_cond_wait(&render_pool.done, &render_pool.mutex);
+        }
+        pthread_mutex_unlock(&render_pool.mutex);
+        TRACE_END("render_pool_wait");
+        stats_add(&render_stats.pool_wait_ns, monotonic_ns() - wait_start);
+    }
+}
+
+// A function to keep a copy of the points in plot_points as the trace of a channel for render_frame
+int render_trace_store(int channel, int count) {
+    render_trace_t *trace = &render_traces[channel];
+    if (count > trace->capacity) {
+        plot_point_t *new_points = realloc(trace->points, sizeof(plot_point_t) * count);
+        if (new_points == NULL) {
+            perror("realloc");
+            return -1;
+        }
+        trace->points = new_points;
+        trace->capacity = count;
+    }
+    memcpy(trace->points, plot_points, sizeof(plot_point_t) * count);
+    trace->count = count;
+
+    // Check whether x never decreases
+    trace->monotonic = 1;
+    for (int i = 1; i < count; i++) {
+        if (plot_points[i].x < plot_points[i - 1].x) {
+            trace->monotonic = 0;
+            break;
+        }
+    }
+
+    return 0;
+}
+
+// A function to reduce a trace with the configured decimation mode
+// Returns the number of points stored in plot_points or -1 on failure
+int plot_decimate(const plot_segment_t *segments, int segment_count, const plot_transform_t *transform) {
+    if (config.decimation == PLOT_DECIMATION_M4) {
+        return plot_decimate_m4(segments, segment_count, transform);
+    } else if (config.decimation == PLOT_DECIMATION_LTTB) {
+        return plot_decimate_lttb(segments, segment_count, transform, 2 * (config.graph_width - 2 * config.graph_margin));
+    }
+    return plot_decimate_none(segments, segment_count, transform);
+}
+
+// A function to pick the coarsest pyramid level that still has at least two blocks per pixel column for the
+// points of the spans, so a block that straddles two columns moves its extremes by less than a column
+// Returns -1 when there are too few points per column for any level (or x does not increase)
+int plot_lod_max_level(const csv_span_t *spans, int span_count, const plot_transform_t *transform) {
+    int count = 0;
+    for (int s = 0; s < span_count; s++) {
+        count += spans[s].count;
+    }
+    if (count < 2) {
+        return -1;
+    }
+
+    // Get the number of points per pixel column from the x extent of the points
+    const csv_span_t *newest = &spans[span_count - 1];
+    double width = (csv_data.x[newest->start + newest->count - 1] - csv_data.x[spans[0].start]) * transform->scale_x;
+    if (!(width > 0.0)) {
+        return -1;
+    }
+    double points_per_pixel = count / ((width > 1.0) ? width : 1.0);
+
+    int max_level = -1;
+    while (max_level + 1 < CSV_LOD_LEVELS && (1 << csv_lod_shift(max_level + 1)) <= points_per_pixel / 2) {
+        max_level++;
+    }
+    return max_level;
+}
+
+// A function to draw every channel of a snapshot as its own trace, from a point (counted from the oldest) to the newest
+// The native renderer draws straight into the pixels of raster with the rendering threads, cairo draws through cr
+// When clear is set the region (the raster clip rectangle) is first restored from the static layer
+void draw_traces(cairo_t *cr, const raster_target_t *raster, const csv_snapshot_t *snapshot, int first,
+                 const plot_transform_t *transform, int clear) {
+    // Get the rolling buffer contents from oldest to newest
+    csv_span_t spans[2];
+    int span_count = csv_data_get_spans(snapshot, spans);
+
+    // Skip the points before the first one
+    if (span_count == 2 && first >= spans[0].count) {
+        first -= spans[0].count;
+        spans[0] = spans[1];
+        span_count = 1;
+    }
+    spans[0].start += first;
+    spans[0].count -= first;
+
+    // Set the line width for the graph
+    cairo_set_line_width(cr, 2.0);
+
+    // Restore the region from the static layer, the native renderer does it for each tile instead
+    if (clear && config.renderer != RENDERER_NATIVE) {
+        cairo_surface_flush(cairo_get_target(cr));
+        static_layer_copy(raster->pixels, raster->clip_x0, raster->clip_y0, raster->clip_x1, raster->clip_y1);
+        cairo_surface_mark_dirty(cairo_get_target(cr));
+    }
+
+    // M4 reads whole pyramid blocks when there are enough points per pixel column, so the cost depends
+    // on the graph width instead of the number of points
+    int max_level = (config.decimation == PLOT_DECIMATION_M4) ? plot_lod_max_level(spans, span_count, transform) : -1;
+
+    // Draw each channel as its own trace
+    for (int c = 0; c < csv_data.channels; c++) {
+        // Describe the channel as the spans of the rolling buffer
+        plot_segment_t segments[2];
+        for (int s = 0; s < span_count; s++) {
+            segments[s].x = csv_data.x + spans[s].start;
+            segments[s].y = csv_data.y[c] + spans[s].start;
+            segments[s].count = spans[s].count;
+        }
+
+        // Reduce the channel to the points that affect the drawn pixels
+        uint64_t decimate_start = monotonic_ns();
+        TRACE_BEGIN("plot_decimate");
+        int count = (max_level >= 0) ? plot_decimate_lod(spans, span_count, c, max_level, transform)
+                                     : plot_decimate(segments, span_count, transform);
+        TRACE_END("plot_decimate");
+        uint64_t draw_start = monotonic_ns();
+        stats_add(&render_stats.decimate_ns, draw_start - decimate_start);
+
+        // Keep the trace for the native renderer, it is drawn once every channel is decimated
+        if (config.renderer == RENDERER_NATIVE) {
+            if (render_trace_store(c, count > 0 ? count : 0) == -1) {
+                render_traces[c].count = 0;
+            }
+            continue;
+        }
+        if (count <= 0) {
+            continue;
+        }
+
+        // Set the color of this channel
+        const double *color = trace_colors[c % TRACE_COLOR_COUNT];
+        cairo_set_source_rgb(cr, color[0], color[1], color[2]);
+
+        // Move to the oldest point and draw lines to each remaining point
+        cairo_move_to(cr, plot_points[0].x, plot_points[0].y);
+        for (int i = 1; i < count; i++) {
+            cairo_line_to(cr, plot_points[i].x, plot_points[i].y);
+        }
+
+        // Stroke the trace
+        TRACE_BEGIN("cairo_stroke");
+        cairo_stroke(cr);
+        TRACE_END("cairo_stroke");
+        stats_add(&render_stats.draw_ns, monotonic_ns() - draw_start);
+    }
 
-    return buffer;
+    // Render the traces natively with the rendering threads and tell cairo the pixels changed behind its back
+    if (config.renderer == RENDERER_NATIVE) {
+        uint64_t draw_start = monotonic_ns();
+        cairo_surface_flush(cairo_get_target(cr));
+        TRACE_BEGIN("render_frame");
+        render_frame(raster, clear);
+        TRACE_END("render_frame");
+        cairo_surface_mark_dirty(cairo_get_target(cr));
+        stats_add(&render_stats.draw_ns, monotonic_ns() - draw_start);
+    }
 }
 
-// A function to draw a graph on the shared memory buffer
-void draw_graph() {
-    if (shm_data == NULL) {
+// A function to draw a graph into the pixels of a shared memory buffer
+// The background and the texts come from the static layer, only the traces are drawn for each frame
+void draw_graph(void *pixels) {
+    // Make the static layer the size of the frame
+    if (static_layer_reserve(config.graph_width, config.graph_height) == -1) {
         return;
     }
 
     // Create a cairo surface from the shared memory
     int stride = config.graph_width * 4;
     cairo_surface_t *surface = cairo_image_surface_create_for_data(
-        shm_data, CAIRO_FORMAT_ARGB32, config.graph_width, config.graph_height, stride);
+        pixels, CAIRO_FORMAT_ARGB32, config.graph_width, config.graph_height, stride);
 
     // Create a cairo context from the surface
     cairo_t *cr = cairo_create(surface);
 
-    // Clear the surface with white color
-    cairo_set_source_rgb(cr, 1.0, 1.0, 1.0);
-    cairo_paint(cr);
+    // Move the samples published by the serial thread into the csv data (the renderer owns the csv data)
+    csv_data_drain();
 
-    // Lock the mutex before reading csv_data
-    pthread_mutex_lock(&csv_data_mutex);
+    // Take a consistent view of the csv data, the frame is drawn from the view only
+    csv_snapshot_t snapshot;
+    csv_data_snapshot(&snapshot);
+    latency_frame_begin();
 
     // Check if we have data to draw
-    if (csv_data_size > 0) {
-        // Set the line width and color for the graph
-        cairo_set_line_width(cr, 2.0);
-        cairo_set_source_rgb(cr, 1.0, 0.0, 0.0); // red
-
-        // Find the minimum and maximum x and y values in the csv data
-        double min_x = csv_data[0].x;
-        double max_x = csv_data[0].x;
-        double min_y = csv_data[0].y;
-        double max_y = csv_data[0].y;
-        
-        for (int i = 1; i < csv_data_size; i++) {
-            if (csv_data[i].x < min_x) min_x = csv_data[i].x;
-            if (csv_data[i].x > max_x) max_x = csv_data[i].x;
-            if (csv_data[i].y < min_y) min_y = csv_data[i].y;
-            if (csv_data[i].y > max_y) max_y = csv_data[i].y;
-        }
+    if (snapshot.count > 0) {
+        // Use the range maintained as points were added instead of scanning every point
+        double min_x = snapshot.range.min_x;
+        double max_x = snapshot.range.max_x;
+        double min_y = snapshot.range.min_y;
+        double max_y = snapshot.range.max_y;
 
         // Avoid division by zero
         if (max_x == min_x) max_x = min_x + 1.0;
@@ -537,96 +4228,252 @@ void draw_graph() {
         double scale_y = (config.graph_height - 2 * config.graph_margin) / (max_y - min_y);
         double offset_y = config.graph_height - config.graph_margin + min_y * scale_y; // Flip Y axis
 
-        // Move to the first point in the csv data
-        cairo_move_to(cr, 
-                     csv_data[0].x * scale_x + offset_x, 
-                     offset_y - csv_data[0].y * scale_y); // Flip Y
+        // Map csv values to window coordinates
+        plot_transform_t transform = { scale_x, offset_x, scale_y, offset_y };
+
+        // Update the labels, then copy the static layer and draw every channel over it
+        static_layer_set_labels(snapshot.count, min_x, max_x, min_y, max_y);
+        static_layer_set_stats();
+        raster_target_t raster = { pixels, config.graph_width, 0, 0, config.graph_width, config.graph_height, NULL };
+        draw_traces(cr, &raster, &snapshot, 0, &transform, 1);
+    } else {
+        // Show the waiting message from the static layer
+        static_layer_set_waiting();
+        static_layer_set_stats();
+        static_layer_copy(pixels, 0, 0, config.graph_width, config.graph_height);
+    }
+
+    // Destroy the cairo context
+    cairo_destroy(cr);
+    
+    // Destroy the cairo surface
+    cairo_surface_destroy(surface);
+}
+
+// A function to find the first point of a snapshot (counted from the oldest) whose x value is not less than a value
+// The x values are expected to be non-decreasing (e.g. timestamps)
+int csv_data_find_x(const csv_snapshot_t *snapshot, double value) {
+    csv_span_t spans[2];
+    csv_data_get_spans(snapshot, spans);
 
-        // Loop through the rest of the csv data and draw lines to each point
-        for (int i = 1; i < csv_data_size; i++) {
-            cairo_line_to(cr, 
-                         csv_data[i].x * scale_x + offset_x, 
-                         offset_y - csv_data[i].y * scale_y); // Flip Y
+    int low = 0;
+    int high = snapshot->count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        int index = (middle < spans[0].count) ? spans[0].start + middle : middle - spans[0].count;
+        if (csv_data.x[index] < value) {
+            low = middle + 1;
+        } else {
+            high = middle;
         }
+    }
+    return low;
+}
 
-        // Stroke the graph
-        cairo_stroke(cr);
-        
-        // Draw buffer status text
-        cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
-        cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-        cairo_set_font_size(cr, 14.0);
-        cairo_move_to(cr, 10, 20);
-        
-        char status_text[128];
-        snprintf(status_text, sizeof(status_text), "Points: %d / %d %s", 
-                 csv_data_size, csv_buffer_max_size,
-                 csv_data_size >= csv_buffer_max_size ? "(ROLLING)" : "");
-        cairo_show_text(cr, status_text);
-        
-        // Draw axis labels with min/max values
-        cairo_set_font_size(cr, 12.0);
-        char label[64];
-        
-        // X-axis min
-        snprintf(label, sizeof(label), "%.2f", min_x);
-        cairo_move_to(cr, config.graph_margin, config.graph_height - config.graph_margin + 20);
-        cairo_show_text(cr, label);
-        
-        // X-axis max
-        snprintf(label, sizeof(label), "%.2f", max_x);
-        cairo_move_to(cr, config.graph_width - config.graph_margin - 40, config.graph_height - config.graph_margin + 20);
-        cairo_show_text(cr, label);
-        
-        // Y-axis min
-        snprintf(label, sizeof(label), "%.2f", min_y);
-        cairo_move_to(cr, 5, config.graph_height - config.graph_margin);
-        cairo_show_text(cr, label);
-        
-        // Y-axis max
-        snprintf(label, sizeof(label), "%.2f", max_y);
-        cairo_move_to(cr, 5, config.graph_margin);
-        cairo_show_text(cr, label);
-        
-    } else {
-        // Draw "Waiting for data..." message
-        cairo_set_source_rgb(cr, 0.0, 0.0, 0.0);
-        cairo_select_font_face(cr, "Sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-        cairo_set_font_size(cr, 20.0);
-        cairo_move_to(cr, config.graph_width / 2 - 80, config.graph_height / 2);
-        cairo_show_text(cr, "Waiting for data...");
-        
-        // Show buffer size info
-        cairo_set_font_size(cr, 14.0);
-        cairo_move_to(cr, config.graph_width / 2 - 100, config.graph_height / 2 + 30);
-        char buffer_info[128];
-        snprintf(buffer_info, sizeof(buffer_info), "Buffer size: %d points", csv_buffer_max_size);
-        cairo_show_text(cr, buffer_info);
+// A function to shift the plot area of a buffer left by a number of pixels
+void scroll_shift_pixels(void *pixels, int shift) {
+    int stride = config.graph_width * 4;
+    int plot_width = config.graph_width - 2 * config.graph_margin;
+    for (int row = config.graph_margin; row < config.graph_height - config.graph_margin; row++) {
+        char *line = (char *)pixels + (size_t)row * stride + config.graph_margin * 4;
+        memmove(line, line + shift * 4, (size_t)(plot_width - shift) * 4);
+    }
+}
+
+// A function to draw a scrolling strip chart into a buffer, showing the last config.scroll_span x units
+// The previous frame held by the buffer is shifted by the number of pixel columns the newest point moved
+// and only the newly exposed strip is drawn, so the cost follows the new data instead of the window area
+// Pixel columns are counted on a fixed grid (x * scale_x), so shifts are whole pixels and old pixels stay exact
+// Returns the number of damaged rectangles stored in damage (at most 2)
+int draw_graph_scroll(shm_buffer_t *target, damage_rect_t *damage) {
+    int plot_width = config.graph_width - 2 * config.graph_margin;
+    int plot_height = config.graph_height - 2 * config.graph_margin;
+
+    // Move the samples published by the serial thread into the csv data (the renderer owns the csv data)
+    csv_data_drain();
+
+    // Take a consistent view of the csv data, the frame is drawn from the view only
+    csv_snapshot_t snapshot;
+    csv_data_snapshot(&snapshot);
+
+    // Draw the waiting message with the normal renderer, which starts the latency frame itself
+    if (snapshot.count == 0 || static_layer_reserve(config.graph_width, config.graph_height) == -1) {
+        draw_graph(target->data);
+        target->scroll_valid = 0;
+        damage[0] = (damage_rect_t){ 0, 0, config.graph_width, config.graph_height };
+        return 1;
+    }
+    latency_frame_begin();
+
+    // Get the pixel column of the newest point, the plot area ends just right of it
+    csv_span_t spans[2];
+    int span_count = csv_data_get_spans(&snapshot, spans);
+    double scale_x = plot_width / config.scroll_span;
+    long last_column = plot_column(csv_data.x[spans[span_count - 1].start + spans[span_count - 1].count - 1] * scale_x);
+    long left = last_column + 1 - plot_width;
+
+    // Grow the sticky y range with some headroom when the data leaves it, the y scale never shrinks
+    if (!scroll_y_valid || snapshot.range.min_y < scroll_min_y || snapshot.range.max_y > scroll_max_y) {
+        double headroom = (snapshot.range.max_y - snapshot.range.min_y) * 0.1;
+        if (headroom == 0.0) headroom = 1.0;
+        if (!scroll_y_valid || snapshot.range.min_y < scroll_min_y) scroll_min_y = snapshot.range.min_y - headroom;
+        if (!scroll_y_valid || snapshot.range.max_y > scroll_max_y) scroll_max_y = snapshot.range.max_y + headroom;
+        scroll_y_valid = 1;
+        scroll_y_generation++;
+    }
+
+    // Shift the previous frame of this buffer, or draw the whole plot area when it cannot be reused
+    long shift = last_column - target->scroll_last_column;
+    int full = !target->scroll_valid || target->scroll_y_generation != scroll_y_generation ||
+               shift < 0 || shift >= plot_width;
+    long strip_left = left;
+    if (!full) {
+        if (shift > 0) {
+            scroll_shift_pixels(target->data, shift);
+        }
+
+        // Redraw from the newest point of the previous frame so the line joining it to the new points is complete
+        strip_left = target->scroll_last_column - 2;
+        if (strip_left < left) strip_left = left;
     }
+    int strip_x = config.graph_margin + (int)(strip_left - left);
+    int strip_width = config.graph_margin + plot_width - strip_x;
+
+    // Create a cairo surface from the shared memory
+    int stride = config.graph_width * 4;
+    cairo_surface_t *surface = cairo_image_surface_create_for_data(
+        target->data, CAIRO_FORMAT_ARGB32, config.graph_width, config.graph_height, stride);
+
+    // Create a cairo context from the surface
+    cairo_t *cr = cairo_create(surface);
+
+    // Keep the traces inside the strip
+    cairo_rectangle(cr, strip_x, config.graph_margin, strip_width, plot_height);
+    cairo_clip(cr);
+
+    // Calculate the scale and offset factors, pixel column left is the left edge of the plot area
+    double scale_y = plot_height / (scroll_max_y - scroll_min_y);
+    plot_transform_t transform = {
+        scale_x,
+        config.graph_margin - (double)left,
+        scale_y,
+        config.graph_height - config.graph_margin + scroll_min_y * scale_y // Flip Y axis
+    };
 
-    // Unlock the mutex
-    pthread_mutex_unlock(&csv_data_mutex);
+    // Clear the strip and draw the traces from the last point before the strip to the newest point
+    int first = csv_data_find_x(&snapshot, strip_left / scale_x) - 1;
+    if (first < 0) first = 0;
+    raster_target_t raster = { target->data, config.graph_width, strip_x, config.graph_margin,
+                               strip_x + strip_width, config.graph_margin + plot_height, NULL };
+    draw_traces(cr, &raster, &snapshot, first, &transform, 1);
 
     // Destroy the cairo context
     cairo_destroy(cr);
-    
+
     // Destroy the cairo surface
     cairo_surface_destroy(surface);
+
+    // Copy the margins from the static layer, only the status line changes when the plot did not move
+    static_layer_set_labels(snapshot.count, left / scale_x, (left + plot_width) / scale_x, scroll_min_y, scroll_max_y);
+    static_layer_set_stats();
+    int moved = full || shift > 0;
+    uint32_t *pixels = target->data;
+    static_layer_copy(pixels, 0, 0, config.graph_width, config.graph_margin);
+    if (moved) {
+        static_layer_copy(pixels, 0, config.graph_height - config.graph_margin, config.graph_width, config.graph_height);
+        static_layer_copy(pixels, 0, config.graph_margin, config.graph_margin, config.graph_height - config.graph_margin);
+        static_layer_copy(pixels, config.graph_margin + plot_width, config.graph_margin,
+                          config.graph_width, config.graph_height - config.graph_margin);
+    }
+
+    // Remember what the buffer holds so the next frame drawn into it can shift it
+    target->scroll_valid = 1;
+    target->scroll_last_column = last_column;
+    target->scroll_y_generation = scroll_y_generation;
+
+    // Damage the whole surface when the pixels moved, or only the strip and the status line
+    if (moved) {
+        damage[0] = (damage_rect_t){ 0, 0, config.graph_width, config.graph_height };
+        return 1;
+    }
+    damage[0] = (damage_rect_t){ strip_x, config.graph_margin, strip_width, plot_height };
+    damage[1] = (damage_rect_t){ 0, 0, config.graph_width, config.graph_margin };
+    return 2;
+}
+
+// A function to draw a frame into a buffer, only the changed part in scroll mode
+// Both the wayland and the headless backends draw through it
+// Returns the number of damaged rectangles stored in damage (at most 2)
+int draw_frame(shm_buffer_t *target, damage_rect_t *damage) {
+    uint64_t start = monotonic_ns();
+    int damage_count;
+    TRACE_BEGIN("draw_frame");
+
+    if (config.scroll_span > 0.0) {
+        damage_count = draw_graph_scroll(target, damage);
+    } else {
+        draw_graph(target->data);
+        target->scroll_valid = 0;
+        damage[0] = (damage_rect_t){ 0, 0, config.graph_width, config.graph_height };
+        damage_count = 1;
+    }
+
+    TRACE_END("draw_frame");
+    stats_add(&render_stats.frame_ns, monotonic_ns() - start);
+    stats_add(&render_stats.frames, 1);
+    return damage_count;
 }
 
 // A function to update the wayland surface with the graph
 void update_surface() {
-    // Draw the graph on the shared memory
-    draw_graph();
+    // Skip the frame when the compositor still holds every buffer, the next frame draws the latest data
+    shm_buffer_t *target = get_free_buffer();
+    if (target == NULL) {
+        stats_add(&render_stats.frames_skipped, 1);
+        return;
+    }
+
+    // Draw the graph into the free buffer
+    damage_rect_t damage[2];
+    int damage_count = draw_frame(target, damage);
+
+    // Attach the buffer and damage the changed part of the surface to request a redraw
+    wl_surface_attach(surface, target->buffer, 0, 0);
+    for (int i = 0; i < damage_count; i++) {
+        if (wl_surface_get_version(surface) >= 4) {
+            wl_surface_damage_buffer(surface, damage[i].x, damage[i].y, damage[i].width, damage[i].height);
+        } else {
+            wl_surface_damage(surface, damage[i].x, damage[i].y, damage[i].width, damage[i].height);
+        }
+    }
 
-    // Damage the entire surface to request a redraw
-    wl_surface_damage(surface, 0, 0, config.graph_width, config.graph_height);
+    // Ask the compositor when to draw the next frame, frames follow the display rate
+    struct wl_callback *callback = wl_surface_frame(surface);
+    wl_callback_add_listener(callback, &frame_listener, NULL);
+    frame_pending = 1;
+    redraw_needed = 0;
 
-    // Commit the wayland surface
+    // Ask when the frame reaches the screen to measure the presented latency of its samples
+    presentation_request();
+
+    // Commit the wayland surface, the buffer is held by the compositor until it is released
+    TRACE_BEGIN("wl_surface_commit");
     wl_surface_commit(surface);
+    TRACE_END("wl_surface_commit");
+    latency_frame_commit();
+    target->busy = 1;
+
+    // Count the buffers the compositor holds now
+    unsigned long busy = 0;
+    for (int i = 0; i < SHM_BUFFER_COUNT; i++) {
+        busy += shm_buffers[i].busy;
+    }
+    atomic_store_explicit(&render_stats.buffers_busy, busy, memory_order_relaxed);
 
     // Flush the display
+    TRACE_BEGIN("wl_display_flush");
     wl_display_flush(display);
+    TRACE_END("wl_display_flush");
 }
 
 // A function to initialize the wayland display and surface
@@ -651,8 +4498,8 @@ int wayland_init() {
     // Roundtrip the display to get the global objects
     wl_display_roundtrip(display);
 
-    // Check if the compositor, shell, and shm are available
-    if (compositor == NULL || shell == NULL || shm == NULL) {
+    // Check if the compositor, a shell, and shm are available
+    if (compositor == NULL || (wm_base == NULL && shell == NULL) || shm == NULL) {
         fprintf(stderr, "Missing wayland global objects\n");
         return -1;
     }
@@ -664,31 +4511,58 @@ int wayland_init() {
         return -1;
     }
 
-    // Create a wayland shell surface from the shell and the surface
-    shell_surface = wl_shell_get_shell_surface(shell, surface);
-    if (shell_surface == NULL) {
-        fprintf(stderr, "Failed to create the wayland shell surface\n");
-        return -1;
-    }
+    // Make the surface a toplevel window with the xdg shell, or with the wayland shell on older compositors
+    if (wm_base != NULL) {
+        // Create an xdg surface and an xdg toplevel from the surface
+        xdg_surface = xdg_wm_base_get_xdg_surface(wm_base, surface);
+        if (xdg_surface == NULL) {
+            fprintf(stderr, "Failed to create the xdg surface\n");
+            return -1;
+        }
+        xdg_surface_add_listener(xdg_surface, &xdg_surface_listener, NULL);
+        xdg_toplevel = xdg_surface_get_toplevel(xdg_surface);
+        if (xdg_toplevel == NULL) {
+            fprintf(stderr, "Failed to create the xdg toplevel\n");
+            return -1;
+        }
+        xdg_toplevel_add_listener(xdg_toplevel, &xdg_toplevel_listener, NULL);
 
-    // Add the shell surface listener callbacks
-    wl_shell_surface_add_listener(shell_surface, &shell_surface_listener, NULL);
+        // Set the toplevel title and the smallest size that leaves a plot area
+        xdg_toplevel_set_title(xdg_toplevel, "Serial CSV Graph");
+        xdg_toplevel_set_min_size(xdg_toplevel, 2 * config.graph_margin + WINDOW_MIN_PLOT_SIZE, 2 * config.graph_margin + WINDOW_MIN_PLOT_SIZE);
 
-    // Set the shell surface title
-    wl_shell_surface_set_title(shell_surface, "Serial CSV Graph");
+        // Commit the surface without a buffer and wait for the first configure event
+        wl_surface_commit(surface);
+        while (!configured) {
+            if (wl_display_dispatch(display) == -1) {
+                fprintf(stderr, "Failed to configure the xdg surface\n");
+                return -1;
+            }
+        }
+    } else {
+        // Create a wayland shell surface from the shell and the surface
+        shell_surface = wl_shell_get_shell_surface(shell, surface);
+        if (shell_surface == NULL) {
+            fprintf(stderr, "Failed to create the wayland shell surface\n");
+            return -1;
+        }
 
-    // Set the shell surface role as a toplevel window
-    wl_shell_surface_set_toplevel(shell_surface);
+        // Add the shell surface listener callbacks
+        wl_shell_surface_add_listener(shell_surface, &shell_surface_listener, NULL);
 
-    // Create the buffer
-    buffer = create_buffer();
-    if (buffer == NULL) {
-        fprintf(stderr, "Failed to create buffer\n");
-        return -1;
+        // Set the shell surface title
+        wl_shell_surface_set_title(shell_surface, "Serial CSV Graph");
+
+        // Set the shell surface role as a toplevel window
+        wl_shell_surface_set_toplevel(shell_surface);
+        configured = 1;
     }
 
-    // Attach the buffer to the surface
-    wl_surface_attach(surface, buffer, 0, 0);
+    // Create the shared memory pool for the first size, the buffers are carved from it when drawn into
+    if (shm_pool_grow((size_t)config.graph_width * 4 * config.graph_height) == -1) {
+        fprintf(stderr, "Failed to create buffers\n");
+        return -1;
+    }
 
     // Update the wayland surface with the graph
     update_surface();
@@ -698,9 +4572,19 @@ int wayland_init() {
 
 // A function to clean up the wayland display and surface
 void wayland_cleanup() {
+    // Destroy the wayland buffers and the pool they were carved from
+    for (int i = 0; i < SHM_BUFFER_COUNT; i++) {
+        if (shm_buffers[i].buffer != NULL) {
+            wl_buffer_destroy(shm_buffers[i].buffer);
+        }
+    }
+    if (shm_pool != NULL) {
+        wl_shm_pool_destroy(shm_pool);
+    }
+
     // Unmap shared memory
-    if (shm_data != NULL && shm_data != MAP_FAILED) {
-        munmap(shm_data, config.graph_width * config.graph_height * 4);
+    if (shm_data != NULL) {
+        munmap(shm_data, shm_size);
     }
 
     // Close shared memory fd
@@ -708,12 +4592,13 @@ void wayland_cleanup() {
         close(shm_fd);
     }
 
-    // Destroy the wayland buffer
-    if (buffer != NULL) {
-        wl_buffer_destroy(buffer);
+    // Destroy the xdg toplevel and surface, or the wayland shell surface
+    if (xdg_toplevel != NULL) {
+        xdg_toplevel_destroy(xdg_toplevel);
+    }
+    if (xdg_surface != NULL) {
+        xdg_surface_destroy(xdg_surface);
     }
-
-    // Destroy the wayland shell surface
     if (shell_surface != NULL) {
         wl_shell_surface_destroy(shell_surface);
     }
@@ -728,7 +4613,15 @@ void wayland_cleanup() {
         wl_shm_destroy(shm);
     }
 
-    // Destroy the wayland shell
+    // Destroy the presentation time interface
+    if (presentation != NULL) {
+        wp_presentation_destroy(presentation);
+    }
+
+    // Destroy the xdg shell and the wayland shell
+    if (wm_base != NULL) {
+        xdg_wm_base_destroy(wm_base);
+    }
     if (shell != NULL) {
         wl_shell_destroy(shell);
     }
@@ -748,9 +4641,32 @@ void wayland_cleanup() {
         wl_display_disconnect(display);
     }
 
-    // Free the global csv data array
-    if (csv_data != NULL) {
-        free(csv_data);
+    // Free the global csv data columns
+    csv_data_free();
+
+    // Free the decimation output buffer
+    free(plot_points);
+    plot_points = NULL;
+    plot_points_capacity = 0;
+
+    // Stop the rendering threads and free the spans and traces of the native renderer
+    render_pool_stop();
+    for (int i = 0; i < RENDER_MAX_THREADS; i++) {
+        free(raster_spans[i].top);
+        free(raster_spans[i].bottom);
+    }
+    memset(raster_spans, 0, sizeof(raster_spans));
+    for (int c = 0; c < CSV_MAX_CHANNELS; c++) {
+        free(render_traces[c].points);
+    }
+    memset(render_traces, 0, sizeof(render_traces));
+
+    // Free the static layer and the glyph atlases
+    free(static_layer.pixels);
+    memset(&static_layer, 0, sizeof(static_layer));
+    for (int f = 0; f < GLYPH_FONT_COUNT; f++) {
+        free(glyph_atlases[f].alpha);
+        glyph_atlases[f].alpha = NULL;
     }
     
     // Free config strings
@@ -759,6 +4675,353 @@ void wayland_cleanup() {
     }
 }
 
+// A function to run the wayland main loop until the user closes the window
+// It sleeps on the wayland display and on the data eventfd, and only draws when something changed
+int wayland_run() {
+    printf("Graph window opened. Send CSV data in format: x,y1[,y2,...]\\n\n");
+
+    // Poll the wayland display and the data eventfd
+    struct pollfd fds[2];
+    fds[0].fd = wl_display_get_fd(display);
+    fds[0].events = POLLIN;
+    fds[1].fd = data_event_fd;
+    fds[1].events = POLLIN;
+
+    // Loop until the user closes the window
+    while (!window_closed) {
+        // Draw a frame when the graph changed and the compositor is ready for one
+        if (redraw_needed && !frame_pending) {
+            update_surface();
+        }
+
+        // Dispatch queued events, then flush requests and prepare to read new events
+        while (wl_display_prepare_read(display) != 0) {
+            wl_display_dispatch_pending(display);
+        }
+        TRACE_BEGIN("wl_display_flush");
+        wl_display_flush(display);
+        TRACE_END("wl_display_flush");
+
+        // Sleep until the compositor or the serial thread has something, without a timeout
+        if (poll(fds, 2, -1) == -1) {
+            wl_display_cancel_read(display);
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            break;
+        }
+
+        // Read and dispatch the wayland events
+        if (fds[0].revents & POLLIN) {
+            if (wl_display_read_events(display) == -1) {
+                break;
+            }
+        } else {
+            wl_display_cancel_read(display);
+        }
+        if (fds[0].revents & (POLLERR | POLLHUP)) {
+            break;
+        }
+        if (wl_display_dispatch_pending(display) == -1) {
+            break;
+        }
+
+        // Move new samples into the csv data right away, so the queue keeps draining while the window is hidden
+        if (fds[1].revents & POLLIN) {
+            data_event_clear();
+            if (csv_data_drain() > 0 || stats_overlay != stats_overlay_shown) {
+                redraw_needed = 1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// A global flag set by SIGINT or SIGTERM to end the headless loop
+volatile sig_atomic_t headless_stop = 0;
+
+// A function to handle SIGINT and SIGTERM in headless mode
+// The signal may be delivered to any thread, so the main loop is woken in case it waits for data
+void headless_signal(int signal_number) {
+    // Keep errno for the code the signal interrupted, the main loop checks it after poll
+    int saved_errno = errno;
+    headless_stop = 1;
+    data_event_signal_safe();
+    errno = saved_errno;
+}
+
+// A function to write a headless frame to the dump path, as PNG when the path ends in .png or as raw
+// ARGB8888 pixels (width * height * 4 bytes, native byte order) otherwise
+int headless_dump(const shm_buffer_t *frame, long number) {
+    // Put the dump number into the path
+    char path[4096];
+    snprintf(path, sizeof(path), config.dump_path, (int)number);
+
+    size_t length = strlen(path);
+    if (length >= 4 && strcmp(path + length - 4, ".png") == 0) {
+        // Write the frame as PNG with cairo
+        cairo_surface_t *surface = cairo_image_surface_create_for_data(
+            frame->data, CAIRO_FORMAT_ARGB32, frame->width, frame->height, frame->width * 4);
+        cairo_status_t status = cairo_surface_write_to_png(surface, path);
+        cairo_surface_destroy(surface);
+        if (status != CAIRO_STATUS_SUCCESS) {
+            fprintf(stderr, "Failed to write %s\n", path);
+            return -1;
+        }
+    } else {
+        // Write the raw pixels
+        FILE *file = fopen(path, "wb");
+        if (file == NULL) {
+            perror("fopen");
+            return -1;
+        }
+        size_t size = (size_t)frame->width * frame->height * 4;
+        if (fwrite(frame->data, 1, size, file) != size) {
+            perror("fwrite");
+            fclose(file);
+            return -1;
+        }
+        if (fclose(file) != 0) {
+            perror("fclose");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// A function to run without a wayland connection, frames are drawn into memory by draw_frame
+// With a frame limit, frames are drawn back to back as fast as possible and the frame rate is reported,
+// otherwise a frame is drawn whenever new data arrives, until SIGINT or SIGTERM
+int headless_run() {
+    // Allocate a frame with the layout of a wayland buffer
+    shm_buffer_t frame = { 0 };
+    frame.width = config.graph_width;
+    frame.height = config.graph_height;
+    frame.data = malloc((size_t)frame.width * frame.height * 4);
+    if (frame.data == NULL) {
+        perror("malloc");
+        return -1;
+    }
+
+    // Stop on SIGINT or SIGTERM
+    signal(SIGINT, headless_signal);
+    signal(SIGTERM, headless_signal);
+
+    struct pollfd fds[1];
+    fds[0].fd = data_event_fd;
+    fds[0].events = POLLIN;
+
+    uint64_t interval = (uint64_t)config.dump_interval * 1000000u;
+    uint64_t start = monotonic_ns();
+    uint64_t next_dump = start + interval;
+    long frames = 0;
+    long dumps = 0;
+    int result = 0;
+
+    // Loop until the frame limit or a signal
+    while (!headless_stop && (config.frame_limit == 0 || frames < config.frame_limit)) {
+        // Draw a frame when the graph changed, or every time when drawing as fast as possible
+        if (redraw_needed || config.frame_limit > 0) {
+            damage_rect_t damage[2];
+            draw_frame(&frame, damage);
+            latency_frame_commit();
+            redraw_needed = 0;
+            frames++;
+        }
+
+        // Write the frame when the dump interval elapsed
+        uint64_t now = monotonic_ns();
+        if (config.dump_path != NULL && interval > 0 && now >= next_dump) {
+            TRACE_BEGIN("headless_dump");
+            int dumped = headless_dump(&frame, dumps++);
+            TRACE_END("headless_dump");
+            if (dumped == -1) {
+                result = -1;
+                break;
+            }
+            next_dump = now + interval;
+        }
+
+        // Wait for new data, for the next dump, or not at all when drawing as fast as possible
+        int timeout = -1;
+        if (config.frame_limit > 0) {
+            timeout = 0;
+        } else if (config.dump_path != NULL && interval > 0) {
+            timeout = (int)((next_dump - now + 999999u) / 1000000u);
+        }
+        if (poll(fds, 1, timeout) == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("poll");
+            result = -1;
+            break;
+        }
+
+        // Move new samples into the csv data
+        if (fds[0].revents & POLLIN) {
+            data_event_clear();
+            if (csv_data_drain() > 0 || stats_overlay != stats_overlay_shown) {
+                redraw_needed = 1;
+            }
+        }
+    }
+
+    // Report the frame rate
+    double seconds = (monotonic_ns() - start) * 1e-9;
+    printf("Headless: %ld frames in %.3f s (%.1f frames/s)\n", frames, seconds, seconds > 0.0 ? frames / seconds : 0.0);
+
+    // Write the last frame on exit
+    if (config.dump_path != NULL && result == 0 && headless_dump(&frame, dumps) == -1) {
+        result = -1;
+    }
+
+    free(frame.data);
+    return result;
+}
+
+// A function to handle SIGUSR1: toggle the statistics overlay and wake the main loop to redraw
+void stats_overlay_signal(int signal_number) {
+    // Keep errno for the code the signal interrupted, the main loop checks it after poll
+    int saved_errno = errno;
+    stats_overlay = !stats_overlay;
+    data_event_signal_safe();
+    errno = saved_errno;
+}
+
+// A global variable to store the statistics file, or the listening socket when the path starts with unix:
+int stats_fd = -1;
+
+// A global variable to store the clients connected to the statistics socket, -1 for a free entry
+int stats_clients[STATS_MAX_CLIENTS];
+
+// A function to open the statistics file for appending, or to create the statistics socket
+int stats_init() {
+    for (int i = 0; i < STATS_MAX_CLIENTS; i++) {
+        stats_clients[i] = -1;
+    }
+
+    // Append to a file
+    if (strncmp(config.stats_path, "unix:", 5) != 0) {
+        stats_fd = open(config.stats_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (stats_fd == -1) {
+            perror("open");
+            return -1;
+        }
+        return 0;
+    }
+
+    // Listen on a unix socket, replacing a socket left over by a previous run
+    struct sockaddr_un address = { .sun_family = AF_UNIX };
+    const char *socket_path = config.stats_path + 5;
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Statistics socket path is too long\n");
+        return -1;
+    }
+    strcpy(address.sun_path, socket_path);
+    stats_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (stats_fd == -1) {
+        perror("socket");
+        return -1;
+    }
+    unlink(socket_path);
+    if (bind(stats_fd, (struct sockaddr *)&address, sizeof(address)) == -1) {
+        perror("bind");
+        return -1;
+    }
+    if (listen(stats_fd, STATS_MAX_CLIENTS) == -1) {
+        perror("listen");
+        return -1;
+    }
+
+    return 0;
+}
+
+// A function to write the statistics every interval in a separate thread, until the thread is canceled
+// A file gets one line per interval, every client connected to the socket gets the same line
+void *stats_thread(void *arg) {
+    int is_socket = (strncmp(config.stats_path, "unix:", 5) == 0);
+    uint64_t interval = (uint64_t)config.stats_interval * 1000000u;
+    stats_values_t previous, now;
+    stats_read(&previous);
+    uint64_t next = previous.time_ns + interval;
+    char line[STATS_LINE_SIZE];
+
+    while (1) {
+        // Wait for the next interval, accepting clients meanwhile
+        uint64_t time_ns = monotonic_ns();
+        if (time_ns < next) {
+            struct pollfd pfd = { .fd = stats_fd, .events = POLLIN };
+            int timeout = (int)((next - time_ns + 999999u) / 1000000u);
+            if (is_socket && poll(&pfd, 1, timeout) > 0) {
+                int client = accept(stats_fd, NULL, NULL);
+                if (client >= 0) {
+                    fcntl(client, F_SETFL, O_NONBLOCK);
+                    fcntl(client, F_SETFD, FD_CLOEXEC);
+                }
+                for (int i = 0; client >= 0 && i < STATS_MAX_CLIENTS; i++) {
+                    if (stats_clients[i] == -1) {
+                        stats_clients[i] = client;
+                        client = -1;
+                    }
+                }
+                if (client >= 0) {
+                    close(client);
+                }
+            } else if (!is_socket) {
+                struct timespec delay = { timeout / 1000, (timeout % 1000) * 1000000L };
+                nanosleep(&delay, NULL);
+            }
+            continue;
+        }
+        next += interval;
+        if (next < time_ns) {
+            next = time_ns + interval;
+        }
+
+        // Format the counters and write them out
+        stats_read(&now);
+        int length = stats_format(line, sizeof(line), &now, &previous);
+        if (length >= (int)sizeof(line)) {
+            length = sizeof(line) - 1;
+        }
+        previous = now;
+        if (!is_socket) {
+            if (write(stats_fd, line, length) == -1) {
+                perror("write");
+            }
+            continue;
+        }
+        for (int i = 0; i < STATS_MAX_CLIENTS; i++) {
+            // Disconnect clients that went away or do not keep up
+            if (stats_clients[i] >= 0 && send(stats_clients[i], line, length, MSG_NOSIGNAL | MSG_DONTWAIT) != length) {
+                close(stats_clients[i]);
+                stats_clients[i] = -1;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// A function to close the statistics file or socket and its clients
+void stats_cleanup() {
+    for (int i = 0; i < STATS_MAX_CLIENTS; i++) {
+        if (stats_clients[i] >= 0) {
+            close(stats_clients[i]);
+        }
+    }
+    if (stats_fd >= 0) {
+        close(stats_fd);
+    }
+    if (strncmp(config.stats_path, "unix:", 5) == 0) {
+        unlink(config.stats_path + 5);
+    }
+}
+
 // The main function
 int main(int argc, char *argv[]) {
     // Parse command line arguments
@@ -770,29 +5033,72 @@ int main(int argc, char *argv[]) {
     printf("Starting Serial CSV Grapher\n");
     printf("Configuration:\n");
     printf("  Serial Port: %s\n", config.serial_port);
-    printf("  Baud Rate: %d\n", 
-           config.baud_rate == B9600 ? 9600 :
-           config.baud_rate == B19200 ? 19200 :
-           config.baud_rate == B38400 ? 38400 :
-           config.baud_rate == B57600 ? 57600 :
-           config.baud_rate == B115200 ? 115200 : 0);
+    printf("  Baud Rate: %d\n", config.baud_rate);
     printf("  Buffer Size: %d points (rolling)\n", config.csv_buffer_size);
     printf("  Graph Size: %dx%d pixels\n", config.graph_width, config.graph_height);
     printf("  Graph Margin: %d pixels\n", config.graph_margin);
+    printf("  Decimation: %s\n",
+           config.decimation == PLOT_DECIMATION_M4 ? "m4" :
+           config.decimation == PLOT_DECIMATION_LTTB ? "lttb" : "none");
+    if (config.scroll_span > 0.0) {
+        printf("  Scroll: last %g x units\n", config.scroll_span);
+    }
+    printf("  Renderer: %s", config.renderer == RENDERER_NATIVE ? "native" : "cairo");
+    if (config.renderer == RENDERER_NATIVE) {
+        printf(" (%d threads)", config.render_threads);
+    }
+    printf("\n");
+    if (config.headless) {
+        printf("  Backend: headless");
+        if (config.frame_limit > 0) {
+            printf(", %ld frames", config.frame_limit);
+        }
+        if (config.dump_path != NULL) {
+            printf(", dump to %s", config.dump_path);
+            if (config.dump_interval > 0) {
+                printf(" every %d ms", config.dump_interval);
+            }
+        }
+        printf("\n");
+    }
+    if (config.stats_path != NULL) {
+        printf("  Statistics: %s every %d ms (%s)\n", config.stats_path, config.stats_interval,
+               config.stats_line_protocol ? "line protocol" : "json");
+    }
+    if (config.trace_path != NULL) {
+        printf("  Trace: %s\n", config.trace_path);
+    }
     printf("\n");
 
     // Initialize the serial port
     if (serial_init() == -1) {
         fprintf(stderr, "Failed to initialize the serial port\n");
         // Continue anyway - we can still test the display
+        if (serial_fd >= 0) {
+            close(serial_fd);
+            serial_fd = -1;
+        }
     }
 
-    // Initialize the wayland display and surface
-    if (wayland_init() == -1) {
+    // Initialize the wayland display and surface, the headless backend needs neither
+    if (!config.headless && wayland_init() == -1) {
         fprintf(stderr, "Failed to initialize the wayland display and surface\n");
         return -1;
     }
 
+    // Create the eventfd the serial thread uses to wake the main loop
+    data_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (data_event_fd == -1) {
+        perror("eventfd");
+        return -1;
+    }
+
+    // Start the rendering threads of the native renderer
+    if (config.renderer == RENDERER_NATIVE && render_pool_start(config.render_threads) == -1) {
+        fprintf(stderr, "Failed to start the rendering threads\n");
+        return -1;
+    }
+
     // Create a pthread for reading and parsing csv data from the serial port
     pthread_t thread;
     if (serial_fd >= 0) {
@@ -803,33 +5109,92 @@ int main(int argc, char *argv[]) {
         printf("Serial reader thread started\n");
     }
 
-    printf("Graph window opened. Send CSV data in format: x,y\\n\n");
+    // Toggle the statistics overlay on SIGUSR1
+    signal(SIGUSR1, stats_overlay_signal);
 
-    // Loop until the user closes the window
-    while (wl_display_dispatch(display) != -1) {
-        // Update the wayland surface with the graph
-        update_surface();
-        
-        // Small delay to avoid excessive CPU usage
-        usleep(50000); // 50ms = ~20 FPS
+    // Create a pthread for writing the statistics
+    pthread_t stats_writer;
+    if (config.stats_path != NULL) {
+        if (stats_init() == -1) {
+            fprintf(stderr, "Failed to open %s for the statistics\n", config.stats_path);
+            return -1;
+        }
+        if (pthread_create(&stats_writer, NULL, stats_thread, NULL) != 0) {
+            perror("pthread_create");
+            return -1;
+        }
     }
 
+    // Draw until the window is closed, or into memory with the headless backend
+    TRACE_THREAD("main");
+    int result = config.headless ? headless_run() : wayland_run();
+
     // Cancel and join the pthread if it was created
     if (serial_fd >= 0) {
         pthread_cancel(thread);
         pthread_join(thread, NULL);
     }
 
+    // Cancel and join the statistics thread, then close its file or socket
+    if (config.stats_path != NULL) {
+        pthread_cancel(stats_writer);
+        pthread_join(stats_writer, NULL);
+        stats_cleanup();
+    }
+
+    // Report the total number of dropped samples, the running count is only printed every 1000 drops
+    unsigned long dropped = atomic_load(&serial_stats.samples_dropped);
+    if (dropped > 0) {
+        fprintf(stderr, "Sample queue full, dropped %lu samples\n", dropped);
+    }
+
+    // Report the bytes the serial port lost, overruns mean the host did not keep up with the device
+    if (serial_fd >= 0) {
+        serial_icount_update();
+    }
+    unsigned long overruns = atomic_load(&serial_stats.overruns) + atomic_load(&serial_stats.buffer_overruns);
+    unsigned long line_errors = atomic_load(&serial_stats.frame_errors) + atomic_load(&serial_stats.parity_errors);
+    if (overruns > 0 || line_errors > 0) {
+        fprintf(stderr, "Serial port: %lu bytes lost to overruns (host side), %lu framing or parity errors\n",
+                overruns, line_errors);
+    }
+
+    // Report the binary packets that were rejected or never arrived
+    unsigned long packet_errors = atomic_load(&serial_stats.packet_errors);
+    unsigned long packets_dropped = atomic_load(&serial_stats.packets_dropped);
+    unsigned long packet_resyncs = atomic_load(&serial_stats.packet_resyncs);
+    if (packet_errors > 0 || packets_dropped > 0 || packet_resyncs > 0) {
+        fprintf(stderr, "Binary input: %lu packets rejected, %lu missing from the sequence, %lu resyncs\n",
+                packet_errors, packets_dropped, packet_resyncs);
+    }
+
+    // Report the latency of every stage
+    latency_report(stderr);
+
     // Clean up the wayland display and surface
     wayland_cleanup();
 
-    // Close the serial port
+    // Close the serial port and free its read buffer
     if (serial_fd >= 0) {
         close(serial_fd);
     }
+    free(serial_reader.data);
+
+    // Close the data eventfd
+    close(data_event_fd);
+
+    // Write the trace now that every other thread has stopped
+    if (config.trace_path != NULL && trace_write() == -1) {
+        result = -1;
+    }
+
+    // Free the dump and statistics paths
+    free(config.dump_path);
+    free(config.stats_path);
+    free(config.trace_path);
 
     printf("Program exited cleanly\n");
 
-    // Exit the program with success
-    return 0;
+    // Exit the program with success, or with failure when the loop ended on an error
+    return (result == 0) ? 0 : 1;
 }
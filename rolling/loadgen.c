@@ -0,0 +1,871 @@
+// A load generator and soak harness for the rolling plotter: it creates a pseudo-terminal pair, starts the plotter
+// on the slave side with --port and writes csv lines into the master side at a configurable rate.
+// Lines can also be sent as COBS or SLIP framed binary packets (one sample per packet) to load the packet decoder.
+// It reports the sustained line rate, the lines the plotter rejected or dropped and the plotter's CPU and RSS over time.
+
+#define _GNU_SOURCE // posix_openpt, grantpt, unlockpt and ptsname
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <termios.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define LOADGEN_MAX_CHANNELS 32 // Maximum number of y channels per line (the plotter's limit)
+#define LOADGEN_LINE_SIZE 4096 // Size of the line buffer, large enough for an overlong malformed line or frame
+#define LOADGEN_OVERLONG_SIZE 1500 // Length of an overlong malformed line (longer than the plotter's 1023)
+#define LOADGEN_OVERLONG_FRAME_SIZE 2500 // Length of an overlong malformed frame (longer than the plotter's 2047)
+#define LOADGEN_STDERR_SIZE 4096 // Size of the buffer the plotter's stderr is read into
+#define DEFAULT_LINE_RATE 1000 // Default lines per second
+#define DEFAULT_CHANNELS 2 // Default number of y channels
+#define DEFAULT_REPORT_INTERVAL 1 // Default seconds between reports
+#define PACKET_INT32 1 // The plotter's packet sample type for little endian int32 values
+#define SLIP_END 0xC0 // SLIP frame delimiter
+#define SLIP_ESC 0xDB // SLIP escape byte
+#define SLIP_ESC_END 0xDC // SLIP escaped frame delimiter
+#define SLIP_ESC_ESC 0xDD // SLIP escaped escape byte
+
+// Formats the lines are written in, the names are passed to the plotter's --protocol option
+typedef enum {
+    PROTOCOL_CSV,
+    PROTOCOL_COBS,
+    PROTOCOL_SLIP
+} protocol_t;
+
+const char *protocol_names[] = { "csv", "cobs", "slip" };
+
+// A struct to store the load generator options
+typedef struct {
+    long line_rate; // lines per second, 0 writes as fast as the plotter reads
+    int channels; // y values per line
+    int burst; // lines written back to back per burst
+    double malformed; // fraction of the lines that are malformed
+    protocol_t protocol; // csv lines or framed binary packets
+    long duration; // seconds to run, 0 runs until SIGINT or SIGTERM
+    int interval; // seconds between reports
+    const char *log_path; // csv file the reports are appended to, NULL for none
+    char **command; // the plotter command line, NULL to only create the pty
+} loadgen_config_t;
+
+// Global load generator options
+loadgen_config_t config = {
+    .line_rate = DEFAULT_LINE_RATE,
+    .channels = DEFAULT_CHANNELS,
+    .burst = 1,
+    .malformed = 0.0,
+    .protocol = PROTOCOL_CSV,
+    .duration = 0,
+    .interval = DEFAULT_REPORT_INTERVAL,
+    .log_path = NULL,
+    .command = NULL
+};
+
+// A struct to store the counters of one run, written by the writer and the stderr reader and read by the reports
+typedef struct {
+    unsigned long lines; // lines written
+    unsigned long malformed; // malformed lines written
+    unsigned long bytes; // bytes written
+    uint64_t max_stall_ns; // longest wait for the pty to take a line since the last report
+    atomic_ulong rejected; // lines the plotter reported as failed to parse
+    atomic_ulong discarded; // overlong lines the plotter reported as discarded
+    atomic_ulong dropped; // samples the plotter reported as dropped because its queue was full
+} loadgen_counters_t;
+
+// A global variable to store the counters
+loadgen_counters_t counters;
+
+// A struct to store a sample of the plotter's resource usage
+typedef struct {
+    unsigned long cpu_ticks; // user and system time in clock ticks
+    long rss_kb; // resident set size in KiB
+} process_usage_t;
+
+// A global variable to store the master side of the pseudo-terminal
+int pty_master = -1;
+
+// A global variable to store the slave side, kept open so the pty stays up while the plotter reopens it
+int pty_slave = -1;
+
+// A global variable to store the plotter's process id, 0 when no plotter was started
+pid_t plotter_pid = 0;
+
+// A global variable to store the read end of the pipe carrying the plotter's stderr
+int plotter_stderr = -1;
+
+// A global flag set by SIGINT and SIGTERM or when the plotter exits
+volatile sig_atomic_t loadgen_stop = 0;
+
+// Function to print usage information
+void print_usage(const char *program_name) {
+    printf("Usage: %s [OPTIONS] [-- PLOTTER [PLOTTER OPTIONS]]\n", program_name);
+    printf("\nOptions:\n");
+    printf("  -r, --rate LINES         Lines per second, 0 for as fast as the plotter reads (default: %d)\n",
+           DEFAULT_LINE_RATE);
+    printf("  -c, --channels COUNT     Y values per line, 1 to %d (default: %d)\n", LOADGEN_MAX_CHANNELS,
+           DEFAULT_CHANNELS);
+    printf("  -b, --burst LINES        Lines written back to back per burst, same average rate (default: 1)\n");
+    printf("  -e, --malformed PERCENT  Percentage of malformed lines (default: 0)\n");
+    printf("  -P, --protocol NAME      Line format: csv, or cobs and slip binary packets (default: csv)\n");
+    printf("  -t, --duration SECONDS   Seconds to run (default: until interrupted)\n");
+    printf("  -i, --interval SECONDS   Seconds between reports (default: %d)\n", DEFAULT_REPORT_INTERVAL);
+    printf("  -l, --log PATH           Append every report to a csv file\n");
+    printf("  -h, --help               Display this help message\n");
+    printf("\nDescription:\n");
+    printf("  Creates a pseudo-terminal, starts PLOTTER with --port set to its slave side and writes csv\n");
+    printf("  lines (x,y1[,y2,...]) into it. Without PLOTTER the slave path is printed for use by hand.\n");
+    printf("  With a binary protocol each line is one packet of int32 values (y in hundredths) and the\n");
+    printf("  plotter is also given --protocol NAME.\n");
+    printf("\nExamples:\n");
+    printf("  %s --rate 50000 --channels 4 -- ./graph --headless -s 100000\n", program_name);
+    printf("  %s --rate 2000 --burst 200 --malformed 1 --duration 7200 --log soak.csv -- ./graph\n",
+           program_name);
+}
+
+// Function to parse command line arguments
+int parse_arguments(int argc, char *argv[]) {
+    static struct option long_options[] = {
+        {"rate", required_argument, 0, 'r'},
+        {"channels", required_argument, 0, 'c'},
+        {"burst", required_argument, 0, 'b'},
+        {"malformed", required_argument, 0, 'e'},
+        {"protocol", required_argument, 0, 'P'},
+        {"duration", required_argument, 0, 't'},
+        {"interval", required_argument, 0, 'i'},
+        {"log", required_argument, 0, 'l'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    int option_index = 0;
+
+    // Stop at the first non-option so the plotter's own options are left alone
+    while ((opt = getopt_long(argc, argv, "+r:c:b:e:P:t:i:l:h", long_options, &option_index)) != -1) {
+        switch (opt) {
+            case 'r':
+                config.line_rate = atol(optarg);
+                if (config.line_rate < 0) {
+                    fprintf(stderr, "Rate must be 0 or more lines per second\n");
+                    return -1;
+                }
+                break;
+            case 'c':
+                config.channels = atoi(optarg);
+                if (config.channels < 1 || config.channels > LOADGEN_MAX_CHANNELS) {
+                    fprintf(stderr, "Channels must be between 1 and %d\n", LOADGEN_MAX_CHANNELS);
+                    return -1;
+                }
+                break;
+            case 'b':
+                config.burst = atoi(optarg);
+                if (config.burst < 1) {
+                    fprintf(stderr, "Burst must be at least 1 line\n");
+                    return -1;
+                }
+                break;
+            case 'e':
+                config.malformed = atof(optarg) / 100.0;
+                if (config.malformed < 0.0 || config.malformed > 1.0) {
+                    fprintf(stderr, "Malformed percentage must be between 0 and 100\n");
+                    return -1;
+                }
+                break;
+            case 'P':
+                if (strcmp(optarg, "csv") == 0) {
+                    config.protocol = PROTOCOL_CSV;
+                } else if (strcmp(optarg, "cobs") == 0) {
+                    config.protocol = PROTOCOL_COBS;
+                } else if (strcmp(optarg, "slip") == 0) {
+                    config.protocol = PROTOCOL_SLIP;
+                } else {
+                    fprintf(stderr, "Protocol must be csv, cobs or slip\n");
+                    return -1;
+                }
+                break;
+            case 't':
+                config.duration = atol(optarg);
+                if (config.duration < 0) {
+                    fprintf(stderr, "Duration must be 0 or more seconds\n");
+                    return -1;
+                }
+                break;
+            case 'i':
+                config.interval = atoi(optarg);
+                if (config.interval < 1) {
+                    fprintf(stderr, "Interval must be at least 1 second\n");
+                    return -1;
+                }
+                break;
+            case 'l':
+                config.log_path = optarg;
+                break;
+            case 'h':
+                print_usage(argv[0]);
+                exit(0);
+            default:
+                print_usage(argv[0]);
+                return -1;
+        }
+    }
+
+    // Everything after the options (and an optional --) is the plotter command line
+    if (optind < argc) {
+        config.command = argv + optind;
+    }
+
+    return 0;
+}
+
+// A function to get the time of the monotonic clock in nanoseconds
+uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// A function to handle SIGINT and SIGTERM
+void loadgen_signal(int signal_number) {
+    loadgen_stop = 1;
+}
+
+// A function to create the pseudo-terminal pair and put the slave side in raw mode
+// The plotter sets its own attributes when it opens the port, raw mode only covers the lines written before that
+int pty_init() {
+    // Open the master side and unlock the slave side
+    pty_master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (pty_master == -1) {
+        perror("posix_openpt");
+        return -1;
+    }
+    if (grantpt(pty_master) == -1 || unlockpt(pty_master) == -1) {
+        perror("unlockpt");
+        return -1;
+    }
+
+    // Open the slave side, a pty whose slave was never opened or is closed again fails writes with EIO
+    const char *slave_path = ptsname(pty_master);
+    if (slave_path == NULL) {
+        perror("ptsname");
+        return -1;
+    }
+    pty_slave = open(slave_path, O_RDWR | O_NOCTTY);
+    if (pty_slave == -1) {
+        perror("open");
+        return -1;
+    }
+
+    // No echo, no line editing and no translation of the written bytes
+    struct termios options;
+    if (tcgetattr(pty_slave, &options) == -1) {
+        perror("tcgetattr");
+        return -1;
+    }
+    cfmakeraw(&options);
+    if (tcsetattr(pty_slave, TCSANOW, &options) == -1) {
+        perror("tcsetattr");
+        return -1;
+    }
+
+    // Write without blocking, so the writer can notice the plotter exiting while the pty is full
+    if (fcntl(pty_master, F_SETFL, fcntl(pty_master, F_GETFL) | O_NONBLOCK) == -1) {
+        perror("fcntl");
+        return -1;
+    }
+
+    return 0;
+}
+
+// A function to start the plotter on the slave side with its stdout discarded and its stderr piped to us
+int plotter_start(const char *slave_path) {
+    // Create the pipe for the plotter's stderr
+    int pipe_fds[2];
+    if (pipe(pipe_fds) == -1) {
+        perror("pipe");
+        return -1;
+    }
+
+    // Build the plotter argument list: the command, --port SLAVE, --protocol NAME for binary packets,
+    // then the plotter options
+    int count = 0;
+    while (config.command[count] != NULL) {
+        count++;
+    }
+    char **arguments = calloc(count + 5, sizeof(char *));
+    if (arguments == NULL) {
+        perror("calloc");
+        return -1;
+    }
+    int used = 0;
+    arguments[used++] = config.command[0];
+    arguments[used++] = "--port";
+    arguments[used++] = (char *)slave_path;
+    if (config.protocol != PROTOCOL_CSV) {
+        arguments[used++] = "--protocol";
+        arguments[used++] = (char *)protocol_names[config.protocol];
+    }
+    for (int i = 1; i < count; i++) {
+        arguments[used++] = config.command[i];
+    }
+
+    plotter_pid = fork();
+    if (plotter_pid == -1) {
+        perror("fork");
+        free(arguments);
+        return -1;
+    }
+    if (plotter_pid == 0) {
+        // In the plotter: stderr to the pipe
+        dup2(pipe_fds[1], STDERR_FILENO);
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        close(pty_master);
+        close(pty_slave);
+        execvp(arguments[0], arguments);
+        perror("execvp");
+        _exit(127);
+    }
+
+    free(arguments);
+    close(pipe_fds[1]);
+    plotter_stderr = pipe_fds[0];
+
+    return 0;
+}
+
+// A function to count one line of the plotter's stderr, lines that are not counted are passed on to our stderr
+void plotter_stderr_line(const char *line) {
+    unsigned long dropped;
+    if (strncmp(line, "Failed to parse csv line:", 25) == 0 || strncmp(line, "Failed to decode packet:", 24) == 0) {
+        atomic_fetch_add_explicit(&counters.rejected, 1, memory_order_relaxed);
+    } else if (strncmp(line, "Discarding serial line longer than", 34) == 0) {
+        atomic_fetch_add_explicit(&counters.discarded, 1, memory_order_relaxed);
+    } else if (sscanf(line, "Sample queue full, dropped %lu samples", &dropped) == 1) {
+        // The plotter reports a running total, keep the largest
+        unsigned long seen = atomic_load_explicit(&counters.dropped, memory_order_relaxed);
+        while (dropped > seen &&
+               !atomic_compare_exchange_weak_explicit(&counters.dropped, &seen, dropped,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+        }
+    } else if (strncmp(line, "Invalid csv format:", 19) != 0 && strncmp(line, "Expected ", 9) != 0) {
+        // The details printed before "Failed to parse csv line" are not counted twice
+        fprintf(stderr, "plotter: %s\n", line);
+    }
+}
+
+// A function to read the plotter's stderr in a separate thread until the plotter closes it
+void *plotter_stderr_thread(void *arg) {
+    static char buffer[LOADGEN_STDERR_SIZE];
+    size_t used = 0;
+
+    while (1) {
+        ssize_t count = read(plotter_stderr, buffer + used, sizeof(buffer) - 1 - used);
+        if (count == -1 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            break;
+        }
+        used += count;
+
+        // Count every complete line and keep the partial one
+        char *start = buffer;
+        char *end;
+        while ((end = memchr(start, '\n', buffer + used - start)) != NULL) {
+            *end = '\0';
+            plotter_stderr_line(start);
+            start = end + 1;
+        }
+        used -= start - buffer;
+        memmove(buffer, start, used);
+
+        // A line longer than the buffer (a long malformed line echoed back) is cut
+        if (used == sizeof(buffer) - 1) {
+            buffer[used] = '\0';
+            plotter_stderr_line(buffer);
+            used = 0;
+        }
+    }
+
+    return NULL;
+}
+
+// A function to read the CPU time and resident set size of a process from /proc
+// Returns -1 when the process is gone
+int process_usage_read(pid_t pid, process_usage_t *usage) {
+    char path[64];
+    char data[1024];
+
+    // /proc/PID/stat: the fields after the command name in parentheses, utime and stime are fields 14 and 15
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return -1;
+    }
+    size_t size = fread(data, 1, sizeof(data) - 1, file);
+    fclose(file);
+    data[size] = '\0';
+    char *fields = strrchr(data, ')');
+    if (fields == NULL) {
+        return -1;
+    }
+    unsigned long utime, stime;
+    long rss_pages;
+    if (sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu %*d %*d %*d %*d %*d %*d %*u %*u %ld",
+               &utime, &stime, &rss_pages) != 3) {
+        return -1;
+    }
+
+    usage->cpu_ticks = utime + stime;
+    usage->rss_kb = rss_pages * (sysconf(_SC_PAGESIZE) / 1024);
+    return 0;
+}
+
+// A global variable to store the state of the line generator
+uint64_t random_state = 0x853c49e6748fea9bull;
+
+// A function to get the next pseudo-random number
+uint32_t random_next() {
+    random_state = random_state * 6364136223846793005ull + 1442695040888963407ull;
+    return (uint32_t)(random_state >> 32);
+}
+
+// A function to format line number n into a buffer, a well formed line or one of four kinds of malformed lines
+// Returns the length of the line including the line break
+int line_format(char *line, unsigned long n, int malformed) {
+    int length = snprintf(line, LOADGEN_LINE_SIZE, "%lu", n);
+
+    // Well formed lines: one sine-like triangle wave per channel, shifted by the channel, plus noise
+    int channels = config.channels;
+    if (malformed) {
+        switch (n % 4) {
+            case 0:
+                // Wrong number of channels
+                channels = (config.channels == LOADGEN_MAX_CHANNELS) ? 1 : config.channels + 1;
+                break;
+            case 1:
+                // A field that is not a number
+                length += snprintf(line + length, LOADGEN_LINE_SIZE - length, ",abc\n");
+                return length;
+            case 2:
+                // A missing field
+                length += snprintf(line + length, LOADGEN_LINE_SIZE - length, ",,\n");
+                return length;
+            default:
+                // A line longer than the plotter accepts
+                memset(line + length, '7', LOADGEN_OVERLONG_SIZE);
+                length += LOADGEN_OVERLONG_SIZE;
+                line[length++] = '\n';
+                return length;
+        }
+    }
+    for (int c = 0; c < channels; c++) {
+        long phase = (long)((n + c * 250) % 1000);
+        long wave = (phase < 500) ? phase : 1000 - phase;
+        length += snprintf(line + length, LOADGEN_LINE_SIZE - length, ",%ld.%02u", wave - 250, random_next() % 100);
+    }
+    line[length++] = '\n';
+    return length;
+}
+
+// A function to compute the CRC-16/CCITT (polynomial 0x1021, initial value 0xFFFF) the plotter checks
+uint16_t crc16(const uint8_t *data, size_t size) {
+    uint16_t crc = 0xFFFF;
+    for (size_t i = 0; i < size; i++) {
+        crc ^= (uint16_t)(data[i] << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        }
+    }
+    return crc;
+}
+
+// A function to frame a packet with COBS followed by its zero delimiter
+// Returns the length of the frame
+int cobs_encode(const uint8_t *packet, int size, uint8_t *frame) {
+    int length = 1;
+    int code_index = 0;
+    uint8_t code = 1;
+    for (int i = 0; i < size; i++) {
+        if (packet[i] != 0) {
+            frame[length++] = packet[i];
+            code++;
+        }
+        // A zero, or a run of 254 non-zero bytes, closes the current block
+        if (packet[i] == 0 || code == 0xFF) {
+            frame[code_index] = code;
+            code = 1;
+            code_index = length++;
+        }
+    }
+    frame[code_index] = code;
+    frame[length++] = 0;
+    return length;
+}
+
+// A function to frame a packet with SLIP followed by its delimiter
+// Returns the length of the frame
+int slip_encode(const uint8_t *packet, int size, uint8_t *frame) {
+    int length = 0;
+    for (int i = 0; i < size; i++) {
+        if (packet[i] == SLIP_END) {
+            frame[length++] = SLIP_ESC;
+            frame[length++] = SLIP_ESC_END;
+        } else if (packet[i] == SLIP_ESC) {
+            frame[length++] = SLIP_ESC;
+            frame[length++] = SLIP_ESC_ESC;
+        } else {
+            frame[length++] = packet[i];
+        }
+    }
+    frame[length++] = SLIP_END;
+    return length;
+}
+
+// A function to format line number n as a framed binary packet, well formed or one of four kinds of malformed packets
+// The packet holds the channel count, the int32 type, the sequence number n, then x = n and the y values in
+// hundredths, then the CRC, all little endian
+// Returns the length of the frame including its delimiter
+int packet_format(char *line, unsigned long n, int malformed) {
+    uint8_t packet[4 + (LOADGEN_MAX_CHANNELS + 2) * 4 + 2];
+    int channels = config.channels;
+    if (malformed && n % 4 == 0) {
+        // Wrong number of channels
+        channels = (config.channels == LOADGEN_MAX_CHANNELS) ? 1 : config.channels + 1;
+    }
+    if (malformed && n % 4 == 3) {
+        // A frame longer than the plotter accepts (no delimiter byte inside)
+        memset(line, '7', LOADGEN_OVERLONG_FRAME_SIZE);
+        line[LOADGEN_OVERLONG_FRAME_SIZE] = (config.protocol == PROTOCOL_COBS) ? 0 : (char)SLIP_END;
+        return LOADGEN_OVERLONG_FRAME_SIZE + 1;
+    }
+
+    // Header, then the values
+    int length = 0;
+    packet[length++] = (uint8_t)channels;
+    packet[length++] = PACKET_INT32;
+    packet[length++] = (uint8_t)(n & 0xFF);
+    packet[length++] = (uint8_t)((n >> 8) & 0xFF);
+    for (int c = -1; c < channels; c++) {
+        int32_t value = (int32_t)n;
+        if (c >= 0) {
+            long phase = (long)((n + c * 250) % 1000);
+            long wave = (phase < 500) ? phase : 1000 - phase;
+            value = (int32_t)((wave - 250) * 100 + random_next() % 100);
+        }
+        uint32_t bits = (uint32_t)value;
+        for (int byte = 0; byte < 4; byte++) {
+            packet[length++] = (uint8_t)(bits >> (8 * byte));
+        }
+    }
+
+    // The CRC, broken on purpose for a corrupted packet, dropped with the last values for a truncated one
+    uint16_t crc = crc16(packet, length);
+    if (malformed && n % 4 == 1) {
+        crc ^= 0x5A5A;
+    }
+    if (malformed && n % 4 == 2) {
+        length -= 3;
+    }
+    packet[length++] = (uint8_t)(crc & 0xFF);
+    packet[length++] = (uint8_t)(crc >> 8);
+
+    if (config.protocol == PROTOCOL_COBS) {
+        return cobs_encode(packet, length, (uint8_t *)line);
+    }
+    return slip_encode(packet, length, (uint8_t *)line);
+}
+
+// A function to write a whole line into the pty, waiting while it is full
+// Returns -1 when the plotter is gone or the run was stopped
+int line_write(const char *line, int length) {
+    int written = 0;
+    uint64_t stall_start = 0;
+
+    while (written < length) {
+        ssize_t count = write(pty_master, line + written, length - written);
+        if (count > 0) {
+            written += count;
+            continue;
+        }
+        if (count == -1 && errno != EAGAIN && errno != EINTR) {
+            perror("write");
+            return -1;
+        }
+
+        // The pty is full: the plotter is not reading fast enough, wait and measure the stall
+        if (stall_start == 0) {
+            stall_start = monotonic_ns();
+        }
+        if (loadgen_stop) {
+            return -1;
+        }
+        struct pollfd pfd = { .fd = pty_master, .events = POLLOUT };
+        poll(&pfd, 1, 100);
+    }
+
+    if (stall_start != 0) {
+        uint64_t stall = monotonic_ns() - stall_start;
+        if (stall > counters.max_stall_ns) {
+            counters.max_stall_ns = stall;
+        }
+    }
+
+    counters.lines++;
+    counters.bytes += length;
+    return 0;
+}
+
+// A global variable to store the log file
+FILE *log_file = NULL;
+
+// A struct to store the state of the previous report
+typedef struct {
+    uint64_t time_ns;
+    unsigned long lines;
+    unsigned long bytes;
+    process_usage_t usage;
+    long first_rss_kb; // RSS at the first report
+    long last_rss_kb; // RSS at the last report the plotter was still running
+    long max_rss_kb; // largest RSS seen
+    uint64_t max_stall_ns; // longest stall seen
+} report_state_t;
+
+// A global variable to store the state of the previous report
+report_state_t report_state;
+
+// A function to print a report of the interval since the previous one and append it to the log
+void report(uint64_t start_ns) {
+    uint64_t now = monotonic_ns();
+    double seconds = (now - report_state.time_ns) * 1e-9;
+    double elapsed = (now - start_ns) * 1e-9;
+    double rate = (counters.lines - report_state.lines) / seconds;
+    double mb_rate = (counters.bytes - report_state.bytes) / seconds / 1e6;
+
+    // Read the plotter's CPU and RSS
+    process_usage_t usage = { 0, -1 };
+    double cpu = -1.0;
+    if (plotter_pid > 0 && process_usage_read(plotter_pid, &usage) == 0) {
+        cpu = (usage.cpu_ticks - report_state.usage.cpu_ticks) * 100.0 / sysconf(_SC_CLK_TCK) / seconds;
+        if (report_state.first_rss_kb == 0) {
+            report_state.first_rss_kb = usage.rss_kb;
+        }
+        report_state.last_rss_kb = usage.rss_kb;
+        if (usage.rss_kb > report_state.max_rss_kb) {
+            report_state.max_rss_kb = usage.rss_kb;
+        }
+    }
+    if (counters.max_stall_ns > report_state.max_stall_ns) {
+        report_state.max_stall_ns = counters.max_stall_ns;
+    }
+
+    unsigned long rejected = atomic_load_explicit(&counters.rejected, memory_order_relaxed);
+    unsigned long discarded = atomic_load_explicit(&counters.discarded, memory_order_relaxed);
+    unsigned long dropped = atomic_load_explicit(&counters.dropped, memory_order_relaxed);
+    printf("%8.0f s  %10.0f lines/s  %7.2f MB/s  lines %lu  malformed %lu  rejected %lu  discarded %lu  "
+           "dropped %lu  stall %.1f ms", elapsed, rate, mb_rate, counters.lines, counters.malformed, rejected,
+           discarded, dropped, counters.max_stall_ns * 1e-6);
+    if (cpu >= 0.0) {
+        printf("  cpu %.1f%%  rss %ld KiB", cpu, usage.rss_kb);
+    }
+    printf("\n");
+    fflush(stdout);
+
+    if (log_file != NULL) {
+        fprintf(log_file, "%.3f,%.1f,%lu,%lu,%lu,%lu,%lu,%.3f,%.1f,%ld\n", elapsed, rate, counters.lines,
+                counters.malformed, rejected, discarded, dropped, counters.max_stall_ns * 1e-6, cpu, usage.rss_kb);
+        fflush(log_file);
+    }
+
+    report_state.time_ns = now;
+    report_state.lines = counters.lines;
+    report_state.bytes = counters.bytes;
+    report_state.usage = usage;
+    counters.max_stall_ns = 0;
+}
+
+// A function to print the totals of the run
+void report_summary(uint64_t start_ns) {
+    double elapsed = (monotonic_ns() - start_ns) * 1e-9;
+    unsigned long rejected = atomic_load_explicit(&counters.rejected, memory_order_relaxed);
+    unsigned long discarded = atomic_load_explicit(&counters.discarded, memory_order_relaxed);
+    unsigned long dropped = atomic_load_explicit(&counters.dropped, memory_order_relaxed);
+
+    printf("\nSummary:\n");
+    printf("  Duration: %.1f s\n", elapsed);
+    printf("  Lines written: %lu (%.0f lines/s, %.2f MB/s)\n", counters.lines, counters.lines / elapsed,
+           counters.bytes / elapsed / 1e6);
+    printf("  Malformed written: %lu, rejected: %lu, discarded as too long: %lu\n", counters.malformed, rejected,
+           discarded);
+    printf("  Dropped by the plotter (queue full): %lu\n", dropped);
+    unsigned long lost = rejected + discarded + dropped;
+    printf("  Accepted by the plotter: %lu\n", (counters.lines > lost) ? counters.lines - lost : 0);
+    printf("  Longest write stall: %.1f ms\n", report_state.max_stall_ns * 1e-6);
+    if (report_state.first_rss_kb > 0) {
+        printf("  Plotter RSS: %ld KiB at the first report, %ld KiB at the last, %ld KiB at most\n",
+               report_state.first_rss_kb, report_state.last_rss_kb, report_state.max_rss_kb);
+    }
+}
+
+// A function to write lines at the configured rate until the duration is over, the run is stopped or the plotter exits
+// Returns the start time of the run
+uint64_t loadgen_run() {
+    static char line[LOADGEN_LINE_SIZE];
+    uint64_t start = monotonic_ns();
+    uint64_t end = (config.duration > 0) ? start + config.duration * 1000000000ull : UINT64_MAX;
+    uint64_t report_period = config.interval * 1000000000ull;
+    uint64_t next_report = start + report_period;
+    uint64_t burst_period = (config.line_rate > 0) ? config.burst * 1000000000ull / config.line_rate : 0;
+    uint64_t next_burst = start;
+    uint32_t malformed_threshold = (uint32_t)(config.malformed * 4294967295.0);
+    unsigned long n = 0;
+
+    report_state.time_ns = start;
+    if (plotter_pid > 0) {
+        process_usage_read(plotter_pid, &report_state.usage);
+    }
+
+    while (!loadgen_stop) {
+        // Write one burst of lines back to back
+        for (int i = 0; i < config.burst && !loadgen_stop; i++) {
+            // The first line is always well formed, the plotter takes its channel count from it
+            int malformed = (n > 0 && config.malformed > 0.0 && random_next() <= malformed_threshold);
+            int length = (config.protocol == PROTOCOL_CSV) ? line_format(line, n++, malformed)
+                                                           : packet_format(line, n++, malformed);
+            if (line_write(line, length) == -1) {
+                loadgen_stop = 1;
+                break;
+            }
+            counters.malformed += malformed;
+        }
+
+        // Check if the plotter exited
+        if (plotter_pid > 0 && waitpid(plotter_pid, NULL, WNOHANG) == plotter_pid) {
+            fprintf(stderr, "The plotter exited\n");
+            plotter_pid = 0;
+            loadgen_stop = 1;
+        }
+
+        uint64_t now = monotonic_ns();
+        if (now >= next_report) {
+            report(start);
+            next_report += report_period;
+        }
+        if (now >= end) {
+            break;
+        }
+
+        // Wait for the next burst, restarting the schedule when more than a second behind (the plotter stalled us)
+        if (burst_period > 0) {
+            next_burst += burst_period;
+            if (now > next_burst + 1000000000ull) {
+                next_burst = now;
+            }
+            uint64_t wake = (next_burst < next_report) ? next_burst : next_report;
+            if (wake > now) {
+                struct timespec deadline = { (time_t)(wake / 1000000000ull), (long)(wake % 1000000000ull) };
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL);
+            }
+        }
+    }
+
+    // Report the lines written since the last report
+    if (counters.lines != report_state.lines) {
+        report(start);
+    }
+    return start;
+}
+
+// The main function
+int main(int argc, char *argv[]) {
+    // Parse command line arguments
+    if (parse_arguments(argc, argv) != 0) {
+        return 1;
+    }
+
+    // Stop cleanly on SIGINT and SIGTERM, and write to a plotter that is gone without being killed
+    struct sigaction action = { 0 };
+    action.sa_handler = loadgen_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Create the pseudo-terminal pair
+    if (pty_init() == -1) {
+        return 1;
+    }
+    const char *slave_path = ptsname(pty_master);
+
+    // Open the log file and write its header
+    if (config.log_path != NULL) {
+        log_file = fopen(config.log_path, "a");
+        if (log_file == NULL) {
+            perror("fopen");
+            return 1;
+        }
+        fprintf(log_file, "seconds,lines_per_s,lines,malformed,rejected,discarded,dropped,max_stall_ms,cpu_percent,"
+                "rss_kb\n");
+    }
+
+    // Print the configuration
+    printf("Load generator:\n");
+    printf("  Pty: %s\n", slave_path);
+    printf("  Rate: ");
+    if (config.line_rate > 0) {
+        printf("%ld lines/s", config.line_rate);
+    } else {
+        printf("as fast as the plotter reads");
+    }
+    printf(", bursts of %d lines, %d channels, %.2f%% malformed, %s\n", config.burst, config.channels,
+           config.malformed * 100.0, protocol_names[config.protocol]);
+    if (config.duration > 0) {
+        printf("  Duration: %ld s\n", config.duration);
+    }
+
+    // Start the plotter and the thread counting what it reports on stderr
+    pthread_t thread;
+    if (config.command != NULL) {
+        if (plotter_start(slave_path) == -1) {
+            return 1;
+        }
+        printf("  Plotter: %s (pid %d)\n", config.command[0], (int)plotter_pid);
+        if (pthread_create(&thread, NULL, plotter_stderr_thread, NULL) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+    printf("\n");
+
+    // Write until the duration is over or the run is stopped
+    uint64_t start = loadgen_run();
+
+    // Stop the plotter and wait for its last messages (a headless plotter prints its final drop count)
+    if (plotter_pid > 0) {
+        kill(plotter_pid, SIGTERM);
+        waitpid(plotter_pid, NULL, 0);
+    }
+    if (config.command != NULL) {
+        pthread_join(thread, NULL);
+        close(plotter_stderr);
+    }
+    report_summary(start);
+
+    // Close the pseudo-terminal and the log
+    close(pty_slave);
+    close(pty_master);
+    if (log_file != NULL) {
+        fclose(log_file);
+    }
+
+    return 0;
+}